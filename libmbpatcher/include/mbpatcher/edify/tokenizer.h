@@ -22,6 +22,8 @@
 #include <string>
 #include <vector>
 
+#include <cstdint>
+
 #include "mbcommon/common.h"
 
 namespace mb
@@ -269,6 +271,70 @@ private:
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/*!
+ * \brief Token in an EdifyTokenStream
+ *
+ * Flat tokens do not own any data. They refer to their text in the buffer that
+ * was tokenized.
+ */
+struct EdifyFlatToken
+{
+    EdifyTokenType type;
+    uint32_t offset;
+    uint32_t size;
+};
+
+/*!
+ * \brief Function call in an EdifyTokenStream
+ *
+ * The fields are token indexes. If the function's parentheses are unbalanced,
+ * \a right_paren is EdifyTokenStream::npos.
+ */
+struct EdifyFunctionCall
+{
+    std::size_t name;
+    std::size_t left_paren;
+    std::size_t right_paren;
+};
+
+/*!
+ * \brief Flat edify token stream with a function call index
+ *
+ * The tokens are stored contiguously and refer to the tokenized buffer, which
+ * must outlive the stream. Function calls are indexed once during
+ * tokenization and are listed in the order they appear in the buffer.
+ */
+class EdifyTokenStream
+{
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    EdifyTokenStream();
+
+    bool tokenize(const char *data, std::size_t size);
+
+    const std::vector<EdifyFlatToken> & tokens() const;
+    const std::vector<EdifyFunctionCall> & function_calls() const;
+
+    std::string text(std::size_t index) const;
+    bool unescaped_string(std::size_t index, std::string &out) const;
+
+    const char * data() const;
+    std::size_t size() const;
+
+private:
+    const char *m_data;
+    std::size_t m_size;
+    std::vector<EdifyFlatToken> m_tokens;
+    std::vector<EdifyFunctionCall> m_calls;
+
+    void index_function_calls();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(EdifyTokenStream)
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 class EdifyTokenizer
 {
 public:
@@ -283,9 +349,13 @@ public:
 private:
     static bool is_valid_unquoted(char c);
 
+    static bool scan_token(const char *data, std::size_t size,
+                           std::size_t *pos, EdifyTokenType *type);
     static bool next_token(const char *data, std::size_t size, std::size_t *pos,
                            EdifyToken **token);
 
+    friend class EdifyTokenStream;
+
     MB_DISABLE_DEFAULT_CONSTRUCTOR(EdifyTokenizer)
     MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(EdifyTokenizer)
     MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(EdifyTokenizer)
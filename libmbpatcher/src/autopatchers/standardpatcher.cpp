@@ -19,14 +19,15 @@
 
 #include "mbpatcher/autopatchers/standardpatcher.h"
 
+#include <cinttypes>
 #include <cstring>
 
+#include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 
 #include "mbpatcher/edify/tokenizer.h"
 #include "mbpatcher/private/fileutils.h"
-#include "mbpatcher/private/stringutils.h"
 
 #define LOG_TAG "mbpatcher/autopatchers/standardpatcher"
 
@@ -48,6 +49,8 @@ const std::string StandardPatcher::UpdaterScript
 const std::string StandardPatcher::SystemTransferList
         = "system.transfer.list";
 
+static constexpr std::size_t TRANSFER_LIST_BUF_SIZE = 64 * 1024;
+
 static constexpr char MOUNT_FMT[] =
         "(run_program(\"/update-binary-tool\", \"mount\", \"%s\") == 0)";
 static constexpr char UNMOUNT_FMT[] =
@@ -96,163 +99,35 @@ static bool find_items_in_string(const std::string &haystack,
     return false;
 }
 
-static bool find_function(const std::vector<EdifyToken *>::iterator begin,
-                          const std::vector<EdifyToken *>::iterator end,
-                          std::vector<EdifyToken *>::iterator *out_func_name,
-                          std::vector<EdifyToken *>::iterator *out_left_paren,
-                          std::vector<EdifyToken *>::iterator *out_right_paren)
-{
-    std::vector<EdifyToken *>::iterator func_name;
-    std::vector<EdifyToken *>::iterator left_paren;
-    std::vector<EdifyToken *>::iterator right_paren;
-
-    for (auto it = begin; it != end; ++it) {
-        // Find string representing the function name
-        if ((*it)->type() != EdifyTokenType::String) {
-            continue;
-        }
-
-        func_name = it;
-
-        bool found_left_paren = false;
-        bool found_right_paren = false;
-
-        // Barring any whitespace, newlines, or comments, the function name
-        // should be followed by a left parenthesis
-        for (auto it2 = it + 1; it2 != end; ++it2) {
-            if ((*it2)->type() == EdifyTokenType::Whitespace
-                    || (*it2)->type() == EdifyTokenType::Newline
-                    || (*it2)->type() == EdifyTokenType::Comment) {
-                continue;
-            } else if ((*it2)->type() == EdifyTokenType::LeftParen) {
-                found_left_paren = true;
-                left_paren = it2;
-            }
-            break;
-        }
-
-        // If a left parenthesis was not found, then the string token was not
-        // a function name
-        if (!found_left_paren) {
-            continue;
-        }
-
-        // Left for matching right parenthesis
-        std::size_t depth = 0;
-
-        for (auto it2 = left_paren; it2 != end; ++it2) {
-            if ((*it2)->type() == EdifyTokenType::LeftParen) {
-                ++depth;
-            } else if ((*it2)->type() == EdifyTokenType::RightParen) {
-                --depth;
-            }
-            if (depth == 0) {
-                found_right_paren = true;
-                right_paren = it2;
-                break;
-            }
-        }
-
-        // If a right parenthesis was not found, but the function name and left
-        // parenthesis were found, then assume there's a syntax error and bail
-        // out
-        if (!found_right_paren) {
-            return false;
-        }
-
-        *out_func_name = func_name;
-        *out_left_paren = left_paren;
-        *out_right_paren = right_paren;
-
-        return true;
-    }
-
-    return false;
-}
-
-/*!
- * \brief Replace edify function
- *
- * \param tokens List of edify tokens
- * \param func_name Function name token of the replaced function
- * \param left_paren Left parenthesis token of the replaced function
- * \param right_paren Right parenthesis token of the replaced function
- * \param replacement Replacement edify function (in string form)
- *
- * \return New iterator pointing to position *after* the right parenthesis of
- *         the replaced function. Returns tokens->end() if the replacement
- *         string could not be tokenized.
- */
-static std::vector<EdifyToken *>::iterator
-replace_function(std::vector<EdifyToken *> *tokens,
-                 std::vector<EdifyToken *>::iterator func_name,
-                 std::vector<EdifyToken *>::iterator left_paren,
-                 std::vector<EdifyToken *>::iterator right_paren,
-                 const std::string &replacement)
-{
-    // Included for completeness' sake
-    (void) left_paren;
-
-    std::vector<EdifyToken *> replacement_tokens;
-    bool result = EdifyTokenizer::tokenize(
-            replacement.data(), replacement.size(), &replacement_tokens);
-    if (!result) {
-        LOGE("Failed to tokenize replacement function string: %s",
-             replacement.c_str());
-        return tokens->end();
-    }
-
-    // Deallocate replaced tokens
-    for (auto it = func_name; it != right_paren; ++it) {
-        delete *it;
-    }
-    delete *right_paren;
-
-    // Remove replaced tokens
-    auto it = tokens->erase(func_name, right_paren);
-    it = tokens->erase(it);
-
-    // Add replacement tokens
-    it = tokens->insert(it, replacement_tokens.begin(),
-                        replacement_tokens.end());
-
-    // Move iterator to the end of the replaced tokens
-    it += static_cast<ptrdiff_t>(replacement_tokens.size());
-
-    return it;
-}
-
 /*!
  * \brief Replace edify mount() command
  *
- * \param tokens List of edify tokens
- * \param func_name Function name token
- * \param left_paren Left parenthesis token
- * \param right_paren Right parenthesis token
+ * \param stream Edify token stream
+ * \param call Function call to replace
  * \param system_devs List of system partition block devices
  * \param cache_devs List of cache partition block devices
  * \param data_devs List of data partition block devices
+ * \param replacement Output replacement edify function (in string form)
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \return Whether the function should be replaced
  */
-static std::vector<EdifyToken *>::iterator
-replace_edify_mount(std::vector<EdifyToken *> *tokens,
-                    const std::vector<EdifyToken *>::iterator func_name,
-                    const std::vector<EdifyToken *>::iterator left_paren,
-                    const std::vector<EdifyToken *>::iterator right_paren,
-                    const std::vector<std::string> &system_devs,
-                    const std::vector<std::string> &cache_devs,
-                    const std::vector<std::string> &data_devs)
+static bool replace_edify_mount(const EdifyTokenStream &stream,
+                                const EdifyFunctionCall &call,
+                                const std::vector<std::string> &system_devs,
+                                const std::vector<std::string> &cache_devs,
+                                const std::vector<std::string> &data_devs,
+                                std::string *replacement)
 {
+    auto const &tokens = stream.tokens();
+
     // For the mount() edify function, replace with the corresponding
     // update-binary-tool command
-    for (auto it = left_paren + 1; it != right_paren; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    for (auto i = call.left_paren + 1; i != call.right_paren; ++i) {
+        if (tokens[i].type != EdifyTokenType::String) {
             continue;
         }
 
-        auto token = static_cast<EdifyTokenString *>(*it);
-        const std::string str = token->string();
+        const std::string str = stream.text(i);
 
         bool is_system = str.find("/system") != std::string::npos
                 || find_items_in_string(str.c_str(), system_devs);
@@ -263,50 +138,48 @@ replace_edify_mount(std::vector<EdifyToken *> *tokens,
                 || find_items_in_string(str.c_str(), data_devs);
 
         if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/system"));
+            *replacement = format(MOUNT_FMT, "/system");
+            return true;
         } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/cache"));
+            *replacement = format(MOUNT_FMT, "/cache");
+            return true;
         } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/data"));
+            *replacement = format(MOUNT_FMT, "/data");
+            return true;
         }
     }
-    return right_paren + 1;
+    return false;
 }
 
 /*!
  * \brief Replace edify unmount() command
  *
- * \param tokens List of edify tokens
- * \param func_name Function name token
- * \param left_paren Left parenthesis token
- * \param right_paren Right parenthesis token
+ * \param stream Edify token stream
+ * \param call Function call to replace
  * \param system_devs List of system partition block devices
  * \param cache_devs List of cache partition block devices
  * \param data_devs List of data partition block devices
+ * \param replacement Output replacement edify function (in string form)
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \return Whether the function should be replaced
  */
-static std::vector<EdifyToken *>::iterator
-replace_edify_unmount(std::vector<EdifyToken *> *tokens,
-                      const std::vector<EdifyToken *>::iterator func_name,
-                      const std::vector<EdifyToken *>::iterator left_paren,
-                      const std::vector<EdifyToken *>::iterator right_paren,
-                      const std::vector<std::string> &system_devs,
-                      const std::vector<std::string> &cache_devs,
-                      const std::vector<std::string> &data_devs)
+static bool replace_edify_unmount(const EdifyTokenStream &stream,
+                                  const EdifyFunctionCall &call,
+                                  const std::vector<std::string> &system_devs,
+                                  const std::vector<std::string> &cache_devs,
+                                  const std::vector<std::string> &data_devs,
+                                  std::string *replacement)
 {
+    auto const &tokens = stream.tokens();
+
     // For the unmount() edify function, replace with the corresponding
     // update-binary-tool command
-    for (auto it = left_paren + 1; it != right_paren; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    for (auto i = call.left_paren + 1; i != call.right_paren; ++i) {
+        if (tokens[i].type != EdifyTokenType::String) {
             continue;
         }
 
-        auto token = static_cast<EdifyTokenString *>(*it);
-        const std::string str = token->string();
+        const std::string str = stream.text(i);
 
         bool is_system = str.find("/system") != std::string::npos
                 || find_items_in_string(str.c_str(), system_devs);
@@ -317,41 +190,40 @@ replace_edify_unmount(std::vector<EdifyToken *> *tokens,
                 || find_items_in_string(str.c_str(), data_devs);
 
         if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/system"));
+            *replacement = format(UNMOUNT_FMT, "/system");
+            return true;
         } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/cache"));
+            *replacement = format(UNMOUNT_FMT, "/cache");
+            return true;
         } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/data"));
+            *replacement = format(UNMOUNT_FMT, "/data");
+            return true;
         }
     }
-    return right_paren + 1;
+    return false;
 }
 
 /*!
  * \brief Replace edify run_program() command
  *
- * \param tokens List of edify tokens
- * \param func_name Function name token
- * \param left_paren Left parenthesis token
- * \param right_paren Right parenthesis token
+ * \param stream Edify token stream
+ * \param call Function call to replace
  * \param system_devs List of system partition block devices
  * \param cache_devs List of cache partition block devices
  * \param data_devs List of data partition block devices
+ * \param replacement Output replacement edify function (in string form)
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \return Whether the function should be replaced
  */
-static std::vector<EdifyToken *>::iterator
-replace_edify_run_program(std::vector<EdifyToken *> *tokens,
-                          const std::vector<EdifyToken *>::iterator func_name,
-                          const std::vector<EdifyToken *>::iterator left_paren,
-                          const std::vector<EdifyToken *>::iterator right_paren,
-                          const std::vector<std::string> &system_devs,
-                          const std::vector<std::string> &cache_devs,
-                          const std::vector<std::string> &data_devs)
+static bool replace_edify_run_program(const EdifyTokenStream &stream,
+                                      const EdifyFunctionCall &call,
+                                      const std::vector<std::string> &system_devs,
+                                      const std::vector<std::string> &cache_devs,
+                                      const std::vector<std::string> &data_devs,
+                                      std::string *replacement)
 {
+    auto const &tokens = stream.tokens();
+
     bool found_reboot = false;
     bool found_mount = false;
     bool found_umount = false;
@@ -361,13 +233,16 @@ replace_edify_run_program(std::vector<EdifyToken *> *tokens,
     bool is_cache = false;
     bool is_data = false;
 
-    for (auto it = left_paren + 1; it != right_paren; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    for (auto i = call.left_paren + 1; i != call.right_paren; ++i) {
+        if (tokens[i].type != EdifyTokenType::String) {
             continue;
         }
 
-        auto token = static_cast<EdifyTokenString *>(*it);
-        const std::string unescaped = token->unescaped_string();
+        std::string unescaped;
+        if (!stream.unescaped_string(i, unescaped)) {
+            // Don't guess what a malformed command does
+            return false;
+        }
 
         if (ends_with(unescaped, "reboot")) {
             found_reboot = true;
@@ -400,116 +275,102 @@ replace_edify_run_program(std::vector<EdifyToken *> *tokens,
         }
     }
 
+    const char *fmt = nullptr;
+
     if (found_reboot) {
-        return replace_function(tokens, func_name, left_paren, right_paren,
-                                "(ui_print(\"Removed reboot command\") == 0)");
+        *replacement = "(ui_print(\"Removed reboot command\") == 0)";
+        return true;
     } else if (found_umount) {
-        if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(UNMOUNT_FMT, "/data"));
-        }
+        fmt = UNMOUNT_FMT;
     } else if (found_mount) {
-        if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(MOUNT_FMT, "/data"));
-        }
+        fmt = MOUNT_FMT;
     } else if (found_format_sh) {
-        return replace_function(tokens, func_name, left_paren, right_paren,
-                                format(FORMAT_FMT, "/system"));
+        *replacement = format(FORMAT_FMT, "/system");
+        return true;
     } else if (found_mke2fs) {
-        if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/data"));
-        }
+        fmt = FORMAT_FMT;
+    } else {
+        return false;
+    }
+
+    if (is_system) {
+        *replacement = format(fmt, "/system");
+    } else if (is_cache) {
+        *replacement = format(fmt, "/cache");
+    } else if (is_data) {
+        *replacement = format(fmt, "/data");
+    } else {
+        return false;
     }
 
-    return right_paren + 1;
+    return true;
 }
 
 /*!
  * \brief Replace edify delete_recursive() command
  *
- * \param tokens List of edify tokens
- * \param func_name Function name token
- * \param left_paren Left parenthesis token
- * \param right_paren Right parenthesis token
+ * \param stream Edify token stream
+ * \param call Function call to replace
+ * \param replacement Output replacement edify function (in string form)
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \return Whether the function should be replaced
  */
-static std::vector<EdifyToken *>::iterator
-replace_edify_delete_recursive(std::vector<EdifyToken *> *tokens,
-                               const std::vector<EdifyToken *>::iterator func_name,
-                               const std::vector<EdifyToken *>::iterator left_paren,
-                               const std::vector<EdifyToken *>::iterator right_paren)
+static bool replace_edify_delete_recursive(const EdifyTokenStream &stream,
+                                           const EdifyFunctionCall &call,
+                                           std::string *replacement)
 {
-    for (auto it = left_paren + 1; it != right_paren; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    auto const &tokens = stream.tokens();
+
+    for (auto i = call.left_paren + 1; i != call.right_paren; ++i) {
+        if (tokens[i].type != EdifyTokenType::String) {
             continue;
         }
 
-        auto token = static_cast<EdifyTokenString *>(*it);
-        const std::string unescaped = token->unescaped_string();
+        std::string unescaped;
+        if (!stream.unescaped_string(i, unescaped)) {
+            return false;
+        }
 
         if (unescaped == "/system" || unescaped == "/system/") {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/system"));
+            *replacement = format(FORMAT_FMT, "/system");
+            return true;
         } else if (unescaped == "/cache" || unescaped == "/cache/") {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/cache"));
+            *replacement = format(FORMAT_FMT, "/cache");
+            return true;
         }
     }
-    return right_paren + 1;
+    return false;
 }
 
 /*!
  * \brief Replace edify format() command
  *
- * \param tokens List of edify tokens
- * \param func_name Function name token
- * \param left_paren Left parenthesis token
- * \param right_paren Right parenthesis token
+ * \param stream Edify token stream
+ * \param call Function call to replace
  * \param system_devs List of system partition block devices
  * \param cache_devs List of cache partition block devices
  * \param data_devs List of data partition block devices
+ * \param replacement Output replacement edify function (in string form)
  *
- * \return Iterator pointing to position immediately after the right parenthesis
+ * \return Whether the function should be replaced
  */
-static std::vector<EdifyToken *>::iterator
-replace_edify_format(std::vector<EdifyToken *> *tokens,
-                     const std::vector<EdifyToken *>::iterator func_name,
-                     const std::vector<EdifyToken *>::iterator left_paren,
-                     const std::vector<EdifyToken *>::iterator right_paren,
-                     const std::vector<std::string> &system_devs,
-                     const std::vector<std::string> &cache_devs,
-                     const std::vector<std::string> &data_devs)
+static bool replace_edify_format(const EdifyTokenStream &stream,
+                                 const EdifyFunctionCall &call,
+                                 const std::vector<std::string> &system_devs,
+                                 const std::vector<std::string> &cache_devs,
+                                 const std::vector<std::string> &data_devs,
+                                 std::string *replacement)
 {
+    auto const &tokens = stream.tokens();
+
     // For the format() edify function, replace with the corresponding
     // update-binary-tool command
-    for (auto it = left_paren + 1; it != right_paren; ++it) {
-        if ((*it)->type() != EdifyTokenType::String) {
+    for (auto i = call.left_paren + 1; i != call.right_paren; ++i) {
+        if (tokens[i].type != EdifyTokenType::String) {
             continue;
         }
 
-        auto token = static_cast<EdifyTokenString *>(*it);
-        const std::string str = token->string();
+        const std::string str = stream.text(i);
 
         bool is_system = str.find("/system") != std::string::npos
                 || find_items_in_string(str.c_str(), system_devs);
@@ -520,17 +381,17 @@ replace_edify_format(std::vector<EdifyToken *> *tokens,
                 || find_items_in_string(str.c_str(), data_devs);
 
         if (is_system) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/system"));
+            *replacement = format(FORMAT_FMT, "/system");
+            return true;
         } else if (is_cache) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/cache"));
+            *replacement = format(FORMAT_FMT, "/cache");
+            return true;
         } else if (is_data) {
-            return replace_function(tokens, func_name, left_paren, right_paren,
-                                    format(FORMAT_FMT, "/data"));
+            *replacement = format(FORMAT_FMT, "/data");
+            return true;
         }
     }
-    return right_paren + 1;
+    return false;
 }
 
 bool StandardPatcher::patch_files(const std::string &directory)
@@ -562,104 +423,225 @@ bool StandardPatcher::patch_updater(const std::string &directory)
         return true;
     }
 
-    std::vector<EdifyToken *> tokens;
-    bool result = EdifyTokenizer::tokenize(
-            contents.data(), contents.size(), &tokens);
-    if (!result) {
+    EdifyTokenStream stream;
+    if (!stream.tokenize(contents.data(), contents.size())) {
         LOGE("Failed to tokenize updater-script");
         return false;
     }
 
-#if DUMP_DEBUG
-    EdifyTokenizer::dump(tokens);
-#endif
-
     auto &&device = m_info.device();
     auto system_devs = device.system_block_devs();
     auto cache_devs = device.cache_block_devs();
     auto data_devs = device.data_block_devs();
 
-    std::vector<EdifyToken *>::iterator begin = tokens.begin();
-    std::vector<EdifyToken *>::iterator end;
+    auto const &tokens = stream.tokens();
+
+    std::string output;
+    output.reserve(contents.size());
 
-    // TODO: Catch errors
-    while (true) {
-        end = tokens.end();
+    // Offset of the first source byte not yet copied to the output
+    std::size_t copied = 0;
+    // Calls nested inside an already handled function are skipped
+    std::size_t skip_until = 0;
+    std::string replacement;
 
-        // Need to find:
-        // 1. String containing function name
-        // 2. Left parenthesis for the function
-        // 3. Right parenthesis for the function
-        std::vector<EdifyToken *>::iterator func_name;
-        std::vector<EdifyToken *>::iterator left_paren;
-        std::vector<EdifyToken *>::iterator right_paren;
+    // Function calls are indexed in order of appearance, so a single pass over
+    // the index visits every call that the previous search-and-replace loop
+    // would have visited
+    for (auto const &call : stream.function_calls()) {
+        if (call.name < skip_until) {
+            continue;
+        }
 
-        if (!find_function(begin, end, &func_name, &left_paren, &right_paren)) {
+        // If a right parenthesis was not found, then assume there's a syntax
+        // error and stop patching
+        if (call.right_paren == EdifyTokenStream::npos) {
             break;
         }
 
-        // Tokens (types are checked by findFunction())
-        auto t_func_name = static_cast<EdifyTokenString *>(*func_name);
-
-        if (t_func_name->unescaped_string() == "mount") {
-            begin = replace_edify_mount(&tokens, func_name, left_paren, right_paren,
-                                        system_devs, cache_devs, data_devs);
-        } else if (t_func_name->unescaped_string() == "unmount") {
-            begin = replace_edify_unmount(&tokens, func_name, left_paren, right_paren,
-                                          system_devs, cache_devs, data_devs);
-        } else if (t_func_name->unescaped_string() == "run_program") {
-            begin = replace_edify_run_program(&tokens, func_name, left_paren, right_paren,
-                                              system_devs, cache_devs, data_devs);
-        } else if (t_func_name->unescaped_string() == "delete_recursive") {
-            begin = replace_edify_delete_recursive(&tokens, func_name, left_paren, right_paren);
-        } else if (t_func_name->unescaped_string() == "format") {
-            begin = replace_edify_format(&tokens, func_name, left_paren, right_paren,
-                                         system_devs, cache_devs, data_devs);
+        std::string name;
+        if (!stream.unescaped_string(call.name, name)) {
+            LOGW("Skipping function with invalid name at offset %" PRIu32,
+                 tokens[call.name].offset);
+            continue;
+        }
+
+        bool replace;
+
+        if (name == "mount") {
+            replace = replace_edify_mount(stream, call, system_devs,
+                                          cache_devs, data_devs, &replacement);
+        } else if (name == "unmount") {
+            replace = replace_edify_unmount(stream, call, system_devs,
+                                            cache_devs, data_devs,
+                                            &replacement);
+        } else if (name == "run_program") {
+            replace = replace_edify_run_program(stream, call, system_devs,
+                                                cache_devs, data_devs,
+                                                &replacement);
+        } else if (name == "delete_recursive") {
+            replace = replace_edify_delete_recursive(stream, call,
+                                                     &replacement);
+        } else if (name == "format") {
+            replace = replace_edify_format(stream, call, system_devs,
+                                           cache_devs, data_devs,
+                                           &replacement);
         } else {
-            begin = func_name + 1;
+            continue;
         }
-    }
+
+        skip_until = call.right_paren + 1;
+
+        if (replace) {
+            auto const &begin = tokens[call.name];
+            auto const &end = tokens[call.right_paren];
+
+            output.append(contents, copied, begin.offset - copied);
+            output += replacement;
+            copied = end.offset + end.size;
 
 #if DUMP_DEBUG
-    EdifyTokenizer::dump(tokens);
+            LOGD("Replaced %s() at offset %" PRIu32 ": %s",
+                 name.c_str(), begin.offset, replacement.c_str());
 #endif
+        }
+    }
 
-    FileUtils::write_from_string(path, EdifyTokenizer::untokenize(tokens));
+    output.append(contents, copied, std::string::npos);
 
-    for (EdifyToken *t : tokens) {
-        delete t;
-    }
+    FileUtils::write_from_string(path, output);
 
     return true;
 }
 
+/*!
+ * \brief Check whether a block transfer list command should be kept
+ *
+ * \param cmd Command (including the trailing newline, if any)
+ * \param size Size of command
+ *
+ * \return Whether the command should be written to the new transfer list
+ */
+static bool keep_transfer_list_command(const char *cmd, std::size_t size)
+{
+    return !(size >= 6 && std::memcmp(cmd, "erase ", 6) == 0);
+}
+
 bool StandardPatcher::patch_transfer_list(const std::string &directory)
 {
-    std::string contents;
     std::string path;
-    std::vector<std::string> lines;
 
     path += directory;
     path += "/";
     path += SystemTransferList;
 
-    auto ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return ret == ErrorCode::FileOpenError;
+    StandardFile file;
+
+    auto ret = FileUtils::open_file(file, path, FileOpenMode::ReadWrite);
+    if (!ret) {
+        // Not all zips are block-based
+        LOGD("%s: Failed to open for reading: %s",
+             path.c_str(), ret.error().message().c_str());
+        return true;
     }
 
-    lines = StringUtils::split(contents, '\n');
+    // The transfer list is rewritten in place in a single forward pass.
+    // Commands are only ever dropped, so the write offset can never pass the
+    // read offset.
+    std::vector<char> buf(TRANSFER_LIST_BUF_SIZE);
+    std::size_t buf_used = 0;
+    uint64_t read_offset = 0;
+    uint64_t write_offset = 0;
+    bool eof = false;
+
+    while (!eof) {
+        // Grow the buffer if a single command does not fit
+        if (buf_used == buf.size()) {
+            buf.resize(buf.size() * 2);
+        }
 
-    for (auto it = lines.begin(); it != lines.end();) {
-        if (starts_with(*it, "erase ")) {
-            it = lines.erase(it);
-        } else {
-            ++it;
+        auto seek_ret = file.seek(static_cast<int64_t>(read_offset), SEEK_SET);
+        if (!seek_ret) {
+            LOGE("%s: Failed to seek file: %s",
+                 path.c_str(), seek_ret.error().message().c_str());
+            return false;
+        }
+
+        auto n = file_read_retry(file, buf.data() + buf_used,
+                                 buf.size() - buf_used);
+        if (!n) {
+            LOGE("%s: Failed to read file: %s",
+                 path.c_str(), n.error().message().c_str());
+            return false;
+        }
+
+        eof = n.value() == 0;
+        read_offset += n.value();
+        buf_used += n.value();
+
+        // Compact the kept commands to the front of the buffer. At EOF, the
+        // remaining data is the last command, which has no trailing newline.
+        std::size_t start = 0;
+        std::size_t kept = 0;
+
+        while (start < buf_used) {
+            auto newline = static_cast<const char *>(std::memchr(
+                    buf.data() + start, '\n', buf_used - start));
+            std::size_t end;
+
+            if (newline) {
+                end = static_cast<std::size_t>(newline - buf.data()) + 1;
+            } else if (eof) {
+                end = buf_used;
+            } else {
+                break;
+            }
+
+            if (keep_transfer_list_command(buf.data() + start, end - start)) {
+                std::memmove(buf.data() + kept, buf.data() + start,
+                             end - start);
+                kept += end - start;
+            }
+
+            start = end;
         }
+
+        if (kept > 0) {
+            seek_ret = file.seek(static_cast<int64_t>(write_offset), SEEK_SET);
+            if (!seek_ret) {
+                LOGE("%s: Failed to seek file: %s",
+                     path.c_str(), seek_ret.error().message().c_str());
+                return false;
+            }
+
+            auto write_ret = file_write_exact(file, buf.data(), kept);
+            if (!write_ret) {
+                LOGE("%s: Failed to write file: %s",
+                     path.c_str(), write_ret.error().message().c_str());
+                return false;
+            }
+
+            write_offset += kept;
+        }
+
+        // Keep the incomplete command for the next read
+        std::memmove(buf.data(), buf.data() + start, buf_used - start);
+        buf_used -= start;
+    }
+
+    auto truncate_ret = file.truncate(write_offset);
+    if (!truncate_ret) {
+        LOGE("%s: Failed to truncate file: %s",
+             path.c_str(), truncate_ret.error().message().c_str());
+        return false;
     }
 
-    contents = StringUtils::join(lines, "\n");
-    FileUtils::write_from_string(path, contents);
+    auto close_ret = file.close();
+    if (!close_ret) {
+        LOGE("%s: Failed to close file: %s",
+             path.c_str(), close_ret.error().message().c_str());
+        return false;
+    }
 
     return true;
 }
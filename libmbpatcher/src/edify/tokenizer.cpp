@@ -293,15 +293,16 @@ static int hex_char_to_int(char c)
     }
 }
 
-bool EdifyTokenString::unescape(const std::string &str, std::string *out)
+static bool unescape_string(const char *str, std::size_t size,
+                            std::string *out)
 {
     std::string output;
 
-    for (std::size_t i = 0; i < str.size();) {
+    for (std::size_t i = 0; i < size;) {
         char c = str[i];
 
         if (c == '\\') {
-            if (i == str.size() - 1) {
+            if (i == size - 1) {
                 // Escape character is last character
                 return false;
             }
@@ -325,7 +326,7 @@ bool EdifyTokenString::unescape(const std::string &str, std::string *out)
             } else if (str[i + 1] == '\\') {
                 output += '\\';
             } else if (str[i + 1] == 'x') {
-                if (str.size() - i < 4) {
+                if (size - i < 4) {
                     // Need 4 chars: \xYY
                     return false;
                 }
@@ -336,7 +337,7 @@ bool EdifyTokenString::unescape(const std::string &str, std::string *out)
                     return false;
                 }
 
-                char val = static_cast<char>((digit1 << 4) & digit2);
+                char val = static_cast<char>((digit1 << 4) | digit2);
                 output += val;
 
                 new_i += 2;
@@ -357,6 +358,11 @@ bool EdifyTokenString::unescape(const std::string &str, std::string *out)
     return true;
 }
 
+bool EdifyTokenString::unescape(const std::string &str, std::string *out)
+{
+    return unescape_string(str.data(), str.size(), out);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 EdifyTokenUnknown::EdifyTokenUnknown(char c) : EdifyToken(EdifyTokenType::Unknown), m_char(c)
@@ -379,88 +385,77 @@ bool EdifyTokenizer::is_valid_unquoted(char c)
             || c == '.';
 }
 
-bool EdifyTokenizer::next_token(const char *data, std::size_t size,
-                                std::size_t *pos, EdifyToken **token)
+bool EdifyTokenizer::scan_token(const char *data, std::size_t size,
+                                std::size_t *pos, EdifyTokenType *type)
 {
     std::size_t p = *pos;
     assert(p < size);
 
     if (size - p >= 2 && std::memcmp(data + p, "if", 2) == 0) {
-        *token = new EdifyTokenIf();
+        *type = EdifyTokenType::If;
         p += 2;
     } else if (size - p >= 4 && std::memcmp(data + p, "then", 4) == 0) {
-        *token = new EdifyTokenThen();
+        *type = EdifyTokenType::Then;
         p += 4;
     } else if (size - p >= 4 && std::memcmp(data + p, "else", 4) == 0) {
-        *token = new EdifyTokenElse();
+        *type = EdifyTokenType::Else;
         p += 4;
     } else if (size - p >= 5 && std::memcmp(data + p, "endif", 5) == 0) {
-        *token = new EdifyTokenEndif();
+        *type = EdifyTokenType::Endif;
         p += 5;
     } else if (size - p >= 2 && std::memcmp(data + p, "&&", 2) == 0) {
-        *token = new EdifyTokenAnd();
+        *type = EdifyTokenType::And;
         p += 2;
     } else if (size - p >= 2 && std::memcmp(data + p, "||", 2) == 0) {
-        *token = new EdifyTokenOr();
+        *type = EdifyTokenType::Or;
         p += 2;
     } else if (size - p >= 2 && std::memcmp(data + p, "==", 2) == 0) {
-        *token = new EdifyTokenEquals();
+        *type = EdifyTokenType::Equals;
         p += 2;
     } else if (size - p >= 2 && std::memcmp(data + p, "!=", 2) == 0) {
-        *token = new EdifyTokenNotEquals();
+        *type = EdifyTokenType::NotEquals;
         p += 2;
     } else if (data[p] == '!') {
-        *token = new EdifyTokenNot();
+        *type = EdifyTokenType::Not;
         p += 1;
     } else if (data[p] == '(') {
-        *token = new EdifyTokenLeftParen();
+        *type = EdifyTokenType::LeftParen;
         p += 1;
     } else if (data[p] == ')') {
-        *token = new EdifyTokenRightParen();
+        *type = EdifyTokenType::RightParen;
         p += 1;
     } else if (data[p] == ';') {
-        *token = new EdifyTokenSemicolon();
+        *type = EdifyTokenType::Semicolon;
         p += 1;
     } else if (data[p] == ',') {
-        *token = new EdifyTokenComma();
+        *type = EdifyTokenType::Comma;
         p += 1;
     } else if (data[p] == '+') {
-        *token = new EdifyTokenConcat();
+        *type = EdifyTokenType::Concat;
         p += 1;
     } else if (data[p] == '\n') {
-        *token = new EdifyTokenNewline();
+        *type = EdifyTokenType::Newline;
         p += 1;
     } else if (data[p] != '\n' && std::isspace(data[p])) {
-        std::string buf;
-        buf += data[p];
         p += 1;
         while (size - p >= 1 && data[p] != '\n' && std::isspace(data[p])) {
-            buf += data[p];
             p += 1;
         }
-        *token = new EdifyTokenWhitespace(std::move(buf));
+        *type = EdifyTokenType::Whitespace;
     } else if (data[p] == '#') {
-        std::string buf;
-        // Omit '#' character
         p += 1;
         while (size - p >= 1 && data[p] != '\n') {
-            buf += data[p];
             p += 1;
         }
-        *token = new EdifyTokenComment(std::move(buf));
+        *type = EdifyTokenType::Comment;
     } else if (is_valid_unquoted(data[p])) {
-        std::string buf;
-        buf += data[p];
         p += 1;
         while (size - p >= 1 && is_valid_unquoted(data[p])) {
-            buf += data[p];
             p += 1;
         }
-        *token = new EdifyTokenString(std::move(buf), EdifyTokenString::NotQuoted);
+        *type = EdifyTokenType::String;
     } else if (data[p] == '"') {
         std::size_t curPos = p;
-        std::string buf;
-        buf += data[p];
         p += 1;
         bool escaped = false;
         bool terminated = false;
@@ -468,21 +463,19 @@ bool EdifyTokenizer::next_token(const char *data, std::size_t size,
             if (data[p] == '\\' || escaped) {
                 escaped = !escaped;
             } else if (!escaped && data[p] == '"') {
-                buf += data[p];
                 p += 1;
                 terminated = true;
                 break;
             }
-            buf += data[p];
             p += 1;
         }
         if (!terminated) {
             LOGE("Unterminated quote at position %" MB_PRIzu, curPos);
             return false;
         }
-        *token = new EdifyTokenString(std::move(buf), EdifyTokenString::AlreadyQuoted);
+        *type = EdifyTokenType::String;
     } else {
-        *token = new EdifyTokenUnknown(data[p]);
+        *type = EdifyTokenType::Unknown;
         p += 1;
     }
 
@@ -491,6 +484,56 @@ bool EdifyTokenizer::next_token(const char *data, std::size_t size,
     return true;
 }
 
+bool EdifyTokenizer::next_token(const char *data, std::size_t size,
+                                std::size_t *pos, EdifyToken **token)
+{
+    std::size_t start = *pos;
+    EdifyTokenType type;
+
+    if (!scan_token(data, size, pos, &type)) {
+        return false;
+    }
+
+    const char *text = data + start;
+    std::size_t length = *pos - start;
+
+    switch (type) {
+    case EdifyTokenType::If:         *token = new EdifyTokenIf();         break;
+    case EdifyTokenType::Then:       *token = new EdifyTokenThen();       break;
+    case EdifyTokenType::Else:       *token = new EdifyTokenElse();       break;
+    case EdifyTokenType::Endif:      *token = new EdifyTokenEndif();      break;
+    case EdifyTokenType::And:        *token = new EdifyTokenAnd();        break;
+    case EdifyTokenType::Or:         *token = new EdifyTokenOr();         break;
+    case EdifyTokenType::Equals:     *token = new EdifyTokenEquals();     break;
+    case EdifyTokenType::NotEquals:  *token = new EdifyTokenNotEquals();  break;
+    case EdifyTokenType::Not:        *token = new EdifyTokenNot();        break;
+    case EdifyTokenType::LeftParen:  *token = new EdifyTokenLeftParen();  break;
+    case EdifyTokenType::RightParen: *token = new EdifyTokenRightParen(); break;
+    case EdifyTokenType::Semicolon:  *token = new EdifyTokenSemicolon();  break;
+    case EdifyTokenType::Comma:      *token = new EdifyTokenComma();      break;
+    case EdifyTokenType::Concat:     *token = new EdifyTokenConcat();     break;
+    case EdifyTokenType::Newline:    *token = new EdifyTokenNewline();    break;
+    case EdifyTokenType::Whitespace:
+        *token = new EdifyTokenWhitespace(std::string(text, length));
+        break;
+    case EdifyTokenType::Comment:
+        // Omit '#' character
+        *token = new EdifyTokenComment(std::string(text + 1, length - 1));
+        break;
+    case EdifyTokenType::String:
+        *token = new EdifyTokenString(std::string(text, length),
+                                      *text == '"'
+                                      ? EdifyTokenString::AlreadyQuoted
+                                      : EdifyTokenString::NotQuoted);
+        break;
+    case EdifyTokenType::Unknown:
+        *token = new EdifyTokenUnknown(*text);
+        break;
+    }
+
+    return true;
+}
+
 bool EdifyTokenizer::tokenize(const char *data, std::size_t size,
                               std::vector<EdifyToken *> *tokens)
 {
@@ -577,5 +620,148 @@ void EdifyTokenizer::dump(const std::vector<EdifyToken *> &tokens)
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+constexpr std::size_t EdifyTokenStream::npos;
+
+EdifyTokenStream::EdifyTokenStream() : m_data(nullptr), m_size(0)
+{
+}
+
+bool EdifyTokenStream::tokenize(const char *data, std::size_t size)
+{
+    if (size > UINT32_MAX) {
+        LOGE("Data is too large to tokenize");
+        return false;
+    }
+
+    m_data = data;
+    m_size = size;
+    m_tokens.clear();
+    m_calls.clear();
+
+    // Most tokens are at least a few bytes long
+    m_tokens.reserve(size / 4);
+
+    std::size_t pos = 0;
+
+    while (pos < size) {
+        std::size_t start = pos;
+        EdifyTokenType type;
+
+        if (!EdifyTokenizer::scan_token(data, size, &pos, &type)) {
+            m_tokens.clear();
+            return false;
+        }
+
+        m_tokens.push_back({ type, static_cast<uint32_t>(start),
+                             static_cast<uint32_t>(pos - start) });
+    }
+
+    index_function_calls();
+
+    return true;
+}
+
+/*!
+ * \brief Index all function calls and their matching parentheses
+ *
+ * A function call is a string token followed by a left parenthesis, barring any
+ * whitespace, newlines, or comments.
+ */
+void EdifyTokenStream::index_function_calls()
+{
+    // Index of the matching right parenthesis for each left parenthesis
+    std::vector<std::size_t> matches(m_tokens.size(), npos);
+    std::vector<std::size_t> stack;
+
+    for (std::size_t i = 0; i < m_tokens.size(); ++i) {
+        if (m_tokens[i].type == EdifyTokenType::LeftParen) {
+            stack.push_back(i);
+        } else if (m_tokens[i].type == EdifyTokenType::RightParen
+                && !stack.empty()) {
+            matches[stack.back()] = i;
+            stack.pop_back();
+        }
+    }
+
+    for (std::size_t i = 0; i < m_tokens.size(); ++i) {
+        if (m_tokens[i].type != EdifyTokenType::String) {
+            continue;
+        }
+
+        std::size_t j = i + 1;
+        while (j < m_tokens.size()
+                && (m_tokens[j].type == EdifyTokenType::Whitespace
+                || m_tokens[j].type == EdifyTokenType::Newline
+                || m_tokens[j].type == EdifyTokenType::Comment)) {
+            ++j;
+        }
+
+        if (j < m_tokens.size()
+                && m_tokens[j].type == EdifyTokenType::LeftParen) {
+            m_calls.push_back({ i, j, matches[j] });
+        }
+    }
+}
+
+const std::vector<EdifyFlatToken> & EdifyTokenStream::tokens() const
+{
+    return m_tokens;
+}
+
+const std::vector<EdifyFunctionCall> & EdifyTokenStream::function_calls() const
+{
+    return m_calls;
+}
+
+std::string EdifyTokenStream::text(std::size_t index) const
+{
+    const EdifyFlatToken &t = m_tokens[index];
+    return std::string(m_data + t.offset, t.size);
+}
+
+/*!
+ * \brief Get the unescaped value of a string token
+ *
+ * If the string is quoted, the quotes are removed.
+ *
+ * \param index Index of the token
+ * \param out Output string (unchanged on failure)
+ *
+ * \return Whether the string contains only valid escape sequences
+ */
+bool EdifyTokenStream::unescaped_string(std::size_t index,
+                                        std::string &out) const
+{
+    const EdifyFlatToken &t = m_tokens[index];
+    const char *str = m_data + t.offset;
+    std::size_t size = t.size;
+
+    bool quoted = size >= 2 && str[0] == '"';
+
+    std::string result;
+    if (!unescape_string(str, size, &result)) {
+        return false;
+    }
+    if (quoted && result.size() >= 2) {
+        result.pop_back();
+        result.erase(result.begin());
+    }
+
+    out.swap(result);
+    return true;
+}
+
+const char * EdifyTokenStream::data() const
+{
+    return m_data;
+}
+
+std::size_t EdifyTokenStream::size() const
+{
+    return m_size;
+}
+
 }
 }
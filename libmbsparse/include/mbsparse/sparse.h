@@ -49,6 +49,9 @@ public:
     // File size
     uint64_t size();
 
+    // Chunk table
+    oc::result<std::vector<detail::ChunkInfo>> chunks();
+
 protected:
     oc::result<void> on_open() override;
     oc::result<void> on_close() override;
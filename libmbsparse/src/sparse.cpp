@@ -256,6 +256,37 @@ uint64_t SparseFile::size()
     return m_file_size;
 }
 
+/*!
+ * \brief Get the list of all chunks in the sparse file
+ *
+ * This processes all of the chunk headers that have not been read yet. The
+ * returned chunk table describes where the data for each range of the output
+ * file is located in the source file, which allows the caller to read the
+ * sparse file with positional I/O instead of going through this instance.
+ *
+ * \note This requires the source file to support random seeking.
+ *
+ * \return List of chunks if all of the chunk headers are valid. Otherwise, the
+ *         error code.
+ */
+oc::result<std::vector<ChunkInfo>> SparseFile::chunks()
+{
+    if (state() != FileState::Opened) {
+        return FileError::InvalidState;
+    }
+
+    if (m_seekability != Seekability::CanSeek) {
+        return FileError::UnsupportedSeek;
+    }
+
+    // Read all remaining chunk headers and then move back to the chunk
+    // containing the current offset
+    OUTCOME_TRYV(move_to_chunk(m_file_size));
+    OUTCOME_TRYV(move_to_chunk(m_cur_tgt_offset));
+
+    return m_chunks;
+}
+
 /*!
  * \brief Open sparse file for reading
  *
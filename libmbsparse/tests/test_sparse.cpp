@@ -729,3 +729,65 @@ TEST_F(SparseTest, ReadValidDataWithUnseekableFile)
 
     ASSERT_TRUE(_file.close());
 }
+
+TEST_F(SparseTest, GetChunksWithSeekableFile)
+{
+    char buf[8];
+    build_valid_data();
+
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    // Read part of the first chunk before loading the chunk table
+    auto n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(buf));
+
+    auto chunks = _file.chunks();
+    ASSERT_TRUE(chunks);
+    ASSERT_EQ(chunks.value().size(), 4u);
+
+    auto &raw = chunks.value()[0];
+    ASSERT_EQ(raw.type, CHUNK_TYPE_RAW);
+    ASSERT_EQ(raw.begin, 0u);
+    ASSERT_EQ(raw.end, 16u);
+    ASSERT_EQ(raw.raw_begin, sizeof(SparseHeader) + sizeof(ChunkHeader));
+    ASSERT_EQ(raw.raw_end, raw.raw_begin + 16);
+
+    auto &fill = chunks.value()[1];
+    ASSERT_EQ(fill.type, CHUNK_TYPE_FILL);
+    ASSERT_EQ(fill.begin, 16u);
+    ASSERT_EQ(fill.end, 32u);
+    ASSERT_EQ(mb_le32toh(fill.fill_val), 0x12345678u);
+
+    auto &skip = chunks.value()[2];
+    ASSERT_EQ(skip.type, CHUNK_TYPE_DONT_CARE);
+    ASSERT_EQ(skip.begin, 32u);
+    ASSERT_EQ(skip.end, 48u);
+
+    auto &crc32 = chunks.value()[3];
+    ASSERT_EQ(crc32.type, CHUNK_TYPE_CRC32);
+    ASSERT_EQ(crc32.begin, 48u);
+    ASSERT_EQ(crc32.end, 48u);
+
+    // Check that reading continues from where it left off
+    n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(buf));
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 8, sizeof(buf)), 0);
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, GetChunksWithUnseekableFileFails)
+{
+    build_valid_data();
+
+    _source_file.set_seekability(Seekability::CanSkip);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    auto chunks = _file.chunks();
+    ASSERT_FALSE(chunks);
+    ASSERT_EQ(chunks.error(), FileError::UnsupportedSeek);
+
+    ASSERT_TRUE(_file.close());
+}
@@ -34,6 +34,8 @@ struct ExtractInfo
 {
     std::string from;
     std::string to;
+    // Whether extract_files2_verified() should verify the file before writing
+    bool verify = false;
 };
 
 struct ExistsInfo
@@ -42,6 +44,10 @@ struct ExistsInfo
     bool exists;
 };
 
+typedef bool (*ExtractVerifyFn)(const ExtractInfo &info,
+                                const void *data, size_t size,
+                                void *userdata);
+
 enum class CompressionType : uint8_t
 {
     None,
@@ -69,6 +75,9 @@ bool extract_files(const std::string &filename, const std::string &target,
                    const std::vector<std::string> &files);
 bool extract_files2(const std::string &filename,
                     const std::vector<ExtractInfo> &files);
+bool extract_files2_verified(const std::string &filename,
+                             const std::vector<ExtractInfo> &files,
+                             ExtractVerifyFn verify_fn, void *userdata);
 bool archive_exists(const std::string &filename,
                     std::vector<ExistsInfo> &files);
 
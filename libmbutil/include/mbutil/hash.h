@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <openssl/sha.h>
 
@@ -28,8 +29,29 @@ namespace mb
 namespace util
 {
 
+struct Sha512Job
+{
+    // Input
+    std::string path;
+    // Whether to also read the file contents into `data`
+    bool read_data;
+
+    // Output
+    std::vector<unsigned char> data;
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+    bool success;
+    int error;
+};
+
 bool sha512_hash(const std::string &path,
                  unsigned char digest[SHA512_DIGEST_LENGTH]);
+bool sha512_read_all(const std::string &path,
+                     std::vector<unsigned char> &data_out,
+                     unsigned char digest[SHA512_DIGEST_LENGTH]);
+bool sha512_copy_contents(const std::string &source, const std::string &target,
+                          unsigned char digest[SHA512_DIGEST_LENGTH]);
+bool sha512_hash_multiple(std::vector<Sha512Job> &jobs,
+                          unsigned int max_threads);
 
 }
 }
@@ -21,6 +21,7 @@
 
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "mbcommon/integer.h"
 
@@ -144,6 +145,10 @@ bool property_file_list(const std::string &path, PropertyListCb prop_fn,
 bool property_file_get_all(const std::string &path,
                            std::unordered_map<std::string, std::string> &map);
 
+bool property_file_get_multiple(const std::string &path,
+                                const std::vector<std::string> &keys,
+                                std::unordered_map<std::string, std::string> &map);
+
 bool property_file_write_all(const std::string &path,
                              const std::unordered_map<std::string, std::string> &map);
 
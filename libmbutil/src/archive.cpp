@@ -52,6 +52,8 @@ namespace util
 {
 
 using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
+using ScopedArchiveEntry = std::unique_ptr<archive_entry,
+        decltype(archive_entry_free) *>;
 using ScopedLinkResolver = std::unique_ptr<archive_entry_linkresolver,
         decltype(archive_entry_linkresolver_free) *>;
 
@@ -783,6 +785,147 @@ bool extract_files2(const std::string &filename,
     return true;
 }
 
+/*!
+ * \brief Extract files, verifying the contents of some of them
+ *
+ * Files with ExtractInfo::verify set are decompressed into memory and passed to
+ * \p verify_fn after all of the other files have been extracted, so
+ * \p verify_fn can rely on files such as detached signatures already being on
+ * disk. A verified file is only written to disk if \p verify_fn returns true,
+ * so no unverified data is ever written to its target path. Extraction stops at
+ * the first failure.
+ */
+bool extract_files2_verified(const std::string &filename,
+                             const std::vector<ExtractInfo> &files,
+                             ExtractVerifyFn verify_fn, void *userdata)
+{
+    if (files.empty()) {
+        return false;
+    }
+
+    ScopedArchive in(archive_read_new(), archive_read_free);
+    ScopedArchive out(archive_write_disk_new(), archive_write_free);
+
+    if (!in || !out) {
+        LOGE("Out of memory");
+        return false;
+    }
+
+    struct PendingFile
+    {
+        const ExtractInfo *info;
+        ScopedArchiveEntry entry;
+        std::vector<unsigned char> data;
+    };
+
+    archive_entry *entry;
+    int ret;
+    unsigned int count = 0;
+    std::vector<PendingFile> pending;
+
+    if (!set_up_input(in.get(), filename)) {
+        return false;
+    }
+
+    set_up_output(out.get());
+
+    while ((ret = archive_read_next_header(in.get(), &entry)) == ARCHIVE_OK) {
+        auto it = std::find_if(files.begin(), files.end(),
+                               [&](const ExtractInfo &info) {
+            return info.from == archive_entry_pathname(entry);
+        });
+        if (it == files.end()) {
+            continue;
+        }
+
+        ++count;
+
+        if (!it->verify) {
+            archive_entry_set_pathname(entry, it->to.c_str());
+
+            if (libarchive_copy_header_and_data(in.get(), out.get(), entry) != ARCHIVE_OK) {
+                return false;
+            }
+
+            continue;
+        }
+
+        std::vector<unsigned char> data;
+        if (archive_entry_size(entry) > 0) {
+            data.reserve(static_cast<size_t>(archive_entry_size(entry)));
+        }
+
+        const void *buff;
+        size_t size;
+        int64_t offset;
+
+        while ((ret = archive_read_data_block(
+                in.get(), &buff, &size, &offset)) == ARCHIVE_OK) {
+            if (static_cast<uint64_t>(offset) > data.size()) {
+                data.resize(static_cast<size_t>(offset));
+            }
+            data.insert(data.end(), static_cast<const unsigned char *>(buff),
+                        static_cast<const unsigned char *>(buff) + size);
+        }
+
+        if (ret != ARCHIVE_EOF) {
+            LOGE("%s: Data copy ended without reaching EOF: %s",
+                 it->from.c_str(), archive_error_string(in.get()));
+            return false;
+        }
+
+        ScopedArchiveEntry copy(archive_entry_clone(entry), archive_entry_free);
+        if (!copy) {
+            LOGE("Out of memory");
+            return false;
+        }
+
+        archive_entry_set_pathname(copy.get(), it->to.c_str());
+
+        pending.push_back({ &*it, std::move(copy), std::move(data) });
+    }
+
+    if (ret != ARCHIVE_EOF) {
+        LOGE("Archive extraction ended without reaching EOF: %s",
+             archive_error_string(in.get()));
+        return false;
+    }
+
+    if (count != files.size()) {
+        LOGE("Not all specified files were extracted");
+        return false;
+    }
+
+    for (auto const &file : pending) {
+        if (!verify_fn(*file.info, file.data.data(), file.data.size(),
+                       userdata)) {
+            LOGE("%s: Verification failed", file.info->from.c_str());
+            return false;
+        }
+
+        if (archive_write_header(out.get(), file.entry.get()) != ARCHIVE_OK) {
+            LOGE("Failed to write header: %s", archive_error_string(out.get()));
+            return false;
+        }
+
+        if (!file.data.empty() && archive_write_data(out.get(),
+                file.data.data(), file.data.size())
+                        != static_cast<la_ssize_t>(file.data.size())) {
+            LOGE("%s: Failed to write data: %s",
+                 file.info->to.c_str(), archive_error_string(out.get()));
+            return false;
+        }
+
+        if (archive_write_finish_entry(out.get()) != ARCHIVE_OK) {
+            LOGE("%s: Failed to finish entry: %s",
+                 file.info->to.c_str(), archive_error_string(out.get()));
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool archive_exists(const std::string &filename,
                     std::vector<ExistsInfo> &files)
 {
@@ -19,22 +19,141 @@
 
 #include "mbutil/hash.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <thread>
 
 #include <cerrno>
-#include <cstdio>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/finally.h"
 #include "mblog/logging.h"
 
 #define LOG_TAG "mbutil/hash"
 
+// Large enough to amortize syscall overhead when hashing block devices
+#define HASH_BUF_SIZE           (1024 * 1024)
+
 namespace mb
 {
 namespace util
 {
 
-using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+static bool write_all(int fd, const unsigned char *buf, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compute SHA512 hash of a file descriptor's contents
+ *
+ * Regular files are memory mapped if the data is only being hashed. Otherwise,
+ * the data is read in large chunks and, if requested, written to \p fd_out or
+ * appended to \p data_out while it is still in the cache.
+ */
+static bool sha512_fd(int fd, const std::string &path,
+                      unsigned char digest[SHA512_DIGEST_LENGTH],
+                      int fd_out, std::vector<unsigned char> *data_out)
+{
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    SHA512_CTX ctx;
+    if (!SHA512_Init(&ctx)) {
+        LOGE("openssl: SHA512_Init() failed");
+        return false;
+    }
+
+    if (S_ISREG(sb.st_mode) && sb.st_size > 0 && fd_out < 0 && !data_out) {
+        auto size = static_cast<size_t>(sb.st_size);
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, size, MADV_SEQUENTIAL);
+
+            bool ret = SHA512_Update(&ctx, map, size);
+            munmap(map, size);
+
+            if (!ret) {
+                LOGE("openssl: SHA512_Update() failed");
+                return false;
+            } else if (!SHA512_Final(digest, &ctx)) {
+                LOGE("openssl: SHA512_Final() failed");
+                return false;
+            }
+
+            return true;
+        }
+
+        // Fall back to reading the file
+    }
+
+    if (data_out) {
+        data_out->clear();
+        if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+            data_out->reserve(static_cast<size_t>(sb.st_size));
+        }
+    }
+
+    std::unique_ptr<unsigned char[]> buf(new unsigned char[HASH_BUF_SIZE]);
+
+    while (true) {
+        ssize_t n = read(fd, buf.get(), HASH_BUF_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("%s: Failed to read file: %s", path.c_str(), strerror(errno));
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+
+        auto size = static_cast<size_t>(n);
+
+        if (!SHA512_Update(&ctx, buf.get(), size)) {
+            LOGE("openssl: SHA512_Update() failed");
+            return false;
+        }
+
+        if (fd_out >= 0 && !write_all(fd_out, buf.get(), size)) {
+            LOGE("%s: Failed to write data: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        if (data_out) {
+            data_out->insert(data_out->end(), buf.get(), buf.get() + size);
+        }
+    }
+
+    if (!SHA512_Final(digest, &ctx)) {
+        LOGE("openssl: SHA512_Final() failed");
+        return false;
+    }
+
+    return true;
+}
 
 /*!
  * \brief Compute SHA512 hash of a file
@@ -48,44 +167,163 @@ using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 bool sha512_hash(const std::string &path,
                  unsigned char digest[SHA512_DIGEST_LENGTH])
 {
-    ScopedFILE fp(fopen(path.c_str(), "rb"), fclose);
-    if (!fp) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         LOGE("%s: Failed to open: %s", path.c_str(), strerror(errno));
         return false;
     }
 
-    unsigned char buf[10240];
-    size_t n;
+    auto close_fd = finally([&] {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    });
 
-    SHA512_CTX ctx;
-    if (!SHA512_Init(&ctx)) {
-        LOGE("openssl: SHA512_Init() failed");
+    return sha512_fd(fd, path, digest, -1, nullptr);
+}
+
+/*!
+ * \brief Read a file into memory and compute its SHA512 hash in one pass
+ *
+ * This is useful when the data needs to be verified and then used without
+ * giving anyone a chance to modify the file in between.
+ *
+ * \param path Path to file
+ * \param data_out Output buffer for file contents
+ * \param digest `unsigned char` array of size `SHA512_DIGEST_LENGTH` to store
+ *               computed hash value
+ *
+ * \return true on success, false on failure and errno set appropriately
+ */
+bool sha512_read_all(const std::string &path,
+                     std::vector<unsigned char> &data_out,
+                     unsigned char digest[SHA512_DIGEST_LENGTH])
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open: %s", path.c_str(), strerror(errno));
         return false;
     }
 
-    while ((n = fread(buf, 1, sizeof(buf), fp.get())) > 0) {
-        if (!SHA512_Update(&ctx, buf, n)) {
-            LOGE("openssl: SHA512_Update() failed");
-            return false;
-        }
-        if (n < sizeof(buf)) {
-            break;
-        }
+    auto close_fd = finally([&] {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    });
+
+    return sha512_fd(fd, path, digest, -1, &data_out);
+}
+
+/*!
+ * \brief Copy a file's contents while computing its SHA512 hash
+ *
+ * Like copy_contents(), the target is truncated and created if needed. The
+ * source is only read once.
+ *
+ * \param source Source path
+ * \param target Target path
+ * \param digest `unsigned char` array of size `SHA512_DIGEST_LENGTH` to store
+ *               computed hash value
+ *
+ * \return true on success, false on failure and errno set appropriately
+ */
+bool sha512_copy_contents(const std::string &source, const std::string &target,
+                          unsigned char digest[SHA512_DIGEST_LENGTH])
+{
+    int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_source < 0) {
+        LOGE("%s: Failed to open: %s", source.c_str(), strerror(errno));
+        return false;
     }
 
-    if (ferror(fp.get())) {
-        LOGE("%s: Failed to read file", path.c_str());
-        errno = EIO;
+    auto close_fd_source = finally([&] {
+        int saved_errno = errno;
+        close(fd_source);
+        errno = saved_errno;
+    });
+
+    int fd_target = open(target.c_str(),
+                         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd_target < 0) {
+        LOGE("%s: Failed to open: %s", target.c_str(), strerror(errno));
         return false;
     }
 
-    if (!SHA512_Final(digest, &ctx)) {
-        LOGE("openssl: SHA512_Final() failed");
+    if (!sha512_fd(fd_source, source, digest, fd_target, nullptr)) {
+        int saved_errno = errno;
+        close(fd_target);
+        errno = saved_errno;
+        return false;
+    }
+
+    if (close(fd_target) < 0) {
+        LOGE("%s: Failed to close file: %s", target.c_str(), strerror(errno));
         return false;
     }
 
     return true;
 }
 
+/*!
+ * \brief Compute SHA512 hashes of several files concurrently
+ *
+ * Each job is processed by one of up to \p max_threads worker threads. All jobs
+ * are attempted even if some of them fail.
+ *
+ * \param jobs Jobs to process. Results are stored in each job.
+ * \param max_threads Maximum number of threads to use or 0 to use one thread
+ *                    per CPU
+ *
+ * \return true if all jobs succeeded, otherwise false
+ */
+bool sha512_hash_multiple(std::vector<Sha512Job> &jobs,
+                          unsigned int max_threads)
+{
+    if (max_threads == 0) {
+        max_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    auto n_threads = static_cast<unsigned int>(
+            std::min<size_t>(max_threads, jobs.size()));
+    std::atomic<size_t> next{0};
+
+    auto worker = [&] {
+        size_t i;
+
+        while ((i = next++) < jobs.size()) {
+            Sha512Job &job = jobs[i];
+
+            if (job.read_data) {
+                job.success = sha512_read_all(job.path, job.data, job.digest);
+            } else {
+                job.success = sha512_hash(job.path, job.digest);
+            }
+            job.error = job.success ? 0 : errno;
+        }
+    };
+
+    if (n_threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> threads;
+        threads.reserve(n_threads - 1);
+
+        for (unsigned int i = 1; i < n_threads; ++i) {
+            threads.emplace_back(worker);
+        }
+
+        // Use the current thread as one of the workers
+        worker();
+
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+    return std::all_of(jobs.begin(), jobs.end(), [](const Sha512Job &job) {
+        return job.success;
+    });
+}
+
 }
 }
@@ -19,13 +19,21 @@
 
 #include "mbutil/properties.h"
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
+#include <tuple>
 #include <vector>
 
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
@@ -240,87 +248,225 @@ bool property_get_all(std::unordered_map<std::string, std::string> &map)
 
 // Properties file functions
 
-enum class PropIterAction
+// Maximum number of parsed property files to keep in memory
+#define PROPERTY_FILE_CACHE_MAX         16
+
+struct PropertyFileData
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+
+    // Properties in the order they appear in the file
+    std::vector<std::pair<std::string, std::string>> entries;
+    // Index of the first entry for each key
+    std::unordered_map<std::string, size_t> index;
+};
+
+struct CachedPropertyFile
 {
-    Continue,
-    Stop,
+    std::shared_ptr<const PropertyFileData> data;
+    uint64_t last_used;
 };
 
-typedef PropIterAction (*PropIterCb)(const std::string &key,
-                                     const std::string &value,
-                                     void *cookie);
+static std::unordered_map<std::string, CachedPropertyFile> property_file_cache;
+static uint64_t property_file_cache_counter = 0;
+static std::mutex property_file_cache_lock;
 
-static bool iterate_property_file(const std::string &path, PropIterCb cb,
-                                  void *cookie)
+/*!
+ * \brief Parse properties from a buffer in a single pass
+ *
+ * Empty lines, comments, and lines without an equals sign are skipped. The
+ * key is everything before the first equals sign and the value is everything
+ * after it, up to the end of the line.
+ */
+static void parse_property_data(const char *buf, size_t size,
+                                PropertyFileData &data)
 {
-    ScopedFILE fp(fopen(path.c_str(), "r"), &fclose);
-    if (!fp) {
-        return false;
+    const char *end = buf + size;
+
+    for (const char *line = buf; line < end;) {
+        auto newline = static_cast<const char *>(
+                memchr(line, '\n', static_cast<size_t>(end - line)));
+        const char *line_end = newline ? newline : end;
+
+        if (line != line_end && *line != '#') {
+            auto equals = static_cast<const char *>(
+                    memchr(line, '=', static_cast<size_t>(line_end - line)));
+            if (equals) {
+                data.entries.emplace_back(
+                        std::piecewise_construct,
+                        std::forward_as_tuple(line, equals),
+                        std::forward_as_tuple(equals + 1, line_end));
+                data.index.emplace(data.entries.back().first,
+                                   data.entries.size() - 1);
+            }
+        }
+
+        line = newline ? newline + 1 : end;
     }
+}
 
-    char *line = nullptr;
-    size_t len = 0;
-    ssize_t read;
+static bool read_property_fd(int fd, const struct stat &sb,
+                             PropertyFileData &data)
+{
+    if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        auto size = static_cast<size_t>(sb.st_size);
 
-    auto free_line = finally([&] {
-        free(line);
-    });
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            auto unmap_map = finally([&] {
+                munmap(map, size);
+            });
 
-    while ((read = getline(&line, &len, fp.get())) >= 0) {
-        if (read == 0 || line[0] == '#') {
-            // Skip empty and comment lines
-            continue;
+            parse_property_data(static_cast<const char *>(map), size, data);
+            return true;
         }
+    }
 
-        char *equals = strchr(line, '=');
-        if (!equals) {
-            // No equals in line
-            continue;
+    // Fall back to reading the file for empty or special files
+    std::string buf;
+    char chunk[8192];
+    ssize_t n;
+
+    while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
         }
+        buf.append(chunk, static_cast<size_t>(n));
+    }
+
+    parse_property_data(buf.data(), buf.size(), data);
+    return true;
+}
+
+/*!
+ * \brief Load and parse a property file
+ *
+ * Parsed regular files are cached and reused as long as the device, inode,
+ * size, and modification time of the file do not change.
+ */
+static std::shared_ptr<const PropertyFileData>
+load_property_file(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return {};
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return {};
+    }
+
+    bool cacheable = S_ISREG(sb.st_mode);
 
-        *equals = '\0';
+    if (cacheable) {
+        std::lock_guard<std::mutex> lock(property_file_cache_lock);
 
-        if (line[read - 1] == '\n') {
-            line[read - 1] = '\0';
+        auto it = property_file_cache.find(path);
+        if (it != property_file_cache.end()) {
+            auto const &cached = it->second.data;
+
+            if (cached->dev == sb.st_dev
+                    && cached->ino == sb.st_ino
+                    && cached->size == sb.st_size
+                    && cached->mtime.tv_sec == sb.st_mtim.tv_sec
+                    && cached->mtime.tv_nsec == sb.st_mtim.tv_nsec) {
+                it->second.last_used = ++property_file_cache_counter;
+                return cached;
+            }
+
+            property_file_cache.erase(it);
         }
+    }
 
-        if (cb(line, equals + 1, cookie) == PropIterAction::Stop) {
-            return true;
+    auto data = std::make_shared<PropertyFileData>();
+    data->dev = sb.st_dev;
+    data->ino = sb.st_ino;
+    data->size = sb.st_size;
+    data->mtime = sb.st_mtim;
+
+    if (!read_property_fd(fd, sb, *data)) {
+        return {};
+    }
+
+    if (cacheable) {
+        std::lock_guard<std::mutex> lock(property_file_cache_lock);
+
+        if (property_file_cache.size() >= PROPERTY_FILE_CACHE_MAX) {
+            auto lru = std::min_element(
+                    property_file_cache.begin(), property_file_cache.end(),
+                    [](const auto &a, const auto &b) {
+                return a.second.last_used < b.second.last_used;
+            });
+            property_file_cache.erase(lru);
         }
+
+        property_file_cache[path] = { data, ++property_file_cache_counter };
     }
 
-    return !ferror(fp.get());
+    return data;
+}
+
+static void invalidate_property_file(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(property_file_cache_lock);
+    property_file_cache.erase(path);
 }
 
 bool property_file_get(const std::string &path, const std::string &key,
                        std::string &value_out)
 {
-    struct Ctx
-    {
-        const std::string *key;
-        std::string *value_out;
-        bool found;
-    };
+    auto data = load_property_file(path);
+    if (!data) {
+        return false;
+    }
 
-    Ctx ctx{&key, &value_out, false};
+    auto it = data->index.find(key);
+    if (it != data->index.end()) {
+        value_out = data->entries[it->second].second;
+    } else {
+        value_out.clear();
+    }
 
-    bool ret = iterate_property_file(
-            path, [](const std::string &key_, const std::string &value,
-                     void *cookie) {
-        auto *ctx_ = static_cast<Ctx *>(cookie);
-        if (key_ == *ctx_->key) {
-            *ctx_->value_out = value;
-            ctx_->found = true;
-            return PropIterAction::Stop;
-        }
-        return PropIterAction::Continue;
-    }, &ctx);
+    return true;
+}
 
-    if (!ctx.found) {
-        value_out.clear();
+/*!
+ * \brief Get the values of multiple keys from a property file
+ *
+ * The file is only parsed once, regardless of the number of keys. Like
+ * property_file_get(), the first occurrence of a key is used. Keys that are
+ * not in the file are not added to \p map.
+ *
+ * \return Whether the file could be read
+ */
+bool property_file_get_multiple(const std::string &path,
+                                const std::vector<std::string> &keys,
+                                std::unordered_map<std::string, std::string> &map)
+{
+    auto data = load_property_file(path);
+    if (!data) {
+        return false;
     }
 
-    return ret;
+    for (auto const &key : keys) {
+        auto it = data->index.find(key);
+        if (it != data->index.end()) {
+            map[key] = data->entries[it->second].second;
+        }
+    }
+
+    return true;
 }
 
 std::string property_file_get_string(const std::string &path,
@@ -352,36 +498,39 @@ bool property_file_get_bool(const std::string &path, const std::string &key,
 bool property_file_list(const std::string &path, PropertyListCb prop_fn,
                         void *cookie)
 {
-    struct Ctx
-    {
-        PropertyListCb prop_fn;
-        void *cookie;
-    };
+    auto data = load_property_file(path);
+    if (!data) {
+        return false;
+    }
 
-    Ctx ctx{prop_fn, cookie};
+    for (auto const &entry : data->entries) {
+        prop_fn(entry.first, entry.second, cookie);
+    }
 
-    return iterate_property_file(
-            path, [](const std::string &key, const std::string &value,
-                     void *cookie_) {
-        auto *ctx_ = static_cast<Ctx *>(cookie_);
-        ctx_->prop_fn(key, value, ctx_->cookie);
-        return PropIterAction::Continue;
-    }, &ctx);
+    return true;
 }
 
 bool property_file_get_all(const std::string &path,
                            std::unordered_map<std::string, std::string> &map)
 {
-    return property_file_list(path,
-            [](const std::string &key, const std::string &value, void *cookie) {
-        auto *map_ = static_cast<std::unordered_map<std::string, std::string> *>(cookie);
-        (*map_)[key] = value;
-    }, &map);
+    auto data = load_property_file(path);
+    if (!data) {
+        return false;
+    }
+
+    // Later entries take precedence
+    for (auto const &entry : data->entries) {
+        map[entry.first] = entry.second;
+    }
+
+    return true;
 }
 
 bool property_file_write_all(const std::string &path,
                              const std::unordered_map<std::string, std::string> &map)
 {
+    invalidate_property_file(path);
+
     ScopedFILE fp(fopen(path.c_str(), "wb"), fclose);
     if (!fp) {
         return false;
@@ -92,28 +92,36 @@ private:
     }
 };
 
-bool selinux_read_policy(const std::string &path, policydb_t *pdb)
+static int open_policy_file(const std::string &path, int flags)
 {
-    struct policy_file pf;
-    struct stat sb;
-    void *map;
-    int fd;
+    int fd = -1;
 
     for (int i = 0; i < OPEN_ATTEMPTS; ++i) {
-        fd = open(path.c_str(), O_RDONLY);
+        fd = open(path.c_str(), flags, 0644);
         if (fd < 0) {
             LOGE("[%d/%d] %s: Failed to open sepolicy: %s",
                  i + 1, OPEN_ATTEMPTS, path.c_str(), strerror(errno));
             if (errno == EBUSY) {
                 usleep(500 * 1000);
                 continue;
-            } else {
-                return false;
             }
         }
         break;
     }
 
+    return fd;
+}
+
+bool selinux_read_policy(const std::string &path, policydb_t *pdb)
+{
+    struct stat sb;
+    void *map;
+
+    int fd = open_policy_file(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
     auto close_fd = finally([&] {
         close(fd);
     });
@@ -134,10 +142,66 @@ bool selinux_read_policy(const std::string &path, policydb_t *pdb)
         munmap(map, static_cast<size_t>(sb.st_size));
     });
 
+    return selinux_policy_from_image(map, static_cast<size_t>(sb.st_size), pdb);
+}
+
+/*!
+ * \brief Read binary policy into memory without parsing it
+ */
+bool selinux_read_policy_image(const std::string &path,
+                               std::vector<unsigned char> &data_out)
+{
+    struct stat sb;
+
+    int fd = open_policy_file(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    if (fstat(fd, &sb) < 0) {
+        LOGE("%s: Failed to stat sepolicy: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::vector<unsigned char> data(static_cast<size_t>(sb.st_size));
+    size_t total = 0;
+
+    while (total < data.size()) {
+        ssize_t n = read(fd, data.data() + total, data.size() - total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("%s: Failed to read sepolicy: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+        total += static_cast<size_t>(n);
+    }
+
+    data.resize(total);
+    data_out.swap(data);
+
+    return true;
+}
+
+/*!
+ * \brief Parse binary policy from memory
+ */
+bool selinux_policy_from_image(const void *data, size_t size, policydb_t *pdb)
+{
+    struct policy_file pf;
+
     policy_file_init(&pf);
     pf.type = PF_USE_MEMORY;
-    pf.data = static_cast<char *>(map);
-    pf.len = static_cast<size_t>(sb.st_size);
+    pf.data = static_cast<char *>(const_cast<void *>(data));
+    pf.len = size;
 
     auto destroy_pf = finally([&] {
         sepol_handle_destroy(pf.handle);
@@ -146,15 +210,15 @@ bool selinux_read_policy(const std::string &path, policydb_t *pdb)
     return policydb_read(pdb, &pf, 0) == 0;
 }
 
-// /sys/fs/selinux/load requires the entire policy to be written in a single
-// write(2) call.
-// See: http://marc.info/?l=selinux&m=141882521027239&w=2
-bool selinux_write_policy(const std::string &path, policydb_t *pdb)
+/*!
+ * \brief Serialize policy to its binary form
+ */
+bool selinux_policy_to_image(policydb_t *pdb,
+                             std::vector<unsigned char> &data_out)
 {
     void *data;
     size_t len;
     sepol_handle_t *handle;
-    int fd;
 
     // Don't print warnings to stderr
     handle = sepol_handle_create();
@@ -173,26 +237,28 @@ bool selinux_write_policy(const std::string &path, policydb_t *pdb)
         free(data);
     });
 
-    for (int i = 0; i < OPEN_ATTEMPTS; ++i) {
-        fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
-        if (fd < 0) {
-            LOGE("[%d/%d] %s: Failed to open sepolicy: %s",
-                 i + 1, OPEN_ATTEMPTS, path.c_str(), strerror(errno));
-            if (errno == EBUSY) {
-                usleep(500 * 1000);
-                continue;
-            } else {
-                return false;
-            }
-        }
-        break;
+    auto ptr = static_cast<unsigned char *>(data);
+    data_out.assign(ptr, ptr + len);
+
+    return true;
+}
+
+// /sys/fs/selinux/load requires the entire policy to be written in a single
+// write(2) call.
+// See: http://marc.info/?l=selinux&m=141882521027239&w=2
+bool selinux_write_policy_image(const std::string &path,
+                                const void *data, size_t size)
+{
+    int fd = open_policy_file(path, O_CREAT | O_TRUNC | O_RDWR);
+    if (fd < 0) {
+        return false;
     }
 
     auto close_fd = finally([&] {
         close(fd);
     });
 
-    if (write(fd, data, len) < 0) {
+    if (write(fd, data, size) < 0) {
         LOGE("%s: Failed to write sepolicy: %s", path.c_str(), strerror(errno));
         return false;
     }
@@ -200,6 +266,14 @@ bool selinux_write_policy(const std::string &path, policydb_t *pdb)
     return true;
 }
 
+bool selinux_write_policy(const std::string &path, policydb_t *pdb)
+{
+    std::vector<unsigned char> data;
+
+    return selinux_policy_to_image(pdb, data)
+            && selinux_write_policy_image(path, data.data(), data.size());
+}
+
 bool selinux_get_context(const std::string &path, std::string &context)
 {
     ssize_t size;
@@ -23,6 +23,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 namespace mb
@@ -107,12 +108,42 @@ bool socket_read_bytes(int fd, std::vector<uint8_t> &result)
 
 bool socket_write_bytes(int fd, const uint8_t *data, size_t len)
 {
-    if (!socket_write_int32(fd, static_cast<int32_t>(len))) {
+    if (len > INT32_MAX) {
+        errno = EINVAL;
         return false;
     }
 
-    if (socket_write(fd, data, len) != static_cast<ssize_t>(len)) {
-        return false;
+    // Send the length prefix and the payload with a single syscall (in the
+    // common case) so large payloads aren't preceded by a tiny write
+    int32_t len32 = static_cast<int32_t>(len);
+    struct iovec iov[2];
+    iov[0].iov_base = &len32;
+    iov[0].iov_len = sizeof(len32);
+    iov[1].iov_base = const_cast<uint8_t *>(data);
+    iov[1].iov_len = len;
+
+    struct iovec *cur = iov;
+    int remain = 2;
+
+    while (remain > 0) {
+        ssize_t n = writev(fd, cur, remain);
+        if (n < 0) {
+            return false;
+        } else if (n == 0) {
+            errno = EIO;
+            return false;
+        }
+
+        size_t written = static_cast<size_t>(n);
+        while (remain > 0 && written >= cur->iov_len) {
+            written -= cur->iov_len;
+            ++cur;
+            --remain;
+        }
+        if (remain > 0) {
+            cur->iov_base = static_cast<char *>(cur->iov_base) + written;
+            cur->iov_len -= written;
+        }
     }
 
     return true;
@@ -479,7 +479,9 @@ static int runPages(const char *page_name, const int stop_on_page_done)
 #endif
         } else {
             gForceRender = 0;
-            PageManager::Render();
+            // Forced renders happen after changes that are not tracked as
+            // damage, so the whole screen must be redrawn
+            PageManager::Render(false);
             flip();
             input_timeout_ms = 0;
         }
@@ -60,6 +60,13 @@ public:
         return 0;
     }
 
+    // GetDamageRegion - Returns the area that the object may draw to
+    //  A width or height of 0 means the area is unknown
+    virtual int GetDamageRegion(int& x, int& y, int& w, int& h)
+    {
+        return GetRenderPos(x, y, w, h);
+    }
+
     // SetRenderPos - Update the position of the object
     //  Return 0 on success, <0 on error
     virtual int SetRenderPos(int x, int y, int w = 0, int h = 0)
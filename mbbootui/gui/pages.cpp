@@ -326,6 +326,11 @@ int ActionObject::SetActionPos(int x, int y, int w, int h)
 Page::Page(xml_node<>* page, std::vector<xml_node<>*> *templates)
 {
     mTouchStart = nullptr;
+    mPartialRender = false;
+    mDamageX = 0;
+    mDamageY = 0;
+    mDamageW = 0;
+    mDamageH = 0;
 
     // We can memset the whole structure, because the alpha channel is ignored
     memset(&mBackground, 0, sizeof(COLOR));
@@ -509,8 +514,108 @@ bool Page::ProcessNode(xml_node<>* page, std::vector<xml_node<>*> *templates, in
     return true;
 }
 
-int Page::Render()
+static bool RectsIntersect(int x1, int y1, int w1, int h1,
+                           int x2, int y2, int w2, int h2)
 {
+    return x1 < x2 + w2 && x2 < x1 + w1 && y1 < y2 + h2 && y2 < y1 + h1;
+}
+
+static bool RectContains(int x1, int y1, int w1, int h1,
+                         int x2, int y2, int w2, int h2)
+{
+    return x2 >= x1 && y2 >= y1 && x2 + w2 <= x1 + w1 && y2 + h2 <= y1 + h1;
+}
+
+void Page::AddDamage(int x, int y, int w, int h)
+{
+    if (mDamageW <= 0 || mDamageH <= 0) {
+        mDamageX = x;
+        mDamageY = y;
+        mDamageW = w;
+        mDamageH = h;
+        return;
+    }
+
+    int x2 = std::max(mDamageX + mDamageW, x + w);
+    int y2 = std::max(mDamageY + mDamageH, y + h);
+    mDamageX = std::min(mDamageX, x);
+    mDamageY = std::min(mDamageY, y);
+    mDamageW = x2 - mDamageX;
+    mDamageH = y2 - mDamageY;
+}
+
+// Grow the damaged region until it fully contains every object that overlaps
+// it. Objects are always rendered in full, so anything drawn above or below
+// them must be re-rendered as well. Returns false if the region cannot be
+// determined, in which case the whole page must be rendered.
+bool Page::ExpandDamage()
+{
+    struct Rect { int x, y, w, h; };
+    std::vector<Rect> rects;
+    rects.reserve(mRenders.size());
+
+    for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
+        Rect r;
+        (*iter)->GetDamageRegion(r.x, r.y, r.w, r.h);
+        if (r.w <= 0 || r.h <= 0) {
+            return false;
+        }
+        rects.push_back(r);
+    }
+
+    bool changed;
+    do {
+        changed = false;
+        for (auto const &r : rects) {
+            if (RectsIntersect(mDamageX, mDamageY, mDamageW, mDamageH,
+                               r.x, r.y, r.w, r.h)
+                    && !RectContains(mDamageX, mDamageY, mDamageW, mDamageH,
+                                     r.x, r.y, r.w, r.h)) {
+                AddDamage(r.x, r.y, r.w, r.h);
+                changed = true;
+            }
+        }
+    } while (changed);
+
+    // Clamp to the screen
+    int x2 = std::min(mDamageX + mDamageW, gr_fb_width());
+    int y2 = std::min(mDamageY + mDamageH, gr_fb_height());
+    mDamageX = std::max(mDamageX, 0);
+    mDamageY = std::max(mDamageY, 0);
+    mDamageW = x2 - mDamageX;
+    mDamageH = y2 - mDamageY;
+
+    return mDamageW > 0 && mDamageH > 0;
+}
+
+int Page::Render(bool allowPartial)
+{
+    bool partial = allowPartial && mPartialRender
+            && gr_fb_preserves_contents() && ExpandDamage();
+    mPartialRender = false;
+
+    if (partial) {
+        // Render background of the damaged region
+        gr_color(mBackground.red, mBackground.green, mBackground.blue, mBackground.alpha);
+        gr_fill(mDamageX, mDamageY, mDamageW, mDamageH);
+
+        // Render objects in the damaged region
+        for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
+            int x, y, w, h;
+            (*iter)->GetDamageRegion(x, y, w, h);
+            if (!RectsIntersect(mDamageX, mDamageY, mDamageW, mDamageH,
+                                x, y, w, h)) {
+                continue;
+            }
+            if ((*iter)->Render()) {
+                LOGE("A render request has failed.");
+            }
+        }
+
+        gr_damage(mDamageX, mDamageY, mDamageW, mDamageH);
+        return 0;
+    }
+
     // Render background
     gr_color(mBackground.red, mBackground.green, mBackground.blue, mBackground.alpha);
     gr_fill(0, 0, gr_fb_width(), gr_fb_height());
@@ -521,22 +626,59 @@ int Page::Render()
             LOGE("A render request has failed.");
         }
     }
+
+    gr_damage_all();
     return 0;
 }
 
+void Page::ResetDamage()
+{
+    mPartialRender = false;
+    mDamageX = 0;
+    mDamageY = 0;
+    mDamageW = 0;
+    mDamageH = 0;
+}
+
 int Page::Update()
 {
     int retCode = 0;
+    bool knownDamage = true;
+
+    mDamageW = 0;
+    mDamageH = 0;
 
     for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
         int ret = (*iter)->Update();
         if (ret < 0) {
             LOGE("An update request has failed.");
+            continue;
         } else if (ret > retCode) {
             retCode = ret;
         }
+
+        if (ret == 0) {
+            continue;
+        }
+
+        int x, y, w, h;
+        (*iter)->GetDamageRegion(x, y, w, h);
+        if (w <= 0 || h <= 0) {
+            knownDamage = false;
+            if (ret == 1) {
+                gr_damage_all();
+            }
+        } else if (ret == 1) {
+            // The object already rendered itself, so only the flip needs to
+            // know about it
+            gr_damage(x, y, w, h);
+        } else {
+            AddDamage(x, y, w, h);
+        }
     }
 
+    mPartialRender = knownDamage && retCode > 1;
+
     return retCode;
 }
 
@@ -921,6 +1063,7 @@ int PageSet::SetPage(const std::string& page)
         mCurrentPage = tmp;
         mCurrentPage->SetPageFocus(1);
         mCurrentPage->NotifyVarChange("", "");
+        ResetDamage();
         return 0;
     } else {
         LOGE("Unable to locate page (%s)", page.c_str());
@@ -964,9 +1107,23 @@ int PageSet::SetOverlay(Page* page)
             }
         }
     }
+    ResetDamage();
     return 0;
 }
 
+// The damage tracked by each page only describes what changed since the last
+// frame of that page. After switching pages or adding or removing an overlay,
+// the screen contents are unrelated, so everything must be redrawn.
+void PageSet::ResetDamage()
+{
+    if (mCurrentPage) {
+        mCurrentPage->ResetDamage();
+    }
+    for (auto iter = mOverlays.begin(); iter != mOverlays.end(); iter++) {
+        (*iter)->ResetDamage();
+    }
+}
+
 const ResourceManager* PageSet::GetResources()
 {
     return mResources;
@@ -1073,17 +1230,23 @@ std::string PageSet::GetCurrentPage() const
     return mCurrentPage ? mCurrentPage->GetName() : "";
 }
 
-int PageSet::Render()
+int PageSet::Render(bool allowPartial)
 {
     int ret;
 
-    ret = (mCurrentPage ? mCurrentPage->Render() : -1);
+    // Overlays are drawn on top of the current page, so the damaged regions
+    // of the individual pages cannot be rendered independently
+    if (!mOverlays.empty()) {
+        allowPartial = false;
+    }
+
+    ret = (mCurrentPage ? mCurrentPage->Render(allowPartial) : -1);
     if (ret < 0) {
         return ret;
     }
 
     for (auto iter = mOverlays.begin(); iter != mOverlays.end(); iter++) {
-        ret = ((*iter) ? (*iter)->Render() : -1);
+        ret = ((*iter) ? (*iter)->Render(allowPartial) : -1);
         if (ret < 0) {
             return ret;
         }
@@ -1442,6 +1605,7 @@ PageSet* PageManager::SelectPackage(const std::string& name)
         mCurrentSet = tmp;
         mCurrentSet->MakeEmergencyConsoleIfNeeded();
         mCurrentSet->NotifyVarChange("", "");
+        mCurrentSet->ResetDamage();
     } else {
         LOGE("Unable to find package.");
     }
@@ -1572,13 +1736,14 @@ int PageManager::IsCurrentPage(Page* page)
     return (mCurrentSet ? mCurrentSet->IsCurrentPage(page) : 0);
 }
 
-int PageManager::Render()
+int PageManager::Render(bool allowPartial)
 {
     if (blankTimer.isScreenOff()) {
         return 0;
     }
 
-    int res = (mCurrentSet ? mCurrentSet->Render() : -1);
+    // The mouse cursor is drawn on top of everything and may have moved
+    int res = (mCurrentSet ? mCurrentSet->Render(allowPartial && !mMouseCursor) : -1);
     if (mMouseCursor) {
         mMouseCursor->Render();
     }
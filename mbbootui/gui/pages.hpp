@@ -76,7 +76,10 @@ public:
     }
 
 public:
-    virtual int Render();
+    // Render - Render the page
+    //  If allowPartial is true, only the region damaged by objects during the
+    //  last Update() is rendered, if possible
+    virtual int Render(bool allowPartial = true);
     virtual int Update();
     virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
     virtual int NotifyKey(int key, bool down);
@@ -85,6 +88,8 @@ public:
     virtual int NotifyVarChange(const std::string& varName,
                                 const std::string& value);
     virtual void SetPageFocus(int inFocus);
+    // Forget the damaged region so that the next Render() redraws everything
+    void ResetDamage();
 
 protected:
     std::string mName;
@@ -96,8 +101,18 @@ protected:
     ActionObject* mTouchStart;
     COLOR mBackground;
 
+    // Bounding box of the objects that need to be re-rendered. Only valid if
+    // mPartialRender is true.
+    bool mPartialRender;
+    int mDamageX;
+    int mDamageY;
+    int mDamageW;
+    int mDamageH;
+
 protected:
     bool ProcessNode(xml_node<>* page, std::vector<xml_node<>*> *templates, int depth);
+    void AddDamage(int x, int y, int w, int h);
+    bool ExpandDamage();
 };
 
 struct LoadingContext;
@@ -116,6 +131,7 @@ public:
     Page* FindPage(const std::string& name);
     int SetPage(const std::string& page);
     int SetOverlay(Page* page);
+    void ResetDamage();
     const ResourceManager* GetResources();
 
     // Helper routine for identifing if we're the current page
@@ -123,7 +139,7 @@ public:
     std::string GetCurrentPage() const;
 
     // These are routing routines
-    int Render();
+    int Render(bool allowPartial = true);
     int Update();
     int NotifyTouch(TOUCH_STATE state, int x, int y);
     int NotifyKey(int key, bool down);
@@ -172,7 +188,7 @@ public:
     static int IsCurrentPage(Page* page);
 
     // These are routing routines
-    static int Render();
+    static int Render(bool allowPartial = true);
     static int Update();
     static int NotifyTouch(TOUCH_STATE state, int x, int y);
     static int NotifyKey(int key, bool down);
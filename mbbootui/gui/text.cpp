@@ -23,6 +23,7 @@
 GUIText::GUIText(xml_node<>* node) : GUIObject(node)
 {
     mFont = nullptr;
+    mLastRenderWidth = 0;
     mIsStatic = 1;
     mVarChanged = 0;
     mFontHeight = 0;
@@ -102,8 +103,8 @@ int GUIText::Render()
 
     __attribute__((unused))
     int x = mRenderX, y = mRenderY;
-    __attribute__((unused))
     int width = gr_ttf_measureEx(mLastValue.c_str(), fontResource);
+    mLastRenderWidth = width;
 
     if (isHighlighted) {
         gr_color(mHighlightColor.red, mHighlightColor.green,
@@ -161,6 +162,29 @@ int GUIText::GetCurrentBounds(int& w, int& h)
     return 0;
 }
 
+int GUIText::GetDamageRegion(int& x, int& y, int& w, int& h)
+{
+    if (!mFont) {
+        return RenderObject::GetDamageRegion(x, y, w, h);
+    }
+
+    // The text is positioned relative to (mRenderX, mRenderY) based on the
+    // placement, so report an area that covers every possible placement
+    int width = gr_ttf_measureEx(mLastValue.c_str(), mFont->GetResource());
+    if (width < mLastRenderWidth) {
+        width = mLastRenderWidth;
+    }
+    if (width < 1) {
+        width = 1;
+    }
+
+    x = mRenderX - width;
+    y = mRenderY - mFontHeight;
+    w = width * 2;
+    h = mFontHeight * 2;
+    return 0;
+}
+
 int GUIText::NotifyVarChange(const std::string& varName, const std::string& value)
 {
     GUIObject::NotifyVarChange(varName, value);
@@ -40,6 +40,9 @@ public:
     // Retrieve the size of the current string (dynamic strings may change per call)
     virtual int GetCurrentBounds(int& w, int& h);
 
+    // Area covered by the previously rendered and the current string
+    virtual int GetDamageRegion(int& x, int& y, int& w, int& h);
+
     // Notify of a variable change
     virtual int NotifyVarChange(const std::string& varName, const std::string& value);
 
@@ -62,4 +65,5 @@ protected:
     int mIsStatic;
     int mVarChanged;
     int mFontHeight;
+    int mLastRenderWidth;
 };
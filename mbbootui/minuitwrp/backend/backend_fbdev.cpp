@@ -41,12 +41,17 @@ static GRSurface* fbdev_init(minui_backend*);
 static GRSurface* fbdev_flip(minui_backend*);
 static void fbdev_blank(minui_backend*, bool);
 static void fbdev_exit(minui_backend*);
+static bool fbdev_preserves_contents(minui_backend*);
 
 static GRSurface gr_framebuffer[2];
 static bool double_buffered;
 static GRSurface* gr_draw = nullptr;
 static int displayed_buffer;
 
+// Rows copied to the framebuffer during the previous flip
+static int prev_copy_y1;
+static int prev_copy_y2;
+
 static fb_var_screeninfo vi;
 static int fb_fd = -1;
 static __u32 smem_len;
@@ -56,6 +61,7 @@ static minui_backend my_backend = {
     .flip = fbdev_flip,
     .blank = fbdev_blank,
     .exit = fbdev_exit,
+    .preserves_contents = fbdev_preserves_contents,
 };
 
 extern "C" struct minui_backend * BACKEND_FUNCTION(fbdev)()
@@ -272,10 +278,20 @@ static GRSurface* fbdev_init(minui_backend* backend)
 
     smem_len = fi.smem_len;
 
+    prev_copy_y1 = 0;
+    prev_copy_y2 = gr_draw->height;
+
     return gr_draw;
 }
 
-static GRSurface* fbdev_flip(minui_backend* backend __unused)
+static bool fbdev_preserves_contents(minui_backend* backend __unused)
+{
+    // The in-memory surface is byte swapped in place when flipping in BGRA
+    // mode
+    return tw_device.tw_pixel_format() != mb::device::TwPixelFormat::Bgra8888;
+}
+
+static GRSurface* fbdev_flip(minui_backend* backend)
 {
     if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
         // In case of BGRA, do some byte swapping
@@ -290,16 +306,36 @@ static GRSurface* fbdev_flip(minui_backend* backend __unused)
         }
     }
     if (!(tw_device.tw_flags() & mb::device::TwFlag::BoardHasFlippedScreen)) {
+        // Only copy the rows that changed since the previous flip
+        int y1 = 0;
+        int y2 = gr_draw->height;
+        int damage_y, damage_h;
+        if (fbdev_preserves_contents(backend)
+                && gr_get_flip_damage(&damage_y, &damage_h)) {
+            y1 = damage_y;
+            y2 = damage_y + damage_h;
+        }
+
         if (double_buffered) {
+            // The back buffer was last updated two flips ago, so it is also
+            // missing the rows copied during the previous flip
+            int copy_y1 = y1 < prev_copy_y1 ? y1 : prev_copy_y1;
+            int copy_y2 = y2 > prev_copy_y2 ? y2 : prev_copy_y2;
+
             // Copy from the in-memory surface to the framebuffer.
-            memcpy(gr_framebuffer[1-displayed_buffer].data, gr_draw->data,
-                   gr_draw->height * gr_draw->row_bytes);
+            memcpy(gr_framebuffer[1-displayed_buffer].data + copy_y1 * gr_draw->row_bytes,
+                   gr_draw->data + copy_y1 * gr_draw->row_bytes,
+                   (copy_y2 - copy_y1) * gr_draw->row_bytes);
             set_displayed_framebuffer(1-displayed_buffer);
         } else {
             // Copy from the in-memory surface to the framebuffer.
-            memcpy(gr_framebuffer[0].data, gr_draw->data,
-                   gr_draw->height * gr_draw->row_bytes);
+            memcpy(gr_framebuffer[0].data + y1 * gr_draw->row_bytes,
+                   gr_draw->data + y1 * gr_draw->row_bytes,
+                   (y2 - y1) * gr_draw->row_bytes);
         }
+
+        prev_copy_y1 = y1;
+        prev_copy_y2 = y2;
     } else {
         int gr_active_fb = 0;
         if (double_buffered) {
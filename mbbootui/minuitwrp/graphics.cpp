@@ -38,6 +38,7 @@
 #include "minui.h"
 #include "graphics.h"
 #include "gui/placement.h"
+#include "pixel_ops.h"
 
 struct GRFont
 {
@@ -54,7 +55,6 @@ static int overscan_offset_y = 0;
 static unsigned char gr_current_r = 255;
 static unsigned char gr_current_g = 255;
 static unsigned char gr_current_b = 255;
-__attribute__((unused))
 static unsigned char gr_current_a = 255;
 __attribute__((unused))
 static unsigned char rgb_555[2];
@@ -67,9 +67,23 @@ static unsigned char gr_current_b5 = 31;
 
 GRSurface* gr_draw = nullptr;
 
+// Rows of the drawing surface that were modified since the last flip
+static bool gr_damage_reported = false;
+static bool gr_damage_full = false;
+static int gr_damage_y1 = 0;
+static int gr_damage_y2 = 0;
+
+// Damage passed to the backend during a flip
+static bool gr_flip_damage_full = true;
+static int gr_flip_damage_y1 = 0;
+static int gr_flip_damage_y2 = 0;
+
 static GGLContext *gr_context = 0;
 GGLSurface gr_mem_surface;
 static int gr_is_curr_clr_opaque = 0;
+static bool gr_clip_enabled = false;
+
+static const PixelOps *gr_pixel_ops = nullptr;
 
 #if 0 // unused
 static bool outside(int x, int y)
@@ -138,6 +152,7 @@ void gr_clip(int x, int y, int w, int h)
     GGLContext *gl = gr_context;
     gl->scissor(gl, x, y, w, h);
     gl->enable(gl, GGL_SCISSOR_TEST);
+    gr_clip_enabled = true;
 }
 
 void gr_noclip()
@@ -145,6 +160,7 @@ void gr_noclip()
     GGLContext *gl = gr_context;
     gl->scissor(gl, 0, 0, gr_fb_width(), gr_fb_height());
     gl->disable(gl, GGL_SCISSOR_TEST);
+    gr_clip_enabled = false;
 }
 
 void gr_line(int x0, int y0, int x1, int y1, int width)
@@ -201,49 +217,191 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
 {
     GGLContext *gl = gr_context;
     GGLint color[4];
-    if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Abgr8888
-            || tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
-        color[0] = ((b << 8) | r) + 1;
-        color[1] = ((g << 8) | g) + 1;
-        color[2] = ((r << 8) | b) + 1;
-        color[3] = ((a << 8) | a) + 1;
-    } else {
-        color[0] = ((r << 8) | r) + 1;
-        color[1] = ((g << 8) | g) + 1;
-        color[2] = ((b << 8) | b) + 1;
-        color[3] = ((a << 8) | a) + 1;
-    }
+    bool swap_rb =
+            tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Abgr8888
+            || tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888;
+    pixel_color_to_fixed(r, g, b, a, swap_rb, color);
     gl->color4xv(gl, color);
 
+    // Keep the channels in the order that pixelflinger writes them. On
+    // BGR-ordered framebuffers, gr_current_r holds blue and gr_current_b holds
+    // red, just like pixelflinger's red and blue slots.
+    gr_current_r = pixel_fixed_to_channel(color[0]);
+    gr_current_g = pixel_fixed_to_channel(color[1]);
+    gr_current_b = pixel_fixed_to_channel(color[2]);
+    gr_current_a = pixel_fixed_to_channel(color[3]);
+
     gr_is_curr_clr_opaque = (a == 255);
 }
 
-void gr_clear()
+// Pack the current color into the pixel format of the drawing surface. Returns
+// false if the format is not supported by the pixel kernels.
+static bool gr_pack_current_color(uint32_t *px)
+{
+    if ((gr_draw->format == GGL_PIXEL_FORMAT_RGB_565)
+            != (gr_draw->pixel_bytes == 2)) {
+        return false;
+    }
+
+    switch (gr_draw->format) {
+    case GGL_PIXEL_FORMAT_RGBA_8888:
+    case GGL_PIXEL_FORMAT_RGBX_8888:
+        *px = pixel_pack32(gr_current_r, gr_current_g, gr_current_b,
+                           gr_current_a);
+        return true;
+    case GGL_PIXEL_FORMAT_BGRA_8888:
+        *px = pixel_pack32(gr_current_b, gr_current_g, gr_current_r,
+                           gr_current_a);
+        return true;
+    case GGL_PIXEL_FORMAT_RGB_565:
+        *px = ((gr_current_r >> 3) << 11) | ((gr_current_g >> 2) << 5)
+                | (gr_current_b >> 3);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Clamp a rectangle to the drawing surface. Returns false if nothing is left.
+static bool gr_clamp_rect(int *x, int *y, int *w, int *h)
+{
+    int x1 = *x < 0 ? 0 : *x;
+    int y1 = *y < 0 ? 0 : *y;
+    int x2 = *x + *w > gr_draw->width ? gr_draw->width : *x + *w;
+    int y2 = *y + *h > gr_draw->height ? gr_draw->height : *y + *h;
+
+    if (x1 >= x2 || y1 >= y2) {
+        return false;
+    }
+
+    *x = x1;
+    *y = y1;
+    *w = x2 - x1;
+    *h = y2 - y1;
+    return true;
+}
+
+// Fill a rectangle using the pixel kernels. Returns false if the caller must
+// fall back to pixelflinger.
+static bool gr_fill_fast(int x, int y, int w, int h)
 {
+    uint32_t px;
+
+    if (gr_clip_enabled || !gr_pack_current_color(&px)) {
+        return false;
+    }
+
+    if (!gr_clamp_rect(&x, &y, &w, &h)) {
+        return true;
+    }
+
+    uint8_t *dst = gr_draw->data + y * gr_draw->row_bytes
+            + x * gr_draw->pixel_bytes;
+
     if (gr_draw->pixel_bytes == 2) {
+        if (!gr_is_curr_clr_opaque) {
+            return false;
+        }
+        gr_pixel_ops->fill16(dst, gr_draw->row_bytes, w, h,
+                             static_cast<uint16_t>(px));
+    } else if (gr_draw->pixel_bytes == 4) {
+        if (gr_is_curr_clr_opaque) {
+            gr_pixel_ops->fill32(dst, gr_draw->row_bytes, w, h, px);
+        } else if (gr_current_a != 0) {
+            gr_pixel_ops->blend_fill32(dst, gr_draw->row_bytes, w, h, px);
+        }
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// Blit a 32bpp surface using the pixel kernels. Only the combinations where
+// pixelflinger does not reorder the channels are handled. Returns false if
+// the caller must fall back to pixelflinger.
+static bool gr_blit_fast(GGLSurface *surface, int sx, int sy, int w, int h,
+                         int dx, int dy)
+{
+    if (gr_clip_enabled || gr_draw->pixel_bytes != 4) {
+        return false;
+    }
+
+    bool opaque;
+
+    switch (surface->format) {
+    case GGL_PIXEL_FORMAT_RGBX_8888:
+    case GGL_PIXEL_FORMAT_RGBA_8888:
+        if (gr_draw->format != GGL_PIXEL_FORMAT_RGBA_8888
+                && gr_draw->format != GGL_PIXEL_FORMAT_RGBX_8888) {
+            return false;
+        }
+        opaque = surface->format == GGL_PIXEL_FORMAT_RGBX_8888;
+        break;
+    case GGL_PIXEL_FORMAT_BGRA_8888:
+        if (gr_draw->format != GGL_PIXEL_FORMAT_BGRA_8888) {
+            return false;
+        }
+        opaque = false;
+        break;
+    default:
+        return false;
+    }
+
+    int cx = dx;
+    int cy = dy;
+    if (!gr_clamp_rect(&cx, &cy, &w, &h)) {
+        return true;
+    }
+    sx += cx - dx;
+    sy += cy - dy;
+
+    // pixelflinger wraps texture coordinates, which is not worth replicating
+    if (sx < 0 || sy < 0 || sx + w > static_cast<int>(surface->width)
+            || sy + h > static_cast<int>(surface->height)) {
+        return false;
+    }
+
+    size_t src_stride = surface->stride * 4;
+    const uint8_t *src = surface->data + sy * src_stride + sx * 4;
+    uint8_t *dst = gr_draw->data + cy * gr_draw->row_bytes + cx * 4;
+
+    if (opaque) {
+        pixel_copy_rows(dst, gr_draw->row_bytes, src, src_stride,
+                        static_cast<size_t>(w) * 4, h);
+    } else {
+        gr_pixel_ops->blend32(dst, gr_draw->row_bytes, src, src_stride, w, h);
+    }
+
+    return true;
+}
+
+void gr_clear()
+{
+    uint32_t px;
+
+    if (!gr_pack_current_color(&px)) {
         gr_fill(0, 0, gr_fb_width(), gr_fb_height());
         return;
     }
 
-    // This code only works on 32bpp devices
-    if (gr_current_r == gr_current_g && gr_current_r == gr_current_b) {
-        memset(gr_draw->data, gr_current_r, gr_draw->height * gr_draw->row_bytes);
+    if (gr_draw->pixel_bytes == 2) {
+        gr_pixel_ops->fill16(gr_draw->data, gr_draw->row_bytes,
+                             gr_draw->width, gr_draw->height,
+                             static_cast<uint16_t>(px));
     } else {
-        unsigned char* px = gr_draw->data;
-        for (int y = 0; y < gr_draw->height; ++y) {
-            for (int x = 0; x < gr_draw->width; ++x) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            }
-            px += gr_draw->row_bytes - (gr_draw->width * gr_draw->pixel_bytes);
-        }
+        // Clearing always replaces the existing contents
+        gr_pixel_ops->fill32(gr_draw->data, gr_draw->row_bytes,
+                             gr_draw->width, gr_draw->height, px | 0xff000000);
     }
 }
 
 void gr_fill(int x, int y, int w, int h)
 {
+    if (gr_fill_fast(x, y, w, h)) {
+        return;
+    }
+
     GGLContext *gl = gr_context;
 
     if (gr_is_curr_clr_opaque) {
@@ -266,6 +424,10 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
     GGLContext *gl = gr_context;
     GGLSurface *surface = (GGLSurface*)source;
 
+    if (gr_blit_fast(surface, sx, sy, w, h, dx, dy)) {
+        return;
+    }
+
     if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
         gl->disable(gl, GGL_BLEND);
     }
@@ -300,8 +462,74 @@ unsigned int gr_get_height(gr_surface surface)
     return ((GGLSurface*) surface)->height;
 }
 
+void gr_damage(int x, int y, int w, int h)
+{
+    // Only complete rows are tracked since that is what the backends can
+    // update efficiently
+    (void) x;
+    (void) w;
+
+    if (h <= 0) {
+        return;
+    }
+
+    int y1 = y;
+    int y2 = y1 + h;
+    if (y1 < 0) {
+        y1 = 0;
+    }
+    if (y2 > gr_draw->height) {
+        y2 = gr_draw->height;
+    }
+    if (y1 >= y2) {
+        return;
+    }
+
+    if (!gr_damage_reported) {
+        gr_damage_y1 = y1;
+        gr_damage_y2 = y2;
+        gr_damage_reported = true;
+    } else {
+        if (y1 < gr_damage_y1) {
+            gr_damage_y1 = y1;
+        }
+        if (y2 > gr_damage_y2) {
+            gr_damage_y2 = y2;
+        }
+    }
+}
+
+void gr_damage_all(void)
+{
+    gr_damage_reported = true;
+    gr_damage_full = true;
+}
+
+bool gr_fb_preserves_contents(void)
+{
+    return gr_backend->preserves_contents
+            && gr_backend->preserves_contents(gr_backend);
+}
+
+bool gr_get_flip_damage(int *y, int *h)
+{
+    if (gr_flip_damage_full) {
+        return false;
+    }
+
+    *y = gr_flip_damage_y1;
+    *h = gr_flip_damage_y2 - gr_flip_damage_y1;
+    return true;
+}
+
 void gr_flip()
 {
+    gr_flip_damage_full = !gr_damage_reported || gr_damage_full;
+    gr_flip_damage_y1 = gr_damage_y1;
+    gr_flip_damage_y2 = gr_damage_y2;
+    gr_damage_reported = false;
+    gr_damage_full = false;
+
     gr_draw = gr_backend->flip(gr_backend);
     // On double buffered back ends, when we flip, we need to tell
     // pixel flinger to draw to the other buffer
@@ -360,6 +588,9 @@ int gr_init(void)
     overscan_offset_x = gr_draw->width * tw_device.tw_overscan_percent() / 100;
     overscan_offset_y = gr_draw->height * tw_device.tw_overscan_percent() / 100;
 
+    gr_pixel_ops = pixel_ops_get();
+    printf("Using %s pixel kernels\n", gr_pixel_ops->name);
+
     // Set up pixelflinger
     get_memory_surface(&gr_mem_surface);
     gglInit(&gr_context);
@@ -35,6 +35,15 @@ struct minui_backend
 
     // Device cleanup when drawing is done.
     void (*exit)(minui_backend*);
+
+    // Whether the surface returned by flip() still contains the frame that
+    // was just flipped. If null, the contents are assumed to be undefined.
+    bool (*preserves_contents)(minui_backend*);
 };
 
+// Get the rows of the drawing surface that were modified since the previous
+// flip. Returns false if the entire surface must be assumed to be modified.
+// Only valid while the backend's flip() is running.
+bool gr_get_flip_damage(int *y, int *h);
+
 #endif
@@ -51,6 +51,14 @@ gr_pixel *gr_fb_data(void);
 void gr_flip(void);
 void gr_fb_blank(bool blank);
 
+// Report the region of the screen that was modified before the next flip. If
+// nothing is reported, the entire screen is assumed to have been modified.
+void gr_damage(int x, int y, int w, int h);
+void gr_damage_all(void);
+// Whether the contents of the screen are retained after flipping, allowing
+// only the damaged regions to be redrawn
+bool gr_fb_preserves_contents(void);
+
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 void gr_clip(int x, int y, int w, int h);
 void gr_noclip();
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pixel_ops.h"
+
+#include <cstring>
+
+#if defined(MINUI_HAVE_NEON) && defined(__arm__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+static void generic_fill32(uint8_t *dst, size_t dst_stride, int w, int h,
+                           uint32_t px)
+{
+    for (int y = 0; y < h; ++y) {
+        uint32_t *row = reinterpret_cast<uint32_t *>(dst + y * dst_stride);
+        for (int x = 0; x < w; ++x) {
+            row[x] = px;
+        }
+    }
+}
+
+static void generic_fill16(uint8_t *dst, size_t dst_stride, int w, int h,
+                           uint16_t px)
+{
+    for (int y = 0; y < h; ++y) {
+        uint16_t *row = reinterpret_cast<uint16_t *>(dst + y * dst_stride);
+        for (int x = 0; x < w; ++x) {
+            row[x] = px;
+        }
+    }
+}
+
+static void generic_blend_fill32(uint8_t *dst, size_t dst_stride, int w, int h,
+                                 uint32_t px)
+{
+    uint32_t a = px >> 24;
+
+    for (int y = 0; y < h; ++y) {
+        uint32_t *row = reinterpret_cast<uint32_t *>(dst + y * dst_stride);
+        for (int x = 0; x < w; ++x) {
+            row[x] = pixel_blend32(px, row[x], a);
+        }
+    }
+}
+
+static void generic_blend32(uint8_t *dst, size_t dst_stride,
+                            const uint8_t *src, size_t src_stride, int w, int h)
+{
+    for (int y = 0; y < h; ++y) {
+        uint32_t *d = reinterpret_cast<uint32_t *>(dst + y * dst_stride);
+        const uint32_t *s =
+                reinterpret_cast<const uint32_t *>(src + y * src_stride);
+
+        for (int x = 0; x < w; ++x) {
+            uint32_t a = s[x] >> 24;
+            if (a == 255) {
+                d[x] = s[x];
+            } else if (a != 0) {
+                d[x] = pixel_blend32(s[x], d[x], a);
+            }
+        }
+    }
+}
+
+const PixelOps pixel_ops_generic = {
+    "generic",
+    generic_fill32,
+    generic_fill16,
+    generic_blend_fill32,
+    generic_blend32,
+};
+
+static const PixelOps * select_pixel_ops()
+{
+#if defined(MINUI_HAVE_NEON)
+#  if defined(__arm__)
+    // NEON is optional on armeabi-v7a
+    if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+        return &pixel_ops_neon;
+    }
+#  else
+    return &pixel_ops_neon;
+#  endif
+#elif defined(MINUI_HAVE_SSE2)
+    // SSE2 is part of the x86 and x86_64 Android ABIs
+    return &pixel_ops_sse2;
+#endif
+
+    return &pixel_ops_generic;
+}
+
+const PixelOps * pixel_ops_get()
+{
+    static const PixelOps *ops = select_pixel_ops();
+    return ops;
+}
+
+void pixel_copy_rows(uint8_t *dst, size_t dst_stride,
+                     const uint8_t *src, size_t src_stride,
+                     size_t row_bytes, int h)
+{
+    if (dst_stride == row_bytes && src_stride == row_bytes) {
+        memcpy(dst, src, row_bytes * static_cast<size_t>(h));
+        return;
+    }
+
+    for (int y = 0; y < h; ++y) {
+        memcpy(dst + y * dst_stride, src + y * src_stride, row_bytes);
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Pixel kernels used by the fast paths in graphics.cpp. All strides are in
+// bytes. 32bpp pixels must have the alpha (or unused) channel in the most
+// significant byte (eg. RGBA_8888, RGBX_8888, and BGRA_8888). Blending uses
+// (src * a + dst * (255 - a)) / 255 for every channel, including alpha.
+struct PixelOps
+{
+    const char *name;
+
+    // Fill a rectangle with a 32bpp pixel value
+    void (*fill32)(uint8_t *dst, size_t dst_stride, int w, int h, uint32_t px);
+    // Fill a rectangle with a 16bpp pixel value
+    void (*fill16)(uint8_t *dst, size_t dst_stride, int w, int h, uint16_t px);
+    // Blend a 32bpp color, using its alpha channel, onto a rectangle
+    void (*blend_fill32)(uint8_t *dst, size_t dst_stride, int w, int h,
+                         uint32_t px);
+    // Blend a 32bpp source image onto a 32bpp destination with the same
+    // channel order, using the source's alpha channel
+    void (*blend32)(uint8_t *dst, size_t dst_stride,
+                    const uint8_t *src, size_t src_stride, int w, int h);
+};
+
+extern const PixelOps pixel_ops_generic;
+#ifdef MINUI_HAVE_NEON
+extern const PixelOps pixel_ops_neon;
+#endif
+#ifdef MINUI_HAVE_SSE2
+extern const PixelOps pixel_ops_sse2;
+#endif
+
+// Returns the fastest implementation supported by the CPU
+const PixelOps * pixel_ops_get();
+
+// Copy rows of pixels without any conversion
+void pixel_copy_rows(uint8_t *dst, size_t dst_stride,
+                     const uint8_t *src, size_t src_stride,
+                     size_t row_bytes, int h);
+
+// Convert an 8-bit color to the 16.16 fixed point channel values passed to
+// pixelflinger's color4xv(). Pixelflinger writes channel 0 to the lowest byte
+// of an RGBA_8888 surface, so red and blue are swapped for BGR-ordered
+// framebuffers. Adding 1 maps 255 to 1.0 (0x10000).
+static inline void pixel_color_to_fixed(uint8_t r, uint8_t g, uint8_t b,
+                                        uint8_t a, bool swap_rb,
+                                        int32_t out[4])
+{
+    uint8_t c0 = swap_rb ? b : r;
+    uint8_t c2 = swap_rb ? r : b;
+
+    out[0] = ((c0 << 8) | c2) + 1;
+    out[1] = ((g << 8) | g) + 1;
+    out[2] = ((c2 << 8) | c0) + 1;
+    out[3] = ((a << 8) | a) + 1;
+}
+
+// 8-bit value that pixelflinger writes for a channel passed to color4xv().
+// Only the high byte of the channel is significant.
+static inline uint8_t pixel_fixed_to_channel(int32_t c)
+{
+    return static_cast<uint8_t>(((c - 1) >> 8) & 0xff);
+}
+
+// Pack four channels into a 32bpp pixel, with channel 0 in the lowest byte
+static inline uint32_t pixel_pack32(uint8_t c0, uint8_t c1, uint8_t c2,
+                                    uint8_t c3)
+{
+    return c0 | (c1 << 8) | (c2 << 16) | (static_cast<uint32_t>(c3) << 24);
+}
+
+// Divide a value in [0, 255 * 255] by 255, rounding to the nearest integer
+static inline uint32_t pixel_div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t pixel_blend32(uint32_t src, uint32_t dst, uint32_t a)
+{
+    uint32_t result = 0;
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t s = (src >> shift) & 0xff;
+        uint32_t d = (dst >> shift) & 0xff;
+        result |= pixel_div255(s * a + d * (255 - a)) << shift;
+    }
+
+    return result;
+}
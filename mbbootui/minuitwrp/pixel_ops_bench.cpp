@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compares the pixel kernels against the generic implementation for
+// correctness and speed. Usage: mbbootui-pixel-bench [<width> <height>]
+
+#include "pixel_ops.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static std::vector<uint8_t> random_pixels(size_t size, unsigned int seed)
+{
+    std::vector<uint8_t> data(size);
+    srand(seed);
+    for (auto &b : data) {
+        b = static_cast<uint8_t>(rand());
+    }
+    return data;
+}
+
+template<typename Fn>
+static double time_ms(Fn &&fn, int iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        fn();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count()
+            / iterations;
+}
+
+// Pixel that pixelflinger writes to an RGBA_8888 surface when filling with the
+// color4xv() values in color. Each channel is the high byte of its clamped
+// 16-bit value.
+static uint32_t pixelflinger_fill_pixel(const int32_t color[4])
+{
+    uint8_t c[4];
+    for (int i = 0; i < 4; ++i) {
+        c[i] = static_cast<uint8_t>(std::min<int32_t>(color[i], 0xffff) >> 8);
+    }
+    return pixel_pack32(c[0], c[1], c[2], c[3]);
+}
+
+// Check that the fast fill path produces the same pixels as pixelflinger for a
+// color whose red and blue differ, on both swapped and unswapped formats
+static bool check_fill_color(const PixelOps *ops)
+{
+    static const uint8_t r = 0x20, g = 0x60, b = 0xc0, a = 0xff;
+    static const int w = 7, h = 3;
+    const size_t stride = w * 4;
+    bool ok = true;
+
+    for (bool swap_rb : { false, true }) {
+        int32_t color[4];
+        pixel_color_to_fixed(r, g, b, a, swap_rb, color);
+
+        std::vector<uint8_t> fast(stride * h);
+        std::vector<uint8_t> slow(stride * h);
+
+        // Fast path (see gr_pack_current_color() in graphics.cpp)
+        ops->fill32(fast.data(), stride, w, h, pixel_pack32(
+                pixel_fixed_to_channel(color[0]),
+                pixel_fixed_to_channel(color[1]),
+                pixel_fixed_to_channel(color[2]),
+                pixel_fixed_to_channel(color[3])));
+        // Slow path
+        pixel_ops_generic.fill32(slow.data(), stride, w, h,
+                                 pixelflinger_fill_pixel(color));
+
+        if (fast != slow || fast[0] != (swap_rb ? b : r)
+                || fast[2] != (swap_rb ? r : b)) {
+            printf("%s: fill32 color mismatch (swap_rb=%d)\n",
+                   ops->name, swap_rb);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static bool bench(const PixelOps *ops, int w, int h, int iterations)
+{
+    size_t stride = static_cast<size_t>(w) * 4;
+    auto src = random_pixels(stride * h, 1);
+    auto dst_init = random_pixels(stride * h, 2);
+    auto dst = dst_init;
+    auto ref = dst_init;
+    bool ok = check_fill_color(ops);
+
+    // Correctness against the generic kernels
+    pixel_ops_generic.blend32(ref.data(), stride, src.data(), stride, w, h);
+    ops->blend32(dst.data(), stride, src.data(), stride, w, h);
+    if (dst != ref) {
+        printf("%s: blend32 output mismatch\n", ops->name);
+        ok = false;
+    }
+
+    ref = dst_init;
+    dst = dst_init;
+    pixel_ops_generic.blend_fill32(ref.data(), stride, w, h, 0x80406020);
+    ops->blend_fill32(dst.data(), stride, w, h, 0x80406020);
+    if (dst != ref) {
+        printf("%s: blend_fill32 output mismatch\n", ops->name);
+        ok = false;
+    }
+
+    printf("%-8s fill32:       %8.3f ms\n", ops->name, time_ms([&]{
+        ops->fill32(dst.data(), stride, w, h, 0xff204060);
+    }, iterations));
+    printf("%-8s fill16:       %8.3f ms\n", ops->name, time_ms([&]{
+        ops->fill16(dst.data(), stride / 2, w, h, 0x1234);
+    }, iterations));
+    printf("%-8s blend_fill32: %8.3f ms\n", ops->name, time_ms([&]{
+        ops->blend_fill32(dst.data(), stride, w, h, 0x80406020);
+    }, iterations));
+    printf("%-8s blend32:      %8.3f ms\n", ops->name, time_ms([&]{
+        ops->blend32(dst.data(), stride, src.data(), stride, w, h);
+    }, iterations));
+
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    int w = 1080;
+    int h = 1920;
+    int iterations = 50;
+
+    if (argc == 3) {
+        w = atoi(argv[1]);
+        h = atoi(argv[2]);
+    } else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [<width> <height>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (w <= 0 || h <= 0) {
+        fprintf(stderr, "Invalid dimensions: %dx%d\n", w, h);
+        return EXIT_FAILURE;
+    }
+
+    bool ok = bench(&pixel_ops_generic, w, h, iterations);
+
+    const PixelOps *ops = pixel_ops_get();
+    if (ops != &pixel_ops_generic) {
+        ok = bench(ops, w, h, iterations) && ok;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
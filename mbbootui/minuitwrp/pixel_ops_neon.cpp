@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pixel_ops.h"
+
+#include <arm_neon.h>
+
+static void neon_fill32(uint8_t *dst, size_t dst_stride, int w, int h,
+                        uint32_t px)
+{
+    uint32x4_t v = vdupq_n_u32(px);
+
+    for (int y = 0; y < h; ++y) {
+        uint32_t *row = reinterpret_cast<uint32_t *>(dst + y * dst_stride);
+        int x = 0;
+
+        for (; x + 8 <= w; x += 8) {
+            vst1q_u32(row + x, v);
+            vst1q_u32(row + x + 4, v);
+        }
+        for (; x < w; ++x) {
+            row[x] = px;
+        }
+    }
+}
+
+static void neon_fill16(uint8_t *dst, size_t dst_stride, int w, int h,
+                        uint16_t px)
+{
+    uint16x8_t v = vdupq_n_u16(px);
+
+    for (int y = 0; y < h; ++y) {
+        uint16_t *row = reinterpret_cast<uint16_t *>(dst + y * dst_stride);
+        int x = 0;
+
+        for (; x + 16 <= w; x += 16) {
+            vst1q_u16(row + x, v);
+            vst1q_u16(row + x + 8, v);
+        }
+        for (; x < w; ++x) {
+            row[x] = px;
+        }
+    }
+}
+
+// (s * a + d * (255 - a)) / 255, rounded, for 8 channel values
+static inline uint8x8_t neon_blend_channel(uint8x8_t s, uint8x8_t d,
+                                           uint8x8_t a, uint8x8_t inv_a)
+{
+    uint16x8_t t = vmull_u8(s, a);
+    t = vmlal_u8(t, d, inv_a);
+    return vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8);
+}
+
+static inline uint8x8x4_t neon_blend_pixels(uint8x8x4_t s, uint8x8x4_t d,
+                                            uint8x8_t a)
+{
+    uint8x8_t inv_a = vmvn_u8(a);
+    uint8x8x4_t r;
+
+    r.val[0] = neon_blend_channel(s.val[0], d.val[0], a, inv_a);
+    r.val[1] = neon_blend_channel(s.val[1], d.val[1], a, inv_a);
+    r.val[2] = neon_blend_channel(s.val[2], d.val[2], a, inv_a);
+    r.val[3] = neon_blend_channel(s.val[3], d.val[3], a, inv_a);
+
+    return r;
+}
+
+static void neon_blend_fill32(uint8_t *dst, size_t dst_stride, int w, int h,
+                              uint32_t px)
+{
+    uint32_t a = px >> 24;
+    uint8x8x4_t s;
+    s.val[0] = vdup_n_u8(px & 0xff);
+    s.val[1] = vdup_n_u8((px >> 8) & 0xff);
+    s.val[2] = vdup_n_u8((px >> 16) & 0xff);
+    s.val[3] = vdup_n_u8(a);
+
+    for (int y = 0; y < h; ++y) {
+        uint8_t *row = dst + y * dst_stride;
+        int x = 0;
+
+        for (; x + 8 <= w; x += 8) {
+            uint8x8x4_t d = vld4_u8(row + x * 4);
+            vst4_u8(row + x * 4, neon_blend_pixels(s, d, s.val[3]));
+        }
+        for (; x < w; ++x) {
+            uint32_t *p = reinterpret_cast<uint32_t *>(row) + x;
+            *p = pixel_blend32(px, *p, a);
+        }
+    }
+}
+
+static void neon_blend32(uint8_t *dst, size_t dst_stride,
+                         const uint8_t *src, size_t src_stride, int w, int h)
+{
+    for (int y = 0; y < h; ++y) {
+        uint8_t *d_row = dst + y * dst_stride;
+        const uint8_t *s_row = src + y * src_stride;
+        int x = 0;
+
+        for (; x + 8 <= w; x += 8) {
+            uint8x8x4_t s = vld4_u8(s_row + x * 4);
+            uint8x8x4_t d = vld4_u8(d_row + x * 4);
+            vst4_u8(d_row + x * 4, neon_blend_pixels(s, d, s.val[3]));
+        }
+        for (; x < w; ++x) {
+            const uint32_t *s = reinterpret_cast<const uint32_t *>(s_row) + x;
+            uint32_t *d = reinterpret_cast<uint32_t *>(d_row) + x;
+            *d = pixel_blend32(*s, *d, *s >> 24);
+        }
+    }
+}
+
+const PixelOps pixel_ops_neon = {
+    "neon",
+    neon_fill32,
+    neon_fill16,
+    neon_blend_fill32,
+    neon_blend32,
+};
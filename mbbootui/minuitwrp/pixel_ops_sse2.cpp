@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pixel_ops.h"
+
+#include <emmintrin.h>
+
+static void sse2_fill32(uint8_t *dst, size_t dst_stride, int w, int h,
+                        uint32_t px)
+{
+    __m128i v = _mm_set1_epi32(static_cast<int>(px));
+
+    for (int y = 0; y < h; ++y) {
+        uint32_t *row = reinterpret_cast<uint32_t *>(dst + y * dst_stride);
+        int x = 0;
+
+        for (; x + 4 <= w; x += 4) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(row + x), v);
+        }
+        for (; x < w; ++x) {
+            row[x] = px;
+        }
+    }
+}
+
+static void sse2_fill16(uint8_t *dst, size_t dst_stride, int w, int h,
+                        uint16_t px)
+{
+    __m128i v = _mm_set1_epi16(static_cast<short>(px));
+
+    for (int y = 0; y < h; ++y) {
+        uint16_t *row = reinterpret_cast<uint16_t *>(dst + y * dst_stride);
+        int x = 0;
+
+        for (; x + 8 <= w; x += 8) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(row + x), v);
+        }
+        for (; x < w; ++x) {
+            row[x] = px;
+        }
+    }
+}
+
+// Blend two pixels that have been widened to 16 bits per channel. The alpha
+// of each pixel is broadcast to all four of its channels.
+static inline __m128i sse2_blend_wide(__m128i s, __m128i d, __m128i a)
+{
+    const __m128i v255 = _mm_set1_epi16(255);
+    const __m128i v128 = _mm_set1_epi16(128);
+
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(s, a),
+                              _mm_mullo_epi16(d, _mm_sub_epi16(v255, a)));
+    t = _mm_add_epi16(t, v128);
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static inline __m128i sse2_broadcast_alpha(__m128i wide)
+{
+    wide = _mm_shufflelo_epi16(wide, _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_shufflehi_epi16(wide, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+static inline __m128i sse2_blend_pixels(__m128i s, __m128i d)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+    __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+    __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+    __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+
+    __m128i lo = sse2_blend_wide(s_lo, d_lo, sse2_broadcast_alpha(s_lo));
+    __m128i hi = sse2_blend_wide(s_hi, d_hi, sse2_broadcast_alpha(s_hi));
+
+    return _mm_packus_epi16(lo, hi);
+}
+
+static void sse2_blend_fill32(uint8_t *dst, size_t dst_stride, int w, int h,
+                              uint32_t px)
+{
+    uint32_t a = px >> 24;
+    __m128i s = _mm_set1_epi32(static_cast<int>(px));
+
+    for (int y = 0; y < h; ++y) {
+        uint32_t *row = reinterpret_cast<uint32_t *>(dst + y * dst_stride);
+        int x = 0;
+
+        for (; x + 4 <= w; x += 4) {
+            __m128i *p = reinterpret_cast<__m128i *>(row + x);
+            _mm_storeu_si128(p, sse2_blend_pixels(s, _mm_loadu_si128(p)));
+        }
+        for (; x < w; ++x) {
+            row[x] = pixel_blend32(px, row[x], a);
+        }
+    }
+}
+
+static void sse2_blend32(uint8_t *dst, size_t dst_stride,
+                         const uint8_t *src, size_t src_stride, int w, int h)
+{
+    for (int y = 0; y < h; ++y) {
+        uint32_t *d = reinterpret_cast<uint32_t *>(dst + y * dst_stride);
+        const uint32_t *s =
+                reinterpret_cast<const uint32_t *>(src + y * src_stride);
+        int x = 0;
+
+        for (; x + 4 <= w; x += 4) {
+            __m128i *dp = reinterpret_cast<__m128i *>(d + x);
+            __m128i sv = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(s + x));
+            _mm_storeu_si128(dp, sse2_blend_pixels(sv, _mm_loadu_si128(dp)));
+        }
+        for (; x < w; ++x) {
+            d[x] = pixel_blend32(s[x], d[x], s[x] >> 24);
+        }
+    }
+}
+
+const PixelOps pixel_ops_sse2 = {
+    "sse2",
+    sse2_fill32,
+    sse2_fill16,
+    sse2_blend_fill32,
+    sse2_blend32,
+};
@@ -20,6 +20,8 @@
 #include "appsync.h"
 
 #include <algorithm>
+#include <memory>
+#include <unordered_map>
 
 #include <cassert>
 #include <cstdio>
@@ -28,8 +30,8 @@
 
 #include <fcntl.h>
 #include <getopt.h>
-#include <poll.h>
 #include <signal.h>
+#include <sys/epoll.h>
 #include <sys/mount.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -53,7 +55,6 @@
 #include "mbutil/fts.h"
 #include "mbutil/properties.h"
 #include "mbutil/selinux.h"
-#include "mbutil/socket.h"
 #include "mbutil/string.h"
 #include "mbutil/time.h"
 
@@ -301,78 +302,36 @@ static int create_new_socket()
  */
 
 /*!
- * \brief Receive a message from a socket
+ * \brief Append a message to a connection's output buffer
  */
-static bool receive_message(int fd, char *buf, std::size_t size,
-                            bool is_async, int &async_id)
-{
-    unsigned short count;
-
-    if (is_async) {
-        if (!util::socket_read_int32(fd, async_id)) {
-            LOGE("Failed to receive async command ID: %s", strerror(errno));
-            return false;
-        }
-    }
-
-    if (!util::socket_read_uint16(fd, count)) {
-        LOGE("Failed to read command size: %s", strerror(errno));
-        return false;
-    }
-
-    if (count < 1 || count >= size) {
-        LOGE("Invalid size %u", count);
-        return false;
-    }
-
-    if (util::socket_read(fd, buf, count) != count) {
-        LOGE("Failed to read command: %s", strerror(errno));
-        return false;
-    }
-
-    buf[count] = 0;
-
-    return true;
-}
-
-/*!
- * \brief Send a message to a socket
- */
-static bool send_message(int fd, const char *command,
-                         bool is_async, int async_id)
+static void queue_message(std::vector<char> &out, const char *command,
+                          bool is_async, int async_id)
 {
     auto count = static_cast<uint16_t>(strlen(command));
 
     if (is_async) {
-        if (!util::socket_write_int32(fd, async_id)) {
-            LOGE("Failed to write async command ID: %s", strerror(errno));
-            return false;
-        }
+        auto id = static_cast<int32_t>(async_id);
+        auto ptr = reinterpret_cast<const char *>(&id);
+        out.insert(out.end(), ptr, ptr + sizeof(id));
     }
 
-    if (!util::socket_write_uint16(fd, count)) {
-        LOGE("Failed to write command size: %s", strerror(errno));
-        return false;
-    }
-
-    if (util::socket_write(fd, command, count) != count) {
-        LOGE("Failed to write command: %s", strerror(errno));
-        return false;
-    }
-
-    return true;
+    auto ptr = reinterpret_cast<const char *>(&count);
+    out.insert(out.end(), ptr, ptr + sizeof(count));
+    out.insert(out.end(), command, command + count);
 }
 
 /*!
  * \brief Connect to the installd socket at INSTALLD_SOCKET_PATH
  *
- * Because installd is spawned right before this function is called, this
- * function will make 5 attempts to connect to the socket. If an attempt fails,
- * it will wait 1 second before trying again.
+ * If installd was just spawned, it may not be listening on the socket yet. If
+ * an attempt fails, this function will wait 1 second before trying again, up
+ * to \a attempts attempts in total.
+ *
+ * The returned socket is non-blocking.
  *
  * \return fd if the connection succeeds. Otherwise, -1
  */
-static int connect_to_installd()
+static int connect_to_installd(int attempts)
 {
     struct sockaddr_un addr;
 
@@ -381,32 +340,30 @@ static int connect_to_installd()
     snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
              INSTALLD_SOCKET_PATH);
 
-    int fd = socket(AF_LOCAL, SOCK_STREAM, 0);
-    if (fd < 0) {
-        LOGE("Failed to create socket: %s", strerror(errno));
-        return -1;
-    }
-
-    int attempt;
-    for (attempt = 0; attempt < 5; ++attempt) {
-        LOGV("Connecting to installd [Attempt %d/%d]", attempt + 1, 5);
-        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
-            LOGW("Failed: %s", strerror(errno));
+    for (int attempt = 1; attempt <= attempts; ++attempt) {
+        if (attempt > 1) {
             sleep(1);
-        } else {
-            break;
         }
-    }
 
-    if (attempt == 5) {
-        LOGD("Failed to connect to installd after 5 attempts");
+        int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                        0);
+        if (fd < 0) {
+            LOGE("Failed to create socket: %s", strerror(errno));
+            return -1;
+        }
+
+        LOGV("Connecting to installd [Attempt %d/%d]", attempt, attempts);
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+            LOGD("Connected to installd");
+            return fd;
+        }
+
+        LOGW("Failed: %s", strerror(errno));
         close(fd);
-        return -1;
     }
 
-    LOGD("Connected to installd");
-
-    return fd;
+    LOGD("Failed to connect to installd after %d attempts", attempts);
+    return -1;
 }
 
 /*!
@@ -503,281 +460,571 @@ static bool do_remove(const std::vector<std::string> &args)
 #undef TAG
 }
 
+enum class CommandType
+{
+    // Proxied without any logging
+    Silent,
+    // Logged by name only
+    Unimportant,
+    // CyanogenMod-specific commands
+    CyanogenMod,
+    // TouchWiz-specific commands
+    TouchWiz,
+    // Logged in full and hooked if appsync is enabled
+    Hookable,
+};
+
 struct CommandInfo {
-    const char *name;
+    CommandType type;
     unsigned int nargs;
     bool (*func)(const std::vector<std::string> &args);
 };
 
-static struct CommandInfo cmds[] = {
-    { "remove",  2, do_remove }
+static const std::unordered_map<std::string, CommandInfo> cmds = {
+    { "ping",             { CommandType::Unimportant, 0, nullptr   } },
+    { "freecache",        { CommandType::Unimportant, 0, nullptr   } },
+    { "aapt",             { CommandType::CyanogenMod, 0, nullptr   } },
+    { "aapt_with_common", { CommandType::CyanogenMod, 0, nullptr   } },
+    { "rmrcl",            { CommandType::TouchWiz,    0, nullptr   } },
+    { "asyncDexopt",      { CommandType::TouchWiz,    0, nullptr   } },
+    { "changeDexOwner",   { CommandType::TouchWiz,    0, nullptr   } },
+    // Get size is so annoying we don't want it to show... EVER!
+    { "getsize",          { CommandType::Silent,      0, nullptr   } },
+    { "install",          { CommandType::Hookable,    0, nullptr   } },
+    { "dexopt",           { CommandType::Hookable,    0, nullptr   } },
+    { "markbootcomplete", { CommandType::Hookable,    0, nullptr   } },
+    { "movedex",          { CommandType::Hookable,    0, nullptr   } },
+    { "rmdex",            { CommandType::Hookable,    0, nullptr   } },
+    { "remove",           { CommandType::Hookable,    2, do_remove } },
+    { "rename",           { CommandType::Hookable,    0, nullptr   } },
+    { "fixuid",           { CommandType::Hookable,    0, nullptr   } },
+    { "rmcache",          { CommandType::Hookable,    0, nullptr   } },
+    { "rmcodecache",      { CommandType::Hookable,    0, nullptr   } },
+    { "rmuserdata",       { CommandType::Hookable,    0, nullptr   } },
+    { "movefiles",        { CommandType::Hookable,    0, nullptr   } },
+    { "linklib",          { CommandType::Hookable,    0, nullptr   } },
+    { "mkuserdata",       { CommandType::Hookable,    0, nullptr   } },
+    { "mkuserconfig",     { CommandType::Hookable,    0, nullptr   } },
+    { "rmuser",           { CommandType::Hookable,    0, nullptr   } },
+    { "idmap",            { CommandType::Hookable,    0, nullptr   } },
+    { "restorecondata",   { CommandType::Hookable,    0, nullptr   } },
+    { "patchoat",         { CommandType::Hookable,    0, nullptr   } },
 };
 
-static void handle_command(const std::vector<std::string> &args)
-{
-    for (std::size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); ++i) {
-        if (args[0] == cmds[i].name) {
-            if (args.size() - 1 != cmds[i].nargs) {
-                LOGE("%s requires %u arguments (%zu given)",
-                     cmds[i].name, cmds[i].nargs, args.size() - 1);
-                LOGE("%s command won't be hooked", cmds[i].name);
-            } else {
-                LOGD("Hooking %s command", cmds[i].name);
-                cmds[i].func(std::vector<std::string>(
-                        args.begin() + 1, args.end()));
-            }
-        }
+static void handle_command(const CommandInfo &info,
+                           const std::vector<std::string> &args)
+{
+    if (!info.func) {
+        return;
+    }
+
+    if (args.size() - 1 != info.nargs) {
+        LOGE("%s requires %u arguments (%zu given)",
+             args[0].c_str(), info.nargs, args.size() - 1);
+        LOGE("%s command won't be hooked", args[0].c_str());
+    } else {
+        LOGD("Hooking %s command", args[0].c_str());
+        info.func(std::vector<std::string>(args.begin() + 1, args.end()));
     }
 }
 
-static bool handle_installd_event(int client_fd, int installd_fd,
-                                  bool is_async)
+/*!
+ * \brief Check if installd uses the CyanogenMod async protocol
+ *
+ * Scanning the installd binary is expensive, so the result is cached and only
+ * recomputed if the binary's inode, size, or mtime changes.
+ *
+ * See: https://github.com/CyanogenMod/android_frameworks_native/commit/8124b181d4b5a3a44796fdb0e3ea4e4171f102c7
+ */
+static bool is_installd_async()
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+    static struct {
+        bool valid;
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        time_t mtime;
+        bool is_async;
+    } cache;
+
+    struct stat sb;
+    bool have_stat = stat(INSTALLD_PATH, &sb) == 0;
+
+    if (have_stat && cache.valid
+            && cache.dev == sb.st_dev
+            && cache.ino == sb.st_ino
+            && cache.size == sb.st_size
+            && cache.mtime == sb.st_mtime) {
+        return cache.is_async;
+    }
 
-    uint64_t time_start, time_stop;
-    uint64_t time_start_installd, time_stop_installd;
-    uint64_t time_start_send, time_stop_send;
+    bool is_async = util::file_find_one_of(
+            INSTALLD_PATH, { "failed to read transaction id" });
+    LOGD("installd is CyanogenMod async version: %d", is_async);
+
+    cache.valid = have_stat;
+    if (have_stat) {
+        cache.dev = sb.st_dev;
+        cache.ino = sb.st_ino;
+        cache.size = sb.st_size;
+        cache.mtime = sb.st_mtime;
+        cache.is_async = is_async;
+    }
 
-    int async_id;
+    return is_async;
+}
 
-    time_start = util::current_time_ms();
+struct PendingRequest
+{
+    uint64_t time_start;
+    uint64_t time_hook;
+    bool log_result;
+};
 
-    time_start_installd = util::current_time_ms();
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive reply from installd");
-        return false;
+/*!
+ * \brief A client connection and its dedicated installd connection
+ */
+struct ProxySession
+{
+    int client_fd;
+    int installd_fd;
+    bool is_async;
+    std::vector<char> client_buf;
+    std::vector<char> installd_buf;
+    // Data waiting for the connection to become writable
+    std::vector<char> client_out;
+    std::vector<char> installd_out;
+    // Whether EPOLLOUT is currently requested for the connection
+    bool client_polling_out;
+    bool installd_polling_out;
+    // Requests awaiting a reply, keyed by async ID (always 0 if the
+    // connection is synchronous)
+    std::unordered_map<int, PendingRequest> pending;
+};
+
+/*!
+ * \brief Append all data that can be read without blocking to a buffer
+ *
+ * \return False if the peer closed the connection or an error occurred
+ */
+static bool read_available(int fd, std::vector<char> &buf)
+{
+    char tmp[COMMAND_BUF_SIZE];
+
+    while (true) {
+        ssize_t n = recv(fd, tmp, sizeof(tmp), MSG_DONTWAIT);
+        if (n > 0) {
+            buf.insert(buf.end(), tmp, tmp + n);
+        } else if (n == 0) {
+            return false;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        } else if (errno != EINTR) {
+            LOGE("Failed to read from socket: %s", strerror(errno));
+            return false;
+        }
     }
-    time_stop_installd = util::current_time_ms();
+}
 
-    std::vector<std::string> args = parse_args(buf);
-    LOGD("Received async (probably) reply: %s", args_to_string(args).c_str());
+/*!
+ * \brief Write as much of a buffer as possible without blocking
+ *
+ * The data that was written is removed from the buffer.
+ *
+ * \return False if an error occurred
+ */
+static bool write_available(int fd, std::vector<char> &buf)
+{
+    std::size_t offset = 0;
+    bool ret = true;
+
+    while (offset < buf.size()) {
+        ssize_t n = send(fd, buf.data() + offset, buf.size() - offset,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n >= 0) {
+            offset += static_cast<std::size_t>(n);
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            LOGE("Failed to write to socket: %s", strerror(errno));
+            ret = false;
+            break;
+        }
+    }
 
-    time_start_send = util::current_time_ms();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send reply to client");
-        return false;
+    buf.erase(buf.begin(), buf.begin() + static_cast<std::ptrdiff_t>(offset));
+    return ret;
+}
+
+/*!
+ * \brief Remove the next complete message from a receive buffer
+ *
+ * \return 1 if a message was extracted, 0 if more data is needed, or -1 if the
+ *         buffer does not contain a valid message
+ */
+static int extract_message(std::vector<char> &in, char *buf, std::size_t size,
+                           bool is_async, int &async_id)
+{
+    std::size_t offset = 0;
+    int32_t id = 0;
+    uint16_t count;
+
+    if (in.size() < (is_async ? sizeof(id) : 0) + sizeof(count)) {
+        return 0;
     }
-    time_stop_send = util::current_time_ms();
 
-    time_stop = util::current_time_ms();
+    if (is_async) {
+        memcpy(&id, in.data(), sizeof(id));
+        offset += sizeof(id);
+    }
+    memcpy(&count, in.data() + offset, sizeof(count));
+    offset += sizeof(count);
 
-    LOGD("Command stats:");
-    LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-         time_stop_send - time_start_send);
-    LOGD("- Time to receive reply from installd: %" PRIu64 "ms",
-         time_stop_installd - time_start_installd);
-    LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
-         time_stop - time_start);
-    LOGD("---");
+    if (count < 1 || count >= size) {
+        LOGE("Invalid size %u", count);
+        return -1;
+    }
 
-    return true;
+    if (in.size() < offset + count) {
+        return 0;
+    }
+
+    memcpy(buf, in.data() + offset, count);
+    buf[count] = 0;
+    in.erase(in.begin(),
+             in.begin() + static_cast<std::ptrdiff_t>(offset + count));
+
+    async_id = id;
+    return 1;
 }
 
-static bool handle_android_event(int client_fd, int installd_fd,
-                                 bool can_appsync, bool is_async)
+static void handle_installd_message(ProxySession &session, const char *buf,
+                                    int async_id)
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+    std::vector<std::string> args = parse_args(buf);
 
-    uint64_t time_start, time_stop;
-    uint64_t time_start_installd, time_stop_installd;
-    uint64_t time_start_hook = 0, time_stop_hook = 0;
-    uint64_t time_start_send, time_stop_send;
+    auto it = session.pending.find(async_id);
+    if (it == session.pending.end()) {
+        LOGD("Received async (probably) reply: %s",
+             args_to_string(args).c_str());
+    } else if (it->second.log_result) {
+        LOGD("Sending reply: %s", args_to_string(args).c_str());
+    }
 
-    int async_id;
+    queue_message(session.client_out, buf, session.is_async, async_id);
+    uint64_t time_stop = util::current_time_ms();
 
-    if (!receive_message(client_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive request from client");
-        return false;
+    if (it != session.pending.end()) {
+        if (it->second.log_result) {
+            LOGD("Command stats:");
+            LOGD("- Time to hook installd command:       %" PRIu64 "ms",
+                 it->second.time_hook);
+            LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
+                 time_stop - it->second.time_start);
+            LOGD("---");
+        }
+        session.pending.erase(it);
     }
+}
 
-    time_start = util::current_time_ms();
+static void handle_android_message(ProxySession &session, char *buf,
+                                   int async_id, bool can_appsync)
+{
+    PendingRequest request = { util::current_time_ms(), 0, true };
 
     std::vector<std::string> args = parse_args(buf);
 
-    bool log_result = true;
-
     if (args.empty()) {
         LOGE("Invalid command (empty message)");
     } else {
-        const std::string &cmd = args[0];
-
-        if (cmd == "ping"
-                || cmd == "freecache") {
-            LOGD("Received unimportant command: [%s, ...]", cmd.c_str());
-        } else if (cmd == "aapt"
-                || cmd == "aapt_with_common") {
-            LOGD("Received CyanogenMod-specific command: %s",
-                 args_to_string(args).c_str());
-        } else if (cmd == "rmrcl"
-                || cmd == "asyncDexopt"
-                || cmd == "changeDexOwner") {
-            LOGD("Received Touchwiz-specific command: %s",
-                 args_to_string(args).c_str());
-            if (cmd == "asyncDexopt") {
-                LOGD("Expecting future installd reply for 'asyncDexopt'");
-            }
-        } else if (cmd == "getsize") {
-            // Get size is so annoying we don't want it to show... EVER!
-            log_result = false;
-        } else if (cmd == "install"
-                || cmd == "dexopt"
-                || cmd == "markbootcomplete"
-                || cmd == "movedex"
-                || cmd == "rmdex"
-                || cmd == "remove"
-                || cmd == "rename"
-                || cmd == "fixuid"
-                || cmd == "rmcache"
-                || cmd == "rmcodecache"
-                || cmd == "rmuserdata"
-                || cmd == "movefiles"
-                || cmd == "linklib"
-                || cmd == "mkuserdata"
-                || cmd == "mkuserconfig"
-                || cmd == "rmuser"
-                || cmd == "idmap"
-                || cmd == "restorecondata"
-                || cmd == "patchoat") {
-            LOGD("Received command: %s", args_to_string(args).c_str());
-
-            if (can_appsync) {
-                time_start_hook = util::current_time_ms();
-                handle_command(args);
-                time_stop_hook = util::current_time_ms();
-            }
-        } else {
+        auto it = cmds.find(args[0]);
+        if (it == cmds.end()) {
             LOGW("Unrecognized command: %s", args_to_string(args).c_str());
+        } else {
+            switch (it->second.type) {
+            case CommandType::Silent:
+                request.log_result = false;
+                break;
+            case CommandType::Unimportant:
+                LOGD("Received unimportant command: [%s, ...]",
+                     args[0].c_str());
+                break;
+            case CommandType::CyanogenMod:
+                LOGD("Received CyanogenMod-specific command: %s",
+                     args_to_string(args).c_str());
+                break;
+            case CommandType::TouchWiz:
+                LOGD("Received Touchwiz-specific command: %s",
+                     args_to_string(args).c_str());
+                if (args[0] == "asyncDexopt") {
+                    LOGD("Expecting future installd reply for 'asyncDexopt'");
+                }
+                break;
+            case CommandType::Hookable:
+                LOGD("Received command: %s", args_to_string(args).c_str());
+
+                if (can_appsync) {
+                    uint64_t time_start_hook = util::current_time_ms();
+                    handle_command(it->second, args);
+                    request.time_hook =
+                            util::current_time_ms() - time_start_hook;
+                }
+                break;
+            }
         }
     }
 
-    time_start_installd = util::current_time_ms();
-    if (!send_message(installd_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send request to installd");
+    queue_message(session.installd_out, buf, session.is_async, async_id);
+
+    session.pending[async_id] = request;
+}
+
+static bool handle_client_readable(ProxySession &session, bool can_appsync)
+{
+    // Use the same buffer size as installd
+    char buf[COMMAND_BUF_SIZE];
+    int async_id;
+    int ret;
+
+    bool open = read_available(session.client_fd, session.client_buf);
+
+    while ((ret = extract_message(session.client_buf, buf, sizeof(buf),
+                                  session.is_async, async_id)) > 0) {
+        handle_android_message(session, buf, async_id, can_appsync);
+    }
+
+    if (ret < 0) {
+        LOGE("Failed to receive request from client");
         return false;
     }
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, async_id)) {
+
+    return open;
+}
+
+static bool handle_installd_readable(ProxySession &session)
+{
+    // Use the same buffer size as installd
+    char buf[COMMAND_BUF_SIZE];
+    int async_id;
+    int ret;
+
+    bool open = read_available(session.installd_fd, session.installd_buf);
+
+    while ((ret = extract_message(session.installd_buf, buf, sizeof(buf),
+                                  session.is_async, async_id)) > 0) {
+        handle_installd_message(session, buf, async_id);
+    }
+
+    if (ret < 0) {
         LOGE("Failed to receive reply from installd");
         return false;
     }
-    time_stop_installd = util::current_time_ms();
 
-    args = parse_args(buf);
+    return open;
+}
 
-    if (log_result) {
-        LOGD("Sending reply: %s", args_to_string(args).c_str());
-    }
+static bool epoll_add(int epfd, int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
 
-    time_start_send = util::current_time_ms();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send reply to client");
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOGE("Failed to add fd %d to epoll: %s", fd, strerror(errno));
         return false;
     }
-    time_stop_send = util::current_time_ms();
 
-    time_stop = util::current_time_ms();
+    return true;
+}
 
-    if (log_result) {
-        LOGD("Command stats:");
-        LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-             time_stop_send - time_start_send);
-        LOGD("- Time to complete installd command:   %" PRIu64 "ms",
-             time_stop_installd - time_start_installd);
-        if (can_appsync) {
-            LOGD("- Time to hook installd command:       %" PRIu64 "ms",
-                 time_stop_hook - time_start_hook);
-        }
-        LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
-             time_stop - time_start);
-        LOGD("---");
+static bool epoll_set_polling_out(int epfd, int fd, bool &polling_out,
+                                  bool want_out)
+{
+    if (polling_out == want_out) {
+        return true;
     }
 
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0u);
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        LOGE("Failed to modify fd %d in epoll: %s", fd, strerror(errno));
+        return false;
+    }
+
+    polling_out = want_out;
     return true;
 }
 
+/*!
+ * \brief Write pending data for both connections of a session
+ *
+ * Connections that cannot accept all of their data are polled for EPOLLOUT
+ * so that writing resumes when they become writable.
+ *
+ * \return False if an error occurred
+ */
+static bool flush_session(int epfd, ProxySession &session)
+{
+    return write_available(session.client_fd, session.client_out)
+            && write_available(session.installd_fd, session.installd_out)
+            && epoll_set_polling_out(epfd, session.client_fd,
+                                     session.client_polling_out,
+                                     !session.client_out.empty())
+            && epoll_set_polling_out(epfd, session.installd_fd,
+                                     session.installd_polling_out,
+                                     !session.installd_out.empty());
+}
+
+using SessionMap = std::unordered_map<int, std::shared_ptr<ProxySession>>;
+
+static void close_session(int epfd, SessionMap &sessions,
+                          const std::shared_ptr<ProxySession> &session)
+{
+    LOGD("Closing client connection");
+    epoll_ctl(epfd, EPOLL_CTL_DEL, session->client_fd, nullptr);
+    sessions.erase(session->client_fd);
+    close(session->client_fd);
+
+    LOGD("Closing installd connection");
+    epoll_ctl(epfd, EPOLL_CTL_DEL, session->installd_fd, nullptr);
+    sessions.erase(session->installd_fd);
+    close(session->installd_fd);
+}
+
 /**
  * \brief Main function for capturing and relaying the daemon commands
  *
- * This function will not return under normal conditions. It runs through the
- * following loop infinitely:
+ * This function will not return under normal conditions. All clients are
+ * served from a single epoll loop:
  *
- * 1. Accept a connection on the original installd socket
- * 2. Run installd
- * 3. Connect to the installd
- * 4. Capture and proxy commands
+ * 1. When a client connects to the original installd socket, open a dedicated
+ *    connection to installd for it
+ * 2. When a complete request arrives from a client, run the appsync hooks and
+ *    forward it to installd
+ * 3. When a complete reply arrives from installd, forward it to the client
  *
- * If installd crashes or connection between mbtool and installd breaks in some
- * way, it will simply loop again. If this function fails to accept a connection
- * on the original socket, then it will return false.
+ * Messages are written without blocking. Data that cannot be written
+ * immediately is buffered until the connection becomes writable.
+ *
+ * If a client or its installd connection breaks in some way, only that pair of
+ * connections is closed. If connecting to installd fails, only the new client
+ * is disconnected. If this function fails to accept a connection on the
+ * original socket, then it will return false.
  *
  * \return False if accepting the socket connection fails. Otherwise, does not
  *         return
  */
 static bool proxy_process(int fd, bool can_appsync)
 {
-    while (true) {
-        int client_fd = accept(fd, nullptr, nullptr);
-        if (client_fd < 0) {
-            LOGE("Failed to accept client connection: %s", strerror(errno));
-            return false;
-        }
-
-        auto close_client_fd = finally([&]{
-            LOGD("Closing client connection");
-            close(client_fd);
-        });
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        LOGE("Failed to create epoll fd: %s", strerror(errno));
+        return false;
+    }
 
-        LOGD("Accepted new client connection");
+    // Client and installd fds both map to their session
+    SessionMap sessions;
 
-        // Connect to installd
-        int installd_fd = connect_to_installd();
-        if (installd_fd < 0) {
-            return false;
+    auto close_fds = finally([&]{
+        while (!sessions.empty()) {
+            close_session(epfd, sessions, sessions.begin()->second);
         }
+        close(epfd);
+    });
 
-        auto close_installd_fd = finally([&]{
-            LOGD("Closing installd connection");
-            close(installd_fd);
-        });
+    if (!epoll_add(epfd, fd)) {
+        return false;
+    }
 
-        // Check if we're using some variant of the CyanogenMood async installd
-        // NOTE: We'll effectively make the connection sychronous because we
-        //       always wait for a reply before receiving the next command.
-        // See: https://github.com/CyanogenMod/android_frameworks_native/commit/8124b181d4b5a3a44796fdb0e3ea4e4171f102c7
-        bool is_async = util::file_find_one_of(
-                INSTALLD_PATH, { "failed to read transaction id" });
-        LOGD("installd is CyanogenMod async version: %d", is_async);
+    struct epoll_event events[16];
 
-        LOGD("---");
+    while (true) {
+        int n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]),
+                           -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to wait for events: %s", strerror(errno));
+            return false;
+        }
 
-        struct pollfd fds[2];
-        memset(fds, 0, sizeof(fds));
+        for (int i = 0; i < n; ++i) {
+            int event_fd = events[i].data.fd;
+
+            if (event_fd == fd) {
+                int client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client_fd < 0) {
+                    if (errno == EINTR || errno == EAGAIN
+                            || errno == ECONNABORTED) {
+                        continue;
+                    }
+                    LOGE("Failed to accept client connection: %s",
+                         strerror(errno));
+                    return false;
+                }
+
+                LOGD("Accepted new client connection");
+
+                // Connect to installd. installd was already listening when the
+                // loop started, so don't retry and stall the other sessions.
+                int installd_fd = connect_to_installd(1);
+                if (installd_fd < 0) {
+                    LOGE("Closing client connection");
+                    close(client_fd);
+                    continue;
+                }
+
+                // NOTE: Requests and replies are relayed as complete messages,
+                //       so the async protocol is passed through unchanged.
+                auto session = std::make_shared<ProxySession>();
+                session->client_fd = client_fd;
+                session->installd_fd = installd_fd;
+                session->is_async = is_installd_async();
+                session->client_polling_out = false;
+                session->installd_polling_out = false;
+
+                sessions[client_fd] = session;
+                sessions[installd_fd] = session;
+
+                if (!epoll_add(epfd, client_fd)
+                        || !epoll_add(epfd, installd_fd)) {
+                    close_session(epfd, sessions, session);
+                }
+
+                LOGD("---");
+                continue;
+            }
 
-        fds[0].fd = client_fd;
-        fds[0].events = POLLIN;
-        fds[1].fd = installd_fd;
-        fds[1].events = POLLIN;
+            // The session may have been closed by an earlier event
+            auto it = sessions.find(event_fd);
+            if (it == sessions.end()) {
+                continue;
+            }
 
-        while (true) {
-            fds[0].revents = 0;
-            fds[1].revents = 1;
+            std::shared_ptr<ProxySession> session = it->second;
+            bool ok = true;
 
-            if (poll(fds, 2, -1) < 0) {
-                LOGE("Failed to poll() fds: %s", strerror(errno));
-                break;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                if (event_fd == session->client_fd) {
+                    ok = handle_client_readable(*session, can_appsync);
+                } else {
+                    ok = handle_installd_readable(*session);
+                }
             }
 
-            if (fds[0].revents & POLLIN && !handle_android_event(
-                    client_fd, installd_fd, can_appsync, is_async)) {
-                break;
+            // Relay the messages queued above or continue writing data that
+            // did not fit previously
+            if (ok) {
+                ok = flush_session(epfd, *session);
             }
-            if (fds[1].revents & POLLIN && !handle_installd_event(
-                    client_fd, installd_fd, is_async)) {
-                break;
+
+            if (!ok) {
+                close_session(epfd, sessions, session);
             }
         }
     }
@@ -842,6 +1089,14 @@ static bool hijack_socket(bool can_appsync)
         } while (!WIFEXITED(status) && !WIFSIGNALED(status));
     });
 
+    // Wait for installd to start listening before accepting clients so that
+    // connecting to it never stalls the proxy loop
+    int probe_fd = connect_to_installd(5);
+    if (probe_fd < 0) {
+        return false;
+    }
+    close(probe_fd);
+
     LOGD("Ready! Waiting for connections");
 
     // Start processing commands!
@@ -363,8 +363,12 @@ static Result restore_boot_image(const std::shared_ptr<Rom> &rom,
     std::vector<std::function<RamdiskPatcherFn>> rps;
     rps.push_back(rp_write_rom_id(rom->id));
 
-    if (!InstallerUtil::patch_boot_image(
-            boot_image_backup, boot_image_path, rps)) {
+    std::string patch_id("rom=");
+    patch_id += rom->id;
+    patch_id += '\n';
+
+    if (!InstallerUtil::patch_boot_image_cached(
+            boot_image_backup, boot_image_path, rps, patch_id, nullptr)) {
         LOGE("Failed to patch boot image");
         return Result::Failed;
     }
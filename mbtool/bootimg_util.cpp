@@ -169,4 +169,31 @@ bool bi_copy_data_to_data(Reader &reader, Writer &writer)
     return true;
 }
 
+/*!
+ * \brief Copy entry data while replacing byte patterns
+ *
+ * \sa copy_data_patched()
+ */
+bool bi_copy_data_to_data_patched(Reader &reader, Writer &writer,
+                                  std::vector<BytePatch> &patches)
+{
+    return copy_data_patched([&](void *buf, size_t size, size_t &bytes_read) {
+        if (!reader.read_data(buf, size, bytes_read)) {
+            LOGE("Failed to read boot image entry data: %s",
+                 reader.error_string().c_str());
+            return false;
+        }
+        return true;
+    }, [&](const void *buf, size_t size) {
+        size_t bytes_written;
+        if (!writer.write_data(buf, size, bytes_written)
+                || bytes_written != size) {
+            LOGE("Failed to write entry data: %s",
+                 writer.error_string().c_str());
+            return false;
+        }
+        return true;
+    }, patches);
+}
+
 }
@@ -20,10 +20,15 @@
 #pragma once
 
 #include <string>
+#include <vector>
+
+#include <cstdint>
 
 #include "mbbootimg/reader.h"
 #include "mbbootimg/writer.h"
 
+#include "byte_patch.h"
+
 namespace mb
 {
 
@@ -32,4 +37,8 @@ bool bi_copy_file_to_data(const std::string &path, bootimg::Writer &writer);
 bool bi_copy_data_to_file(bootimg::Reader &reader, const std::string &path);
 bool bi_copy_data_to_data(bootimg::Reader &reader, bootimg::Writer &writer);
 
+bool bi_copy_data_to_data_patched(bootimg::Reader &reader,
+                                  bootimg::Writer &writer,
+                                  std::vector<BytePatch> &patches);
+
 }
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "byte_patch.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#include "mbcommon/libc/string.h"
+
+#define BUF_SIZE    10240
+
+namespace mb
+{
+
+/*!
+ * \brief Copy data while replacing byte patterns
+ *
+ * The patterns are searched for and replaced while the data streams through a
+ * single buffer. The last `max(size) - 1` bytes of each chunk are carried over
+ * to the next one so that occurrences straddling chunk boundaries are found.
+ *
+ * \return Whether the data was copied. Returns false if \p read_fn or
+ *         \p write_fn fails.
+ */
+bool copy_data_patched(const BytePatchReadFn &read_fn,
+                       const BytePatchWriteFn &write_fn,
+                       std::vector<BytePatch> &patches)
+{
+    // Input offset where the next search for each pattern may start
+    std::vector<uint64_t> next(patches.size(), 0);
+    size_t max_size = 1;
+    for (auto &patch : patches) {
+        max_size = std::max(max_size, patch.size);
+        patch.offsets.clear();
+    }
+
+    const size_t carry_max = max_size - 1;
+    std::vector<unsigned char> buf(carry_max + BUF_SIZE);
+    // Number of bytes at the beginning of buf carried over from the last chunk
+    size_t carry = 0;
+    // Input offset of buf[0]
+    uint64_t base = 0;
+    size_t n_read;
+
+    while (true) {
+        if (!read_fn(buf.data() + carry, BUF_SIZE, n_read)) {
+            return false;
+        }
+
+        const bool eof = n_read == 0;
+        const size_t avail = carry + n_read;
+
+        for (size_t i = 0; i < patches.size(); ++i) {
+            auto &patch = patches[i];
+
+            if (patch.size == 0 || patch.size > avail) {
+                continue;
+            }
+
+            // Occurrences starting before this point were fully contained in
+            // the previous chunk and have already been checked
+            size_t pos = carry >= patch.size ? carry - patch.size + 1 : 0;
+            if (next[i] > base) {
+                pos = std::max(pos, static_cast<size_t>(next[i] - base));
+            }
+
+            while (pos < avail && (patch.max_matches == 0
+                    || patch.offsets.size() < patch.max_matches)) {
+                auto match = static_cast<unsigned char *>(mb_memmem(
+                        buf.data() + pos, avail - pos,
+                        patch.source, patch.size));
+                if (!match) {
+                    break;
+                }
+
+                pos = static_cast<size_t>(match - buf.data());
+                patch.offsets.push_back(base + pos);
+                memcpy(match, patch.target, patch.size);
+                pos += patch.size;
+                next[i] = base + pos;
+            }
+        }
+
+        // Hold back the tail unless this is the end of the data
+        const size_t to_write = eof ? avail : avail - std::min(avail, carry_max);
+
+        if (to_write > 0 && !write_fn(buf.data(), to_write)) {
+            return false;
+        }
+
+        if (eof) {
+            break;
+        }
+
+        carry = avail - to_write;
+        memmove(buf.data(), buf.data() + to_write, carry);
+        base += to_write;
+    }
+
+    return true;
+}
+
+}
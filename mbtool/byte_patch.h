@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mb
+{
+
+struct BytePatch
+{
+    // Pattern to search for and its same-sized replacement
+    const unsigned char *source;
+    const unsigned char *target;
+    size_t size;
+    // Maximum number of occurrences to replace (0 for unlimited)
+    size_t max_matches;
+    // Offsets of the replaced occurrences
+    std::vector<uint64_t> offsets;
+};
+
+// Reads up to size bytes. Reading 0 bytes indicates the end of the data.
+using BytePatchReadFn =
+        std::function<bool(void *buf, size_t size, size_t &bytes_read)>;
+// Writes exactly size bytes
+using BytePatchWriteFn = std::function<bool(const void *buf, size_t size)>;
+
+bool copy_data_patched(const BytePatchReadFn &read_fn,
+                       const BytePatchWriteFn &write_fn,
+                       std::vector<BytePatch> &patches);
+
+}
@@ -19,16 +19,23 @@
 
 #include "daemon_v3.h"
 
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 #include <unordered_set>
 
 #include <fcntl.h>
+#include <sys/file.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
 #include "mblog/logging.h"
@@ -46,6 +53,7 @@
 #include "init.h"
 #include "packages.h"
 #include "reboot.h"
+#include "request_workers.h"
 #include "roms.h"
 #include "signature.h"
 #include "switcher.h"
@@ -72,29 +80,80 @@ namespace mb
 namespace v3 = mbtool::daemon::v3;
 namespace fb = flatbuffers;
 
+// Number of threads used for processing requests with a non-zero ID
+#define V3_WORKER_THREADS       4
+// Maximum number of requests waiting for a worker thread
+#define V3_MAX_QUEUED_REQUESTS  16
+// Every connection is handled in a new process, so package counts, which are
+// expensive to compute, are cached on disk to be reusable across connections
+#define V3_CACHE_PATH           "/data/multiboot/daemon_cache.prop"
+
 static std::unordered_map<int, int> fd_map;
 static int fd_count = 0;
+static std::mutex fd_map_lock;
+
+// Responses may be sent from multiple threads
+static std::mutex write_lock;
+
+// Exclusive requests hold this exclusively and all other requests hold it
+// shared. Exclusive requests may change process-wide state, such as the umask
+// in util::copy_file(), or fork, which other requests must not observe.
+static std::shared_timed_mutex exclusive_lock;
+
+/*!
+ * \brief Get a duplicate of the fd for a file ID
+ *
+ * Requests for the same file may run concurrently on worker threads, so a
+ * handler must not use the fd in #fd_map directly. A concurrent FileClose
+ * request could close it and a subsequent open() could reuse the number. The
+ * duplicate shares the file offset with the original, but remains valid until
+ * the caller closes it.
+ *
+ * \return Duplicated fd or -1 if the ID is invalid
+ */
+static int v3_dup_fd(int id)
+{
+    std::lock_guard<std::mutex> lock(fd_map_lock);
+
+    auto it = fd_map.find(id);
+    if (it == fd_map.end()) {
+        return -1;
+    }
+
+    return fcntl(it->second, F_DUPFD_CLOEXEC, 0);
+}
 
 static bool v3_send_response(int fd, const fb::FlatBufferBuilder &builder)
 {
+    std::lock_guard<std::mutex> lock(write_lock);
+
     return util::socket_write_bytes(
             fd, builder.GetBufferPointer(), builder.GetSize());
 }
 
-static bool v3_send_response_invalid(int fd)
+static fb::Offset<v3::Response> v3_create_response(
+        fb::FlatBufferBuilder &builder, const v3::Request *msg,
+        v3::ResponseType type, fb::Offset<void> response)
+{
+    // Tag the response with the request's ID so the client can match them up
+    return v3::CreateResponse(builder, type, response, msg->id());
+}
+
+static bool v3_send_response_invalid(int fd, const v3::Request *msg)
 {
     fb::FlatBufferBuilder builder;
-    auto response = v3::CreateResponse(builder, v3::ResponseType_Invalid,
+    auto response = v3_create_response(builder, msg, v3::ResponseType_Invalid,
                                        v3::CreateInvalid(builder).Union());
     builder.Finish(response);
     return v3_send_response(fd, builder);
 }
 
-static bool v3_send_response_unsupported(int fd)
+static bool v3_send_response_unsupported(int fd, const v3::Request *msg)
 {
     fb::FlatBufferBuilder builder;
-    auto response = v3::CreateResponse(builder, v3::ResponseType_Unsupported,
-                                       v3::CreateUnsupported(builder).Union());
+    auto response = v3_create_response(
+            builder, msg, v3::ResponseType_Unsupported,
+            v3::CreateUnsupported(builder).Union());
     builder.Finish(response);
     return v3_send_response(fd, builder);
 }
@@ -102,17 +161,21 @@ static bool v3_send_response_unsupported(int fd)
 static bool v3_file_chmod(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileChmodRequest *>(msg->request());
-    if (fd_map.find(request->id()) == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    int ffd = v3_dup_fd(request->id());
+    auto close_ffd = finally([&] {
+        if (ffd >= 0) {
+            close(ffd);
+        }
+    });
+    if (ffd < 0) {
+        return v3_send_response_invalid(fd, msg);
     }
 
-    int ffd = fd_map[request->id()];
-
     // Don't allow setting setuid or setgid permissions
     mode_t mode = static_cast<mode_t>(request->mode());
     mode_t masked = mode & (S_IRWXU | S_IRWXG | S_IRWXO);
     if (masked != mode) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     fb::FlatBufferBuilder builder;
@@ -130,8 +193,9 @@ static bool v3_file_chmod(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_FileChmodResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_FileChmodResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -139,14 +203,22 @@ static bool v3_file_chmod(int fd, const v3::Request *msg)
 static bool v3_file_close(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileCloseRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    int ffd = -1;
+
+    {
+        std::lock_guard<std::mutex> lock(fd_map_lock);
+
+        auto it = fd_map.find(request->id());
+        if (it != fd_map.end()) {
+            // Remove ID from map
+            ffd = it->second;
+            fd_map.erase(it);
+        }
     }
 
-    // Remove ID from map
-    int ffd = it->second;
-    fd_map.erase(it);
+    if (ffd < 0) {
+        return v3_send_response_invalid(fd, msg);
+    }
 
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileCloseError> error;
@@ -163,8 +235,9 @@ static bool v3_file_close(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_FileCloseResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_FileCloseResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -173,7 +246,7 @@ static bool v3_file_open(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileOpenRequest *>(msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     int flags = O_CLOEXEC;
@@ -206,6 +279,8 @@ static bool v3_file_open(int fd, const v3::Request *msg)
     int saved_errno = errno;
 
     if (ffd >= 0) {
+        std::lock_guard<std::mutex> lock(fd_map_lock);
+
         // Assign a new ID
         id = fd_count++;
         fd_map[id] = ffd;
@@ -219,8 +294,8 @@ static bool v3_file_open(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_FileOpenResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_FileOpenResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -228,24 +303,41 @@ static bool v3_file_open(int fd, const v3::Request *msg)
 static bool v3_file_read(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileReadRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    int ffd = v3_dup_fd(request->id());
+    auto close_ffd = finally([&] {
+        if (ffd >= 0) {
+            close(ffd);
+        }
+    });
+    if (ffd < 0) {
+        return v3_send_response_invalid(fd, msg);
     }
+    size_t count = static_cast<size_t>(request->count());
 
-    int ffd = it->second;
-
-    std::vector<unsigned char> buf(static_cast<size_t>(request->count()));
-
-    fb::FlatBufferBuilder builder;
+    fb::FlatBufferBuilder builder(count + 1024);
     fb::Offset<v3::FileReadError> error;
     fb::Offset<fb::Vector<unsigned char>> data;
 
-    ssize_t ret = read(ffd, buf.data(), buf.size());
+    // Read directly into the builder's buffer to avoid copying the data into
+    // an intermediate buffer first
+    unsigned char *buf;
+    auto vec = builder.CreateUninitializedVector(count, &buf);
+
+    ssize_t ret = read(ffd, buf, count);
     int saved_errno = errno;
 
+    size_t n = ret >= 0 ? static_cast<size_t>(ret) : 0;
+    if (n < count) {
+        // Shrink the vector to the number of bytes actually read. The length
+        // prefix immediately precedes the data and the unused tail is zeroed
+        // so that no uninitialized memory is sent to the client.
+        fb::WriteScalar(buf - sizeof(fb::uoffset_t),
+                        static_cast<fb::uoffset_t>(n));
+        memset(buf + n, 0, count - n);
+    }
+
     if (ret >= 0) {
-        data = builder.CreateVector(buf.data(), static_cast<size_t>(ret));
+        data = vec;
     } else {
         error = v3::CreateFileReadErrorDirect(
                 builder, saved_errno, strerror(saved_errno));
@@ -254,11 +346,11 @@ static bool v3_file_read(int fd, const v3::Request *msg)
     auto response = v3::CreateFileReadResponse(
             builder, ret >= 0,
             ret >= 0 ? 0 : builder.CreateString(strerror(saved_errno)),
-            static_cast<size_t>(ret), data, error);
+            n, data, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_FileReadResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_FileReadResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -266,12 +358,15 @@ static bool v3_file_read(int fd, const v3::Request *msg)
 static bool v3_file_seek(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileSeekRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    int ffd = v3_dup_fd(request->id());
+    auto close_ffd = finally([&] {
+        if (ffd >= 0) {
+            close(ffd);
+        }
+    });
+    if (ffd < 0) {
+        return v3_send_response_invalid(fd, msg);
     }
-
-    int ffd = it->second;
     int64_t offset = request->offset();
     int whence;
 
@@ -282,7 +377,7 @@ static bool v3_file_seek(int fd, const v3::Request *msg)
     } else if (request->whence() == v3::FileSeekWhence_SEEK_END) {
         whence = SEEK_END;
     } else {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     fb::FlatBufferBuilder builder;
@@ -304,8 +399,8 @@ static bool v3_file_seek(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_FileSeekResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_FileSeekResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -314,13 +409,16 @@ static bool v3_file_selinux_get_label(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileSELinuxGetLabelRequest *>(
             msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    int ffd = v3_dup_fd(request->id());
+    auto close_ffd = finally([&] {
+        if (ffd >= 0) {
+            close(ffd);
+        }
+    });
+    if (ffd < 0) {
+        return v3_send_response_invalid(fd, msg);
     }
 
-    int ffd = it->second;
-
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileSELinuxGetLabelError> error;
     std::string label;
@@ -338,8 +436,8 @@ static bool v3_file_selinux_get_label(int fd, const v3::Request *msg)
             ret ? label.c_str() : nullptr, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathSELinuxGetLabelResponse,
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_PathSELinuxGetLabelResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
@@ -349,13 +447,16 @@ static bool v3_file_selinux_set_label(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileSELinuxSetLabelRequest *>(
             msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end() || !request->label()) {
-        return v3_send_response_invalid(fd);
+    int ffd = v3_dup_fd(request->id());
+    auto close_ffd = finally([&] {
+        if (ffd >= 0) {
+            close(ffd);
+        }
+    });
+    if (ffd < 0 || !request->label()) {
+        return v3_send_response_invalid(fd, msg);
     }
 
-    int ffd = it->second;
-
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileSELinuxSetLabelError> error;
 
@@ -371,8 +472,8 @@ static bool v3_file_selinux_set_label(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_FileSELinuxSetLabelResponse,
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_FileSELinuxSetLabelResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
@@ -381,13 +482,16 @@ static bool v3_file_selinux_set_label(int fd, const v3::Request *msg)
 static bool v3_file_stat(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileStatRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    int ffd = v3_dup_fd(request->id());
+    auto close_ffd = finally([&] {
+        if (ffd >= 0) {
+            close(ffd);
+        }
+    });
+    if (ffd < 0) {
+        return v3_send_response_invalid(fd, msg);
     }
 
-    int ffd = it->second;
-
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileStatError> error;
     fb::Offset<v3::StructStat> statbuf;
@@ -422,8 +526,8 @@ static bool v3_file_stat(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_FileStatResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_FileStatResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -431,13 +535,16 @@ static bool v3_file_stat(int fd, const v3::Request *msg)
 static bool v3_file_write(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileWriteRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end() || !request->data()) {
-        return v3_send_response_invalid(fd);
+    int ffd = v3_dup_fd(request->id());
+    auto close_ffd = finally([&] {
+        if (ffd >= 0) {
+            close(ffd);
+        }
+    });
+    if (ffd < 0 || !request->data()) {
+        return v3_send_response_invalid(fd, msg);
     }
 
-    int ffd = it->second;
-
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileWriteError> error;
 
@@ -454,8 +561,9 @@ static bool v3_file_write(int fd, const v3::Request *msg)
             static_cast<size_t>(ret), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_FileWriteResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_FileWriteResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -464,14 +572,14 @@ static bool v3_path_chmod(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathChmodRequest *>(msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     // Don't allow setting setuid or setgid permissions
     mode_t mode = static_cast<mode_t>(request->mode());
     mode_t masked = mode & (S_IRWXU | S_IRWXG | S_IRWXO);
     if (masked != mode) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     fb::FlatBufferBuilder builder;
@@ -489,8 +597,9 @@ static bool v3_path_chmod(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathChmodResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_PathChmodResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -499,7 +608,7 @@ static bool v3_path_copy(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathCopyRequest *>(msg->request());
     if (!request->source() || !request->target()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     fb::FlatBufferBuilder builder;
@@ -518,8 +627,8 @@ static bool v3_path_copy(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathCopyResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_PathCopyResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -528,7 +637,7 @@ static bool v3_path_delete(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathDeleteRequest *>(msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     bool ret;
@@ -552,7 +661,7 @@ static bool v3_path_delete(int fd, const v3::Request *msg)
         saved_errno = errno;
         break;
     default:
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     fb::FlatBufferBuilder builder;
@@ -567,8 +676,9 @@ static bool v3_path_delete(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathDeleteResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_PathDeleteResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -577,14 +687,14 @@ static bool v3_path_mkdir(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathMkdirRequest *>(msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     // Don't allow setting setuid or setgid permissions
     mode_t mode = static_cast<mode_t>(request->mode());
     mode_t masked = mode & (S_IRWXU | S_IRWXG | S_IRWXO);
     if (masked != mode) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     fb::FlatBufferBuilder builder;
@@ -607,8 +717,9 @@ static bool v3_path_mkdir(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathMkdirResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_PathMkdirResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -617,7 +728,7 @@ static bool v3_path_readlink(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathReadlinkRequest *>(msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     std::string target;
@@ -636,8 +747,9 @@ static bool v3_path_readlink(int fd, const v3::Request *msg)
             builder, ret ? target.c_str() : nullptr, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathReadlinkResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_PathReadlinkResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -647,7 +759,7 @@ static bool v3_path_selinux_get_label(int fd, const v3::Request *msg)
     auto request = static_cast<const v3::PathSELinuxGetLabelRequest *>(
             msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     std::string label;
@@ -672,8 +784,8 @@ static bool v3_path_selinux_get_label(int fd, const v3::Request *msg)
             ret ? label.c_str() : nullptr, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathSELinuxGetLabelResponse,
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_PathSELinuxGetLabelResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
@@ -684,7 +796,7 @@ static bool v3_path_selinux_set_label(int fd, const v3::Request *msg)
     auto request = static_cast<const v3::PathSELinuxSetLabelRequest *>(
             msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     bool ret;
@@ -709,8 +821,8 @@ static bool v3_path_selinux_set_label(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathSELinuxSetLabelResponse,
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_PathSELinuxSetLabelResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
@@ -770,7 +882,7 @@ static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
     auto request = static_cast<const v3::PathGetDirectorySizeRequest *>(
             msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     std::vector<std::string> exclusions;
@@ -797,18 +909,25 @@ static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathGetDirectorySizeResponse,
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_PathGetDirectorySizeResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
+struct SignedExecOutputCtx
+{
+    int fd;
+    const v3::Request *msg;
+};
+
 static void signed_exec_output_cb(const char *line, bool error, void *userdata)
 {
     (void) error;
 
-    int *fd_ptr = static_cast<int *>(userdata);
+    auto *ctx = static_cast<SignedExecOutputCtx *>(userdata);
+    const v3::Request *msg = ctx->msg;
     // TODO: Send line
 
     fb::FlatBufferBuilder builder;
@@ -818,11 +937,11 @@ static void signed_exec_output_cb(const char *line, bool error, void *userdata)
     auto response = v3::CreateSignedExecOutputResponse(builder, line_id);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_SignedExecOutputResponse,
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_SignedExecOutputResponse,
             response.Union()));
 
-    if (!v3_send_response(*fd_ptr, builder)) {
+    if (!v3_send_response(ctx->fd, builder)) {
         // Can't kill the connection from this callback (yet...)
         LOGE("Failed to send output line: %s", strerror(errno));
     }
@@ -832,7 +951,7 @@ static bool v3_signed_exec(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::SignedExecRequest *>(msg->request());
     if (!request->binary_path() || !request->signature_path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     static const char *temp_dir = "/mbtool_exec_tmp";
@@ -848,6 +967,7 @@ static bool v3_signed_exec(int fd, const v3::Request *msg)
     std::string error_msg;
     int exit_status = -1;
     int term_sig = -1;
+    SignedExecOutputCtx output_ctx{fd, msg};
 
     target_binary = temp_dir;
     target_binary += "/binary";
@@ -953,7 +1073,7 @@ static bool v3_signed_exec(int fd, const v3::Request *msg)
     //       Right now, if the connection is broken, the command will continue
     //       executing.
     status = util::run_command(target_binary, argv, {}, {},
-                               &signed_exec_output_cb, &fd);
+                               &signed_exec_output_cb, &output_ctx);
     if (status >= 0 && WIFEXITED(status)) {
         result = v3::SignedExecResult_PROCESS_EXITED;
         exit_status = WEXITSTATUS(status);
@@ -982,8 +1102,9 @@ done:
             builder, result, error_msg_id, exit_status, term_sig, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_SignedExecResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_SignedExecResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -1003,13 +1124,214 @@ static bool v3_mb_get_booted_rom_id(int fd, const v3::Request *msg)
     auto response = v3::CreateMbGetBootedRomIdResponse(builder, id);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_MbGetBootedRomIdResponse,
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_MbGetBootedRomIdResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
+/*!
+ * \brief Identity of a file used to detect whether cached data is stale
+ *
+ * The modification time includes nanoseconds so that a file that is rewritten
+ * within the same second without changing size is not mistaken for the cached
+ * version.
+ */
+struct CachedFileId
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+};
+
+struct CachedPackagesCount
+{
+    unsigned int system_pkgs;
+    unsigned int update_pkgs;
+    unsigned int other_pkgs;
+};
+
+static bool get_cached_file_id(const std::string &path, CachedFileId &id)
+{
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        return false;
+    }
+
+    id.dev = sb.st_dev;
+    id.ino = sb.st_ino;
+    id.size = sb.st_size;
+    id.mtime = sb.st_mtim;
+    return true;
+}
+
+static std::string format_cached_file_id(const CachedFileId &id)
+{
+    std::string result;
+    result += std::to_string(static_cast<unsigned long long>(id.dev));
+    result += ':';
+    result += std::to_string(static_cast<unsigned long long>(id.ino));
+    result += ':';
+    result += std::to_string(static_cast<long long>(id.size));
+    result += ':';
+    result += std::to_string(static_cast<long long>(id.mtime.tv_sec));
+    result += '.';
+    result += std::to_string(static_cast<long>(id.mtime.tv_nsec));
+    return result;
+}
+
+/*!
+ * \brief Load the on-disk cache
+ *
+ * The cache is a property file where each cached file has a `<path>.id` key
+ * holding its identity and `<path>.<field>` keys holding the cached values.
+ */
+static bool cache_load(std::unordered_map<std::string, std::string> &values)
+{
+    std::string cache_path = get_raw_path(V3_CACHE_PATH);
+
+    int fd = open(cache_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    return flock(fd, LOCK_SH) == 0
+            && util::property_file_get_all(cache_path, values);
+}
+
+/*!
+ * \brief Replace the cache entries for a file
+ *
+ * The cache is reloaded while it is locked since other connections may have
+ * updated it. util::property_file_get_all() only parses the file again if it
+ * actually changed. Entries for files that no longer exist or that have
+ * changed are dropped.
+ */
+static void cache_store(
+        const std::string &path, const CachedFileId &id,
+        const std::unordered_map<std::string, std::string> &fields)
+{
+    std::string cache_path = get_raw_path(V3_CACHE_PATH);
+
+    util::mkdir_parent(cache_path, 0755);
+
+    int fd = open(cache_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGW("%s: Failed to open: %s", cache_path.c_str(), strerror(errno));
+        return;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    // Other connections may be updating the cache at the same time
+    if (flock(fd, LOCK_EX) < 0) {
+        LOGW("%s: Failed to lock: %s", cache_path.c_str(), strerror(errno));
+        return;
+    }
+
+    std::unordered_map<std::string, std::string> old_values;
+    util::property_file_get_all(cache_path, old_values);
+
+    std::unordered_set<std::string> current;
+    for (auto const &pair : old_values) {
+        if (!ends_with(pair.first, ".id")) {
+            continue;
+        }
+
+        std::string file = pair.first.substr(0, pair.first.size() - 3);
+        CachedFileId file_id;
+
+        if (file != path && get_cached_file_id(file, file_id)
+                && format_cached_file_id(file_id) == pair.second) {
+            current.insert(std::move(file));
+        }
+    }
+
+    // Field names do not contain dots, but paths may
+    std::unordered_map<std::string, std::string> values;
+    for (auto const &pair : old_values) {
+        auto dot = pair.first.rfind('.');
+        if (dot != std::string::npos
+                && current.find(pair.first.substr(0, dot)) != current.end()) {
+            values.insert(pair);
+        }
+    }
+
+    values[path + ".id"] = format_cached_file_id(id);
+    for (auto const &field : fields) {
+        values[path + "." + field.first] = field.second;
+    }
+
+    if (!util::property_file_write_all(cache_path, values)) {
+        LOGW("%s: Failed to write cache: %s",
+             cache_path.c_str(), strerror(errno));
+    }
+}
+
+static bool get_packages_count(const std::string &packages_xml,
+                               CachedPackagesCount &count)
+{
+    CachedFileId file_id;
+    bool have_id = get_cached_file_id(packages_xml, file_id);
+
+    if (have_id) {
+        std::unordered_map<std::string, std::string> values;
+
+        if (cache_load(values)
+                && values[packages_xml + ".id"]
+                        == format_cached_file_id(file_id)
+                && str_to_num(values[packages_xml + ".system_pkgs"].c_str(),
+                              10, count.system_pkgs)
+                && str_to_num(values[packages_xml + ".update_pkgs"].c_str(),
+                              10, count.update_pkgs)
+                && str_to_num(values[packages_xml + ".other_pkgs"].c_str(),
+                              10, count.other_pkgs)) {
+            return true;
+        }
+    }
+
+    count.system_pkgs = 0;
+    count.update_pkgs = 0;
+    count.other_pkgs = 0;
+
+    // Only the flags are needed, so skip loading signatures
+    bool ret = Packages::scan_xml(packages_xml, [&](const Package &pkg) {
+        bool is_system = (pkg.pkg_flags & Package::Flag::SYSTEM)
+                || (pkg.pkg_public_flags & Package::PublicFlag::SYSTEM);
+        bool is_update = (pkg.pkg_flags & Package::Flag::UPDATED_SYSTEM_APP)
+                || (pkg.pkg_public_flags & Package::PublicFlag::UPDATED_SYSTEM_APP);
+
+        if (is_update) {
+            ++count.update_pkgs;
+        } else if (is_system) {
+            ++count.system_pkgs;
+        } else {
+            ++count.other_pkgs;
+        }
+    });
+    if (!ret) {
+        return false;
+    }
+
+    if (have_id) {
+        cache_store(packages_xml, file_id, {
+            { "system_pkgs", std::to_string(count.system_pkgs) },
+            { "update_pkgs", std::to_string(count.update_pkgs) },
+            { "other_pkgs", std::to_string(count.other_pkgs) },
+        });
+    }
+
+    return true;
+}
+
 static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
 {
     (void) msg;
@@ -1043,15 +1365,18 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
         build_prop += "/build.prop";
 
         std::unordered_map<std::string, std::string> properties;
-        util::property_file_get_all(build_prop, properties);
-
-        if (properties.find("ro.build.version.release") != properties.end()) {
-            const std::string &version = properties["ro.build.version.release"];
-            fb_version = builder.CreateString(version);
+        util::property_file_get_multiple(
+                build_prop,
+                { "ro.build.version.release", "ro.build.display.id" },
+                properties);
+
+        auto version = properties.find("ro.build.version.release");
+        if (version != properties.end()) {
+            fb_version = builder.CreateString(version->second);
         }
-        if (properties.find("ro.build.display.id") != properties.end()) {
-            const std::string &build = properties["ro.build.display.id"];
-            fb_build = builder.CreateString(build);
+        auto build = properties.find("ro.build.display.id");
+        if (build != properties.end()) {
+            fb_build = builder.CreateString(build->second);
         }
 
         v3::MbRomBuilder mrb(builder);
@@ -1071,8 +1396,8 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
             builder, &fb_roms);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_MbGetInstalledRomsResponse,
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_MbGetInstalledRomsResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1088,8 +1413,9 @@ static bool v3_mb_get_version(int fd, const v3::Request *msg)
     auto response = v3::CreateMbGetVersionResponseDirect(builder, version());
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_MbGetVersionResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_MbGetVersionResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -1098,7 +1424,7 @@ static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::MbSetKernelRequest *>(msg->request());
     if (!request->rom_id() || !request->boot_blockdev()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     fb::FlatBufferBuilder builder;
@@ -1115,8 +1441,9 @@ static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
     auto response = v3::CreateMbSetKernelResponse(builder, ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_MbSetKernelResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_MbSetKernelResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -1125,7 +1452,7 @@ static bool v3_mb_switch_rom(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::MbSwitchRomRequest *>(msg->request());
     if (!request->rom_id() || !request->boot_blockdev()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     std::vector<std::string> block_dev_dirs;
@@ -1172,8 +1499,9 @@ static bool v3_mb_switch_rom(int fd, const v3::Request *msg)
             builder, success, fb_ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_MbSwitchRomResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_MbSwitchRomResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -1182,7 +1510,7 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::MbWipeRomRequest *>(msg->request());
     if (!request->rom_id()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     // Find and verify ROM is installed
@@ -1193,14 +1521,14 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
     if (!rom) {
         LOGE("Tried to wipe non-installed or invalid ROM ID: %s",
              request->rom_id()->c_str());
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     // The GUI should check this, but we'll enforce it here
     auto current_rom = Roms::get_current_rom();
     if (current_rom && current_rom->id == rom->id) {
         LOGE("Cannot wipe currently booted ROM: %s", rom->id.c_str());
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     // Wipe the selected targets
@@ -1246,8 +1574,9 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
             builder, &succeeded, &failed);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_MbWipeRomResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_MbWipeRomResponse,
+            response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -1257,7 +1586,7 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
     auto request = static_cast<const v3::MbGetPackagesCountRequest *>(
             msg->request());
     if (!request->rom_id()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     // Find and verify ROM is installed
@@ -1266,7 +1595,7 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
 
     auto rom = roms.find_by_id(request->rom_id()->c_str());
     if (!rom) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     std::string packages_xml(rom->full_data_path());
@@ -1274,38 +1603,21 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
 
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::MbGetPackagesCountError> error;
-    unsigned int system_pkgs = 0;
-    unsigned int update_pkgs = 0;
-    unsigned int other_pkgs = 0;
+    CachedPackagesCount count{};
 
-    Packages pkgs;
-    bool ret = pkgs.load_xml(packages_xml);
+    bool ret = get_packages_count(packages_xml, count);
 
-    if (ret) {
-        for (std::shared_ptr<Package> pkg : pkgs.pkgs) {
-            bool is_system = (pkg->pkg_flags & Package::Flag::SYSTEM)
-                    || (pkg->pkg_public_flags & Package::PublicFlag::SYSTEM);
-            bool is_update = (pkg->pkg_flags & Package::Flag::UPDATED_SYSTEM_APP)
-                    || (pkg->pkg_public_flags & Package::PublicFlag::UPDATED_SYSTEM_APP);
-
-            if (is_update) {
-                ++update_pkgs;
-            } else if (is_system) {
-                ++system_pkgs;
-            } else {
-                ++other_pkgs;
-            }
-        }
-    } else {
+    if (!ret) {
         error = v3::CreateMbGetPackagesCountError(builder);
     }
 
     auto response = v3::CreateMbGetPackagesCountResponse(
-            builder, ret, system_pkgs, update_pkgs, other_pkgs, error);
+            builder, ret, count.system_pkgs, count.update_pkgs,
+            count.other_pkgs, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_MbGetPackagesCountResponse,
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_MbGetPackagesCountResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1338,7 +1650,7 @@ static bool v3_reboot(int fd, const v3::Request *msg)
         break;
     default:
         LOGE("Invalid reboot type: %d", request->type());
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     if (!ret) {
@@ -1349,8 +1661,8 @@ static bool v3_reboot(int fd, const v3::Request *msg)
     auto response = v3::CreateRebootResponse(builder, ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_RebootResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_RebootResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -1374,7 +1686,7 @@ static bool v3_shutdown(int fd, const v3::Request *msg)
         break;
     default:
         LOGE("Invalid shutdown type: %d", request->type());
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(fd, msg);
     }
 
     if (!ret) {
@@ -1385,8 +1697,8 @@ static bool v3_shutdown(int fd, const v3::Request *msg)
     auto response = v3::CreateShutdownResponse(builder, ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_ShutdownResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, msg, v3::ResponseType_ShutdownResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
@@ -1397,43 +1709,85 @@ struct RequestMap
 {
     v3::RequestType type;
     request_handler_fn fn;
+    // Whether the request must not run concurrently with any other request
+    bool exclusive;
 };
 
 static RequestMap request_map[] = {
-    { v3::RequestType_FileChmodRequest, v3_file_chmod },
-    { v3::RequestType_FileCloseRequest, v3_file_close },
-    { v3::RequestType_FileOpenRequest, v3_file_open },
-    { v3::RequestType_FileReadRequest, v3_file_read },
-    { v3::RequestType_FileSeekRequest, v3_file_seek },
-    { v3::RequestType_FileSELinuxGetLabelRequest, v3_file_selinux_get_label },
-    { v3::RequestType_FileSELinuxSetLabelRequest, v3_file_selinux_set_label },
-    { v3::RequestType_FileStatRequest, v3_file_stat },
-    { v3::RequestType_FileWriteRequest, v3_file_write },
-    { v3::RequestType_PathChmodRequest, v3_path_chmod },
-    { v3::RequestType_PathCopyRequest, v3_path_copy },
-    { v3::RequestType_PathDeleteRequest, v3_path_delete },
-    { v3::RequestType_PathMkdirRequest, v3_path_mkdir },
-    { v3::RequestType_PathReadlinkRequest, v3_path_readlink },
-    { v3::RequestType_PathSELinuxGetLabelRequest, v3_path_selinux_get_label },
-    { v3::RequestType_PathSELinuxSetLabelRequest, v3_path_selinux_set_label },
-    { v3::RequestType_PathGetDirectorySizeRequest, v3_path_get_directory_size },
-    { v3::RequestType_SignedExecRequest, v3_signed_exec },
-    { v3::RequestType_MbGetBootedRomIdRequest, v3_mb_get_booted_rom_id },
-    { v3::RequestType_MbGetInstalledRomsRequest, v3_mb_get_installed_roms },
-    { v3::RequestType_MbGetVersionRequest, v3_mb_get_version },
-    { v3::RequestType_MbSetKernelRequest, v3_mb_set_kernel },
-    { v3::RequestType_MbSwitchRomRequest, v3_mb_switch_rom },
-    { v3::RequestType_MbWipeRomRequest, v3_mb_wipe_rom },
-    { v3::RequestType_MbGetPackagesCountRequest, v3_mb_get_packages_count },
-    { v3::RequestType_RebootRequest, v3_reboot },
-    { v3::RequestType_ShutdownRequest, v3_shutdown },
-    { v3::RequestType_NONE, nullptr }
+    { v3::RequestType_FileChmodRequest, v3_file_chmod, false },
+    { v3::RequestType_FileCloseRequest, v3_file_close, false },
+    { v3::RequestType_FileOpenRequest, v3_file_open, false },
+    { v3::RequestType_FileReadRequest, v3_file_read, false },
+    { v3::RequestType_FileSeekRequest, v3_file_seek, false },
+    { v3::RequestType_FileSELinuxGetLabelRequest, v3_file_selinux_get_label, false },
+    { v3::RequestType_FileSELinuxSetLabelRequest, v3_file_selinux_set_label, false },
+    { v3::RequestType_FileStatRequest, v3_file_stat, false },
+    { v3::RequestType_FileWriteRequest, v3_file_write, false },
+    { v3::RequestType_PathChmodRequest, v3_path_chmod, false },
+    { v3::RequestType_PathCopyRequest, v3_path_copy, false },
+    { v3::RequestType_PathDeleteRequest, v3_path_delete, false },
+    { v3::RequestType_PathMkdirRequest, v3_path_mkdir, false },
+    { v3::RequestType_PathReadlinkRequest, v3_path_readlink, false },
+    { v3::RequestType_PathSELinuxGetLabelRequest, v3_path_selinux_get_label, false },
+    { v3::RequestType_PathSELinuxSetLabelRequest, v3_path_selinux_set_label, false },
+    { v3::RequestType_PathGetDirectorySizeRequest, v3_path_get_directory_size, false },
+    { v3::RequestType_SignedExecRequest, v3_signed_exec, true },
+    { v3::RequestType_MbGetBootedRomIdRequest, v3_mb_get_booted_rom_id, false },
+    { v3::RequestType_MbGetInstalledRomsRequest, v3_mb_get_installed_roms, false },
+    { v3::RequestType_MbGetVersionRequest, v3_mb_get_version, false },
+    { v3::RequestType_MbSetKernelRequest, v3_mb_set_kernel, true },
+    { v3::RequestType_MbSwitchRomRequest, v3_mb_switch_rom, true },
+    { v3::RequestType_MbWipeRomRequest, v3_mb_wipe_rom, true },
+    { v3::RequestType_MbGetPackagesCountRequest, v3_mb_get_packages_count, false },
+    { v3::RequestType_RebootRequest, v3_reboot, true },
+    { v3::RequestType_ShutdownRequest, v3_shutdown, true },
+    { v3::RequestType_NONE, nullptr, false }
 };
 
-bool connection_version_3(int fd)
+using RequestTable = std::array<const RequestMap *, v3::RequestType_MAX + 1>;
+
+static RequestTable v3_build_request_table()
+{
+    RequestTable table{};
+
+    for (auto iter = request_map; iter->fn; ++iter) {
+        table[static_cast<size_t>(iter->type)] = iter;
+    }
+
+    return table;
+}
+
+static const RequestMap * v3_find_request_handler(v3::RequestType type)
 {
-    std::string command;
+    // Indexed by request type for constant time lookups
+    static const RequestTable table = v3_build_request_table();
 
+    if (type < v3::RequestType_MIN || type > v3::RequestType_MAX) {
+        return nullptr;
+    }
+
+    return table[static_cast<size_t>(type)];
+}
+
+static bool v3_handle_request(int fd, const v3::Request *request)
+{
+    const RequestMap *entry = v3_find_request_handler(request->request_type());
+    if (!entry) {
+        // Invalid command; allow further commands
+        return v3_send_response_unsupported(fd, request);
+    }
+
+    if (entry->exclusive) {
+        std::unique_lock<std::shared_timed_mutex> lock(exclusive_lock);
+        return entry->fn(fd, request);
+    } else {
+        std::shared_lock<std::shared_timed_mutex> lock(exclusive_lock);
+        return entry->fn(fd, request);
+    }
+}
+
+bool connection_version_3(int fd)
+{
     auto close_all_fds = finally([&]{
         // Ensure opened fd's are closed if the connection is lost
         for (auto &p : fd_map) {
@@ -1442,6 +1796,14 @@ bool connection_version_3(int fd)
         fd_map.clear();
     });
 
+    // Declared after close_all_fds so that the workers are stopped before the
+    // fd's are closed
+    RequestWorkers workers(fd, V3_WORKER_THREADS, V3_MAX_QUEUED_REQUESTS,
+                           [fd](const std::vector<uint8_t> &data) {
+        // The buffer was verified before it was queued
+        return v3_handle_request(fd, v3::GetRequest(data.data()));
+    });
+
     while (1) {
         std::vector<uint8_t> data;
         if (!util::socket_read_bytes(fd, data)) {
@@ -1455,25 +1817,16 @@ bool connection_version_3(int fd)
         }
 
         const v3::Request *request = v3::GetRequest(data.data());
-        v3::RequestType type = request->request_type();
-        request_handler_fn fn = nullptr;
-
-        for (auto iter = request_map; iter->fn; ++iter) {
-            if (type == iter->type) {
-                fn = iter->fn;
-                break;
-            }
-        }
 
         // NOTE: A false return value indicates a connection error, not a
         //       command failure!
-        bool ret = true;
+        bool ret;
 
-        if (fn) {
-            ret = fn(fd, request);
+        if (request->id() != 0) {
+            // May be processed concurrently with other requests
+            ret = workers.submit(std::move(data));
         } else {
-            // Invalid command; allow further commands
-            ret = v3_send_response_unsupported(fd);
+            ret = v3_handle_request(fd, request);
         }
 
         if (!ret) {
@@ -15,7 +15,10 @@
  */
 
 #include <chrono>
+#include <algorithm>
 #include <memory>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <cerrno>
@@ -101,21 +104,28 @@ bool is_legal_property_name(const std::string& name) {
     return true;
 }
 
-uint32_t property_set(const std::string& name, const std::string& value) {
-    size_t valuelen = value.size();
-
+static uint32_t property_validate(const std::string& name,
+                                  const std::string& value) {
     if (!is_legal_property_name(name)) {
         LOGE("property_set(\"%s\", \"%s\") failed: bad name",
              name.c_str(), value.c_str());
         return PROP_ERROR_INVALID_NAME;
     }
 
-    if (valuelen >= PROP_VALUE_MAX) {
+    if (value.size() >= PROP_VALUE_MAX) {
         LOGE("property_set(\"%s\", \"%s\") failed: value too long",
              name.c_str(), value.c_str());
         return PROP_ERROR_INVALID_VALUE;
     }
 
+    return PROP_SUCCESS;
+}
+
+// Caller must have validated the name and value with property_validate()
+static uint32_t property_set_validated(const std::string& name,
+                                       const std::string& value) {
+    size_t valuelen = value.size();
+
     prop_info* pi = (prop_info*) mb__system_property_find(name.c_str());
     if (pi != nullptr) {
         // ro.* properties are actually "write-once".
@@ -139,10 +149,60 @@ uint32_t property_set(const std::string& name, const std::string& value) {
     return PROP_SUCCESS;
 }
 
+uint32_t property_set(const std::string& name, const std::string& value) {
+    uint32_t result = property_validate(name, value);
+    if (result != PROP_SUCCESS) {
+        return result;
+    }
+
+    return property_set_validated(name, value);
+}
+
+typedef std::vector<std::pair<std::string, std::string>> PropertyBatch;
+
+// Set all properties loaded from a file. The whole batch is validated first and
+// duplicates are resolved in memory, so each property is written to the
+// property area only once. As with individual property_set() calls, the first
+// value of a ro.* property wins and the last value of any other property wins.
+static void property_set_batch(const PropertyBatch& batch) {
+    // Name -> index of the value to set
+    std::unordered_map<std::string, size_t> values;
+    // Index of first occurrence of each name, in file order
+    std::vector<size_t> order;
+
+    values.reserve(batch.size());
+    order.reserve(batch.size());
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const std::string& name = batch[i].first;
+        const std::string& value = batch[i].second;
+
+        if (property_validate(name, value) != PROP_SUCCESS) {
+            continue;
+        }
+
+        auto it = values.find(name);
+        if (it == values.end()) {
+            values.emplace(name, i);
+            order.push_back(i);
+        } else if (mb::starts_with(name, "ro.")) {
+            LOGE("property_set(\"%s\", \"%s\") failed: property already set",
+                 name.c_str(), value.c_str());
+        } else {
+            it->second = i;
+        }
+    }
+
+    for (size_t i : order) {
+        const std::string& name = batch[i].first;
+        property_set_validated(name, batch[values[name]].second);
+    }
+}
+
 class SocketConnection {
  public:
   SocketConnection(int socket, const struct ucred& cred)
-      : socket_(socket), cred_(cred) {}
+      : socket_(socket), cred_(cred), buffer_pos_(0), buffer_size_(0) {}
 
   ~SocketConnection() {
     close(socket_);
@@ -234,28 +294,53 @@ class SocketConnection {
     return false;
   }
 
-  bool RecvFully(void* data_ptr, size_t size, uint32_t* timeout_ms) {
-    size_t bytes_left = size;
-    char* data = static_cast<char*>(data_ptr);
-    while (*timeout_ms > 0 && bytes_left > 0) {
+  // Read as much as is available in one recv() and only poll if nothing has
+  // arrived yet. Clients send the whole request at once, so this usually
+  // takes a single system call per request instead of a poll() and recv()
+  // for each field.
+  bool FillBuffer(uint32_t* timeout_ms) {
+    while (true) {
+      ssize_t result = TEMP_FAILURE_RETRY(
+          recv(socket_, buffer_, sizeof(buffer_), MSG_DONTWAIT));
+      if (result > 0) {
+        buffer_pos_ = 0;
+        buffer_size_ = static_cast<size_t>(result);
+        return true;
+      }
+
+      if (result == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return false;
+      }
+
       if (!PollIn(timeout_ms)) {
         return false;
       }
+    }
+  }
 
-      int result = TEMP_FAILURE_RETRY(recv(socket_, data, bytes_left, MSG_DONTWAIT));
-      if (result <= 0) {
+  bool RecvFully(void* data_ptr, size_t size, uint32_t* timeout_ms) {
+    size_t bytes_left = size;
+    char* data = static_cast<char*>(data_ptr);
+    while (bytes_left > 0) {
+      if (buffer_pos_ == buffer_size_ && !FillBuffer(timeout_ms)) {
         return false;
       }
 
-      bytes_left -= result;
-      data += result;
+      size_t n = std::min(bytes_left, buffer_size_ - buffer_pos_);
+      memcpy(data, buffer_ + buffer_pos_, n);
+      buffer_pos_ += n;
+      bytes_left -= n;
+      data += n;
     }
 
-    return bytes_left == 0;
+    return true;
   }
 
   int socket_;
   struct ucred cred_;
+  char buffer_[4096];
+  size_t buffer_pos_;
+  size_t buffer_size_;
 
   DISALLOW_IMPLICIT_CONSTRUCTORS(SocketConnection);
 };
@@ -284,12 +369,13 @@ static void handle_property_set(SocketConnection& socket,
   }
 }
 
-static void handle_property_set_fd() {
+// Returns false if there were no pending connections
+static bool handle_property_set_fd() {
     static constexpr uint32_t kDefaultSocketTimeout = 2000; /* ms */
 
     int s = accept4(property_set_fd, nullptr, nullptr, SOCK_CLOEXEC);
     if (s == -1) {
-        return;
+        return false;
     }
 
     struct ucred cr;
@@ -297,7 +383,7 @@ static void handle_property_set_fd() {
     if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
         close(s);
         LOGE("sys_prop: unable to get SO_PEERCRED");
-        return;
+        return true;
     }
 
     SocketConnection socket(s, cr);
@@ -307,7 +393,7 @@ static void handle_property_set_fd() {
     if (!socket.RecvUint32(&cmd, &timeout_ms)) {
         LOGE("sys_prop: error while reading command from the socket");
         socket.SendUint32(PROP_ERROR_READ_CMD);
-        return;
+        return true;
     }
 
     switch (cmd) {
@@ -318,7 +404,7 @@ static void handle_property_set_fd() {
         if (!socket.RecvChars(prop_name, PROP_NAME_MAX, &timeout_ms) ||
             !socket.RecvChars(prop_value, PROP_VALUE_MAX, &timeout_ms)) {
           LOGE("sys_prop(PROP_MSG_SETPROP): error while reading name/value from the socket");
-          return;
+          return true;
         }
 
         prop_name[PROP_NAME_MAX-1] = 0;
@@ -335,7 +421,7 @@ static void handle_property_set_fd() {
             !socket.RecvString(&value, &timeout_ms)) {
           LOGE("sys_prop(PROP_MSG_SETPROP2): error while reading name/value from the socket");
           socket.SendUint32(PROP_ERROR_READ_DATA);
-          return;
+          return true;
         }
 
         handle_property_set(socket, name, value, false);
@@ -347,6 +433,8 @@ static void handle_property_set_fd() {
         socket.SendUint32(PROP_ERROR_INVALID_CMD);
         break;
     }
+
+    return true;
 }
 
 static void load_properties_from_file(const char *, const char *);
@@ -359,6 +447,7 @@ static void load_properties(char *data, const char *filter)
 {
     char *key, *value, *eol, *sol, *tmp, *fn;
     size_t flen = 0;
+    PropertyBatch batch;
 
     if (filter) {
         flen = strlen(filter);
@@ -386,6 +475,10 @@ static void load_properties(char *data, const char *filter)
                 while (isspace(*key)) key++;
             }
 
+            // Properties before the import must be set first
+            property_set_batch(batch);
+            batch.clear();
+
             load_properties_from_file(fn, key);
 
         } else {
@@ -406,9 +499,11 @@ static void load_properties(char *data, const char *filter)
                 }
             }
 
-            property_set(key, value);
+            batch.emplace_back(key, value);
         }
     }
+
+    property_set_batch(batch);
 }
 
 // Filter is used to decide which properties to load: NULL loads all keys,
@@ -446,6 +541,8 @@ void load_system_props() {
 
 void * property_service_thread(void *)
 {
+    static constexpr int kMaxConnectionsPerWakeup = 32;
+
     struct pollfd fds[2];
     fds[0].fd = stop_pipe_fd[0];
     fds[0].events = POLLIN;
@@ -464,7 +561,14 @@ void * property_service_thread(void *)
             break;
         }
         if (fds[1].revents & POLLIN) {
-            handle_property_set_fd();
+            // Drain connections that queued up while the previous one was
+            // being handled, but go back to poll() periodically so that a
+            // stop request isn't starved
+            for (int i = 0; i < kMaxConnectionsPerWakeup; ++i) {
+                if (!handle_property_set_fd()) {
+                    break;
+                }
+            }
         }
     }
 
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2007-2014 The Android Open Source Project
+ * Copyright (C) 2015 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "initwrapper/coldboot.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+/*
+ * Coldboot walks parts of the /sys tree and pokes the uevent files
+ * to cause the kernel to regenerate device add events that happened
+ * before init's device manager was started
+ *
+ * The walk is split across several worker threads. A directory's uevent file
+ * is always poked before any of its subdirectories are handed to another
+ * worker, so parent devices (eg. platform devices) are still announced before
+ * their children. Meanwhile, the calling thread drains the netlink socket so
+ * that all events are still handled sequentially.
+ */
+
+#define COLDBOOT_MAX_THREADS    4
+// Subdirectories up to this depth are queued for other workers. Deeper
+// subtrees are walked by the worker that found them.
+#define COLDBOOT_SPLIT_DEPTH    3
+
+struct ColdbootWork
+{
+    std::string path;
+    int depth;
+};
+
+struct ColdbootQueue
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<ColdbootWork> work;
+    // Number of items queued or being processed
+    size_t pending = 0;
+};
+
+static void do_coldboot(DIR *d, const std::string &path, int depth,
+                        ColdbootQueue &queue)
+{
+    struct dirent *de;
+    int dfd, fd;
+
+    dfd = dirfd(d);
+
+    fd = openat(dfd, "uevent", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        write(fd, "add\n", 4);
+        close(fd);
+    }
+
+    while ((de = readdir(d))) {
+        DIR *d2;
+
+        if (de->d_type != DT_DIR || de->d_name[0] == '.') {
+            continue;
+        }
+
+        std::string child(path);
+        child += '/';
+        child += de->d_name;
+
+        if (depth < COLDBOOT_SPLIT_DEPTH) {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.work.push_back({ std::move(child), depth + 1 });
+            ++queue.pending;
+            queue.cv.notify_one();
+            continue;
+        }
+
+        fd = openat(dfd, de->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+
+        d2 = fdopendir(fd);
+        if (d2 == 0) {
+            close(fd);
+        } else {
+            do_coldboot(d2, child, depth + 1, queue);
+            closedir(d2);
+        }
+    }
+}
+
+static void coldboot_worker(ColdbootQueue &queue)
+{
+    std::unique_lock<std::mutex> lock(queue.mutex);
+
+    while (true) {
+        queue.cv.wait(lock, [&]{
+            return !queue.work.empty() || queue.pending == 0;
+        });
+        if (queue.work.empty()) {
+            // Nothing queued and nothing in progress
+            break;
+        }
+
+        ColdbootWork item = std::move(queue.work.front());
+        queue.work.pop_front();
+        lock.unlock();
+
+        DIR *d = opendir(item.path.c_str());
+        if (d) {
+            do_coldboot(d, item.path, item.depth, queue);
+            closedir(d);
+        }
+
+        lock.lock();
+        if (--queue.pending == 0) {
+            queue.cv.notify_all();
+        }
+    }
+}
+
+void coldboot(const std::string &sysfs_root, int uevent_fd,
+              const std::function<void(int)> &handle_events)
+{
+    ColdbootQueue queue;
+    for (auto const &dir : { "/class", "/block", "/devices" }) {
+        queue.work.push_back({ sysfs_root + dir, 0 });
+    }
+    queue.pending = queue.work.size();
+
+    // The threads only write to uevent files, so the thread count is not
+    // bound by the number of CPUs
+    std::vector<std::thread> threads;
+    for (int i = 0; i < COLDBOOT_MAX_THREADS; ++i) {
+        threads.emplace_back(coldboot_worker, std::ref(queue));
+    }
+
+    struct pollfd fds[1];
+    fds[0].fd = uevent_fd;
+    fds[0].events = POLLIN;
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.pending == 0) {
+                break;
+            }
+        }
+
+        fds[0].revents = 0;
+        if (poll(fds, 1, 10) > 0 && (fds[0].revents & POLLIN)) {
+            handle_events(uevent_fd);
+        }
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    // Handle the events generated by the last uevent writes
+    handle_events(uevent_fd);
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2007-2014 The Android Open Source Project
+ * Copyright (C) 2015 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+// Pokes the uevent files under the class, block, and devices subdirectories of
+// sysfs_root. handle_events(uevent_fd) is called on the calling thread
+// whenever uevent_fd is readable and once more after the walk completes.
+void coldboot(const std::string &sysfs_root, int uevent_fd,
+              const std::function<void(int)> &handle_events);
@@ -18,6 +18,7 @@
 #include "initwrapper/cutils/uevent.h"
 
 #include <cerrno>
+#include <cstring>
 #include <strings.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -47,6 +48,49 @@ ssize_t uevent_kernel_multicast_uid_recv(int socket, void *buffer, size_t length
     return uevent_kernel_recv(socket, buffer, length, true, uid);
 }
 
+/**
+ * Checks that a received netlink message originates from the kernel. If it
+ * does not, the message is cleared, errno is set to EIO, and false is
+ * returned.
+ */
+static bool check_kernel_sender(struct msghdr *hdr, void *buffer,
+                                size_t length, bool require_group, uid_t *uid)
+{
+    struct sockaddr_nl *addr = (struct sockaddr_nl *) hdr->msg_name;
+    struct cmsghdr *cmsg;
+    struct ucred *cred;
+
+    cmsg = CMSG_FIRSTHDR(hdr);
+    if (!cmsg || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        // Ignoring netlink message with no sender credentials
+        goto out;
+    }
+
+    cred = (struct ucred *) CMSG_DATA(cmsg);
+    *uid = cred->uid;
+    if (cred->uid != 0) {
+        // Ignoring netlink message from non-root user
+        goto out;
+    }
+
+    if (addr->nl_pid != 0) {
+        // Ignore non-kernel
+        goto out;
+    }
+    if (require_group && addr->nl_groups == 0) {
+        // Ignore unicast messages when requested
+        goto out;
+    }
+
+    return true;
+
+out:
+    // Clear residual potentially malicious data
+    bzero(buffer, length);
+    errno = EIO;
+    return false;
+}
+
 ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require_group, uid_t *uid)
 {
     struct iovec iov = { buffer, length };
@@ -68,38 +112,59 @@ ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require
         return n;
     }
 
-    struct cmsghdr *cmsg;
-    struct ucred *cred;
+    if (!check_kernel_sender(&hdr, buffer, length, require_group, uid)) {
+        return -1;
+    }
 
-    cmsg = CMSG_FIRSTHDR(&hdr);
-    if (!cmsg || cmsg->cmsg_type != SCM_CREDENTIALS) {
-        // Ignoring netlink message with no sender credentials
-        goto out;
+    return n;
+}
+
+/**
+ * Like uevent_kernel_multicast_recv(), but receives up to vlen messages with a
+ * single recvmmsg() call. Message i is stored in iov[i] and its size in
+ * lengths[i]. Messages that did not originate from the kernel are cleared and
+ * have their size set to -1.
+ *
+ * Returns the number of messages received or -1 if recvmmsg() fails.
+ */
+int uevent_kernel_multicast_recv_batch(int socket, const struct iovec *iov, ssize_t *lengths, unsigned int vlen)
+{
+    if (vlen > UEVENT_RECV_BATCH_MAX) {
+        vlen = UEVENT_RECV_BATCH_MAX;
     }
 
-    cred = (struct ucred *) CMSG_DATA(cmsg);
-    *uid = cred->uid;
-    if (cred->uid != 0) {
-        // Ignoring netlink message from non-root user
-        goto out;
+    struct iovec iovs[UEVENT_RECV_BATCH_MAX];
+    struct sockaddr_nl addrs[UEVENT_RECV_BATCH_MAX];
+    char controls[UEVENT_RECV_BATCH_MAX][CMSG_SPACE(sizeof(struct ucred))];
+    struct mmsghdr msgs[UEVENT_RECV_BATCH_MAX];
+
+    memset(msgs, 0, sizeof(msgs[0]) * vlen);
+    for (unsigned int i = 0; i < vlen; ++i) {
+        iovs[i] = iov[i];
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = controls[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
     }
 
-    if (addr.nl_pid != 0) {
-        // Ignore non-kernel
-        goto out;
+    int n = recvmmsg(socket, msgs, vlen, MSG_WAITFORONE, nullptr);
+    if (n <= 0) {
+        return n;
     }
-    if (require_group && addr.nl_groups == 0) {
-        // Ignore unicast messages when requested
-        goto out;
+
+    for (int i = 0; i < n; ++i) {
+        uid_t uid = -1;
+        if (check_kernel_sender(&msgs[i].msg_hdr, iov[i].iov_base,
+                                iov[i].iov_len, true, &uid)) {
+            lengths[i] = msgs[i].msg_len;
+        } else {
+            lengths[i] = -1;
+        }
     }
 
     return n;
-
-out:
-    // Clear residual potentially malicious data
-    bzero(buffer, length);
-    errno = EIO;
-    return -1;
 }
 
 int uevent_open_socket(int buf_sz, bool passcred)
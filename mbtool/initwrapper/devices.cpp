@@ -17,7 +17,12 @@
 
 #include "initwrapper/devices.h"
 
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <cstdlib>
 #include <cstring>
@@ -29,6 +34,7 @@
 #include <pthread.h>
 #include <sys/socket.h>
 #include <sys/sysmacros.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "mbcommon/common.h"
@@ -39,6 +45,7 @@
 #include "mbutil/string.h"
 #include "mbutil/external/system_properties.h"
 
+#include "initwrapper/coldboot.h"
 #include "initwrapper/cutils/uevent.h"
 #include "initwrapper/util.h"
 
@@ -75,8 +82,97 @@ struct platform_node {
 
 static std::vector<platform_node> platform_names;
 
-static std::unordered_map<std::string, BlockDevInfo> block_dev_mappings;
-static std::mutex block_dev_mappings_guard;
+/*
+ * Block devices are stored contiguously and removed by swapping with the last
+ * entry. The indexes map to positions in the vector.
+ */
+class BlockDevMap
+{
+public:
+    void add(BlockDevInfo info)
+    {
+        remove(info.sysfs_path);
+
+        size_t index = m_devs.size();
+        m_by_sysfs_path.emplace(info.sysfs_path, index);
+        if (!info.partition_name.empty()) {
+            // If partition names collide, the first device wins
+            m_by_name.emplace(info.partition_name, index);
+        }
+        m_devs.push_back(std::move(info));
+    }
+
+    void remove(const std::string &sysfs_path)
+    {
+        auto it = m_by_sysfs_path.find(sysfs_path);
+        if (it == m_by_sysfs_path.end()) {
+            return;
+        }
+
+        size_t index = it->second;
+        unindex(index);
+
+        size_t last = m_devs.size() - 1;
+        if (index != last) {
+            unindex(last);
+            m_devs[index] = std::move(m_devs[last]);
+            reindex(index);
+        }
+        m_devs.pop_back();
+
+        // Let another device with the same partition name take over
+        for (size_t i = 0; i < m_devs.size(); ++i) {
+            if (!m_devs[i].partition_name.empty()) {
+                m_by_name.emplace(m_devs[i].partition_name, i);
+            }
+        }
+    }
+
+    const BlockDevInfo * find_by_name(const std::string &name) const
+    {
+        auto it = m_by_name.find(name);
+        return it == m_by_name.end() ? nullptr : &m_devs[it->second];
+    }
+
+    const std::vector<BlockDevInfo> & devices() const
+    {
+        return m_devs;
+    }
+
+private:
+    std::vector<BlockDevInfo> m_devs;
+    std::unordered_map<std::string, size_t> m_by_sysfs_path;
+    std::unordered_map<std::string, size_t> m_by_name;
+
+    // Remove index entries that point to the device at index
+    void unindex(size_t index)
+    {
+        const BlockDevInfo &info = m_devs[index];
+
+        m_by_sysfs_path.erase(info.sysfs_path);
+
+        auto it = m_by_name.find(info.partition_name);
+        if (it != m_by_name.end() && it->second == index) {
+            m_by_name.erase(it);
+        }
+    }
+
+    void reindex(size_t index)
+    {
+        const BlockDevInfo &info = m_devs[index];
+
+        m_by_sysfs_path[info.sysfs_path] = index;
+        if (!info.partition_name.empty()) {
+            m_by_name.emplace(info.partition_name, index);
+        }
+    }
+};
+
+static BlockDevMap block_devs;
+// Incremented every time block_devs changes
+static unsigned int block_devs_generation;
+static std::mutex block_devs_guard;
+static std::condition_variable block_devs_cv;
 
 static mode_t get_device_perm(const char *path,
                               const std::vector<std::string> &links,
@@ -387,8 +483,6 @@ static std::vector<std::string> get_block_device_symlinks(struct uevent *uevent)
     const char *slash;
     const char *type;
     char buf[256];
-    char link_path[256];
-    char *p;
     bool is_bootdevice = false;
     int mtd_fd = -1;
     int nr;
@@ -419,9 +513,31 @@ static std::vector<std::string> get_block_device_symlinks(struct uevent *uevent)
     }
 #endif
 
+    // These don't depend on the parent device, so only compute them once
+    std::string partition_name;
+    if (uevent->partition_name) {
+        partition_name = uevent->partition_name;
+        sanitize(&partition_name[0]);
+#if UEVENT_LOGGING
+        if (partition_name != uevent->partition_name) {
+            LOGV("Linking partition '%s' as '%s'",
+                 uevent->partition_name, partition_name.c_str());
+        }
+#endif
+    }
+    std::string partition_num;
+    if (uevent->partition_num >= 0) {
+        partition_num = std::to_string(uevent->partition_num);
+    }
+    slash = strrchr(uevent->path, '/');
+
+    links.reserve(devices.size() * 5);
+
     for (auto const &device : devices) {
-        snprintf(link_path, sizeof(link_path),
-                 "/dev/block/%s/%s", type, device.c_str());
+        std::string link_path("/dev/block/");
+        link_path += type;
+        link_path += '/';
+        link_path += device;
 
         if (strcmp(type, "mtd") == 0) {
             snprintf(mtd_name_path, sizeof(mtd_name_path),
@@ -440,56 +556,41 @@ static std::vector<std::string> get_block_device_symlinks(struct uevent *uevent)
             close(mtd_fd);
             mtd_name[nr - 1] = '\0';
 
-            p = strdup(mtd_name);
-            sanitize(p);
-
-            links.push_back(mb::format("/dev/block/%s/by-name/%s", type, p));
+            sanitize(mtd_name);
 
-            free(p);
+            links.push_back(std::string("/dev/block/") + type + "/by-name/"
+                    + mtd_name);
         }
 
         if (!pdevs.empty() && bootdevice[0] != '\0'
                 && strstr(device.c_str(), bootdevice)) {
             if (!dry_run) {
-                make_link_init(link_path, "/dev/block/bootdevice");
+                make_link_init(link_path.c_str(), "/dev/block/bootdevice");
             }
             is_bootdevice = true;
         } else {
             is_bootdevice = false;
         }
 
-        if (uevent->partition_name) {
-            p = strdup(uevent->partition_name);
-            sanitize(p);
-            if (strcmp(uevent->partition_name, p) != 0) {
-#if UEVENT_LOGGING
-                LOGV("Linking partition '%s' as '%s'",
-                     uevent->partition_name, p);
-#endif
-            }
-
-            links.push_back(mb::format("%s/by-name/%s", link_path, p));
+        if (!partition_name.empty()) {
+            links.push_back(link_path + "/by-name/" + partition_name);
 
             if (is_bootdevice) {
-                links.push_back(mb::format(
-                        "/dev/block/bootdevice/by-name/%s", p));
+                links.push_back("/dev/block/bootdevice/by-name/"
+                        + partition_name);
             }
-            free(p);
         }
 
-        if (uevent->partition_num >= 0) {
-            links.push_back(mb::format("%s/by-num/p%d",
-                                       link_path, uevent->partition_num));
+        if (!partition_num.empty()) {
+            links.push_back(link_path + "/by-num/p" + partition_num);
 
             if (is_bootdevice) {
-                links.push_back(mb::format("/dev/block/bootdevice/by-num/p%d",
-                                           uevent->partition_num));
+                links.push_back("/dev/block/bootdevice/by-num/p"
+                        + partition_num);
             }
         }
 
-        slash = strrchr(uevent->path, '/');
-
-        links.push_back(mb::format("%s/%s", link_path, slash + 1));
+        links.push_back(link_path + '/' + (slash + 1));
     }
 
     return links;
@@ -584,6 +685,7 @@ static void handle_block_device_event(struct uevent *uevent)
     // Add/remove block device mapping
     if (strcmp(uevent->action, "add") == 0) {
         BlockDevInfo info;
+        info.sysfs_path = uevent->path;
         info.path = devpath;
         info.partition_num = uevent->partition_num;
         info.major = uevent->major;
@@ -593,12 +695,15 @@ static void handle_block_device_event(struct uevent *uevent)
             info.partition_name = uevent->partition_name;
         }
 
-        std::lock_guard<std::mutex> lock(block_dev_mappings_guard);
-        block_dev_mappings.emplace(
-                std::make_pair(uevent->path, std::move(info)));
+        std::lock_guard<std::mutex> lock(block_devs_guard);
+        block_devs.add(std::move(info));
+        ++block_devs_generation;
+        block_devs_cv.notify_all();
     } else if (strcmp(uevent->action, "remove") == 0) {
-        std::lock_guard<std::mutex> lock(block_dev_mappings_guard);
-        block_dev_mappings.erase(uevent->path);
+        std::lock_guard<std::mutex> lock(block_devs_guard);
+        block_devs.remove(uevent->path);
+        ++block_devs_generation;
+        block_devs_cv.notify_all();
     }
 }
 
@@ -739,84 +844,65 @@ static void handle_device_event(struct uevent *uevent)
 }
 
 #define UEVENT_MSG_LEN  2048
-void handle_device_fd()
+#define UEVENT_BATCH    16
+static void handle_uevent_fd(int fd)
 {
-    char msg[UEVENT_MSG_LEN + 2];
-    int n;
-    while ((n = uevent_kernel_multicast_recv(device_fd, msg, UEVENT_MSG_LEN)) > 0) {
-        if (n >= UEVENT_MSG_LEN) {
-            // overflow -- discard
+    // Only the coldboot thread or the device thread drains the socket at any
+    // given time, so the buffers can be shared
+    static char msgs[UEVENT_BATCH][UEVENT_MSG_LEN + 2];
+    struct iovec iov[UEVENT_BATCH];
+    ssize_t lengths[UEVENT_BATCH];
+    int count;
+
+    for (int i = 0; i < UEVENT_BATCH; ++i) {
+        iov[i].iov_base = msgs[i];
+        iov[i].iov_len = UEVENT_MSG_LEN;
+    }
+
+    while (true) {
+        count = uevent_kernel_multicast_recv_batch(
+                fd, iov, lengths, UEVENT_BATCH);
+        if (count < 0 && errno == ENOBUFS) {
+            // The socket buffer overflowed and some events were lost. Keep
+            // handling the remaining ones.
+            LOGW("uevent socket buffer overrun");
             continue;
+        } else if (count <= 0) {
+            break;
         }
 
-        msg[n] = '\0';
-        msg[n + 1] = '\0';
+        for (int i = 0; i < count; ++i) {
+            char *msg = msgs[i];
+            ssize_t n = lengths[i];
 
-        struct uevent uevent;
-        parse_event(msg, &uevent);
-
-        if (uevent.path && strstr(uevent.path, "sec-battery")) {
-            // sec-battery causes boot delays on the Galaxy S4
-            continue;
-        }
-
-        handle_device_event(&uevent);
-    }
-}
-
-/*
- * Coldboot walks parts of the /sys tree and pokes the uevent files
- * to cause the kernel to regenerate device add events that happened
- * before init's device manager was started
- *
- * We drain any pending events from the netlink socket every time
- * we poke another uevent file to make sure we don't overrun the
- * socket's buffer.
- */
-
-static void do_coldboot(DIR *d)
-{
-    struct dirent *de;
-    int dfd, fd;
-
-    dfd = dirfd(d);
-
-    fd = openat(dfd, "uevent", O_WRONLY);
-    if (fd >= 0) {
-        write(fd, "add\n", 4);
-        close(fd);
-        handle_device_fd();
-    }
+            if (n <= 0) {
+                // not from the kernel -- discard
+                continue;
+            }
+            if (n >= UEVENT_MSG_LEN) {
+                // overflow -- discard
+                continue;
+            }
 
-    while ((de = readdir(d))) {
-        DIR *d2;
+            msg[n] = '\0';
+            msg[n + 1] = '\0';
 
-        if (de->d_type != DT_DIR || de->d_name[0] == '.') {
-            continue;
-        }
+            struct uevent uevent;
+            parse_event(msg, &uevent);
 
-        fd = openat(dfd, de->d_name, O_RDONLY | O_DIRECTORY);
-        if (fd < 0) {
-            continue;
-        }
+            if (uevent.path && strstr(uevent.path, "sec-battery")) {
+                // sec-battery causes boot delays on the Galaxy S4
+                continue;
+            }
 
-        d2 = fdopendir(fd);
-        if (d2 == 0) {
-            close(fd);
-        } else {
-            do_coldboot(d2);
-            closedir(d2);
+            handle_device_event(&uevent);
         }
     }
 }
 
-static void coldboot(const char *path)
+void handle_device_fd()
 {
-    DIR *d = opendir(path);
-    if (d) {
-        do_coldboot(d);
-        closedir(d);
-    }
+    handle_uevent_fd(device_fd);
 }
 
 void * device_thread(void *)
@@ -857,17 +943,16 @@ void device_init(bool dry_run_)
         strlcpy(bootdevice, value->c_str(), sizeof(bootdevice));
     }
 
-    // Is 256K enough? udev uses 16MB!
-    device_fd = uevent_open_socket(256 * 1024, true);
+    // Coldboot generates events from several threads at once, so use a larger
+    // buffer than the 256K that Android's init uses. udev uses 16MB!
+    device_fd = uevent_open_socket(2 * 1024 * 1024, true);
     if (device_fd < 0) {
         return;
     }
 
     fcntl(device_fd, F_SETFL, O_NONBLOCK);
 
-    coldboot("/sys/class");
-    coldboot("/sys/block");
-    coldboot("/sys/devices");
+    coldboot("/sys", device_fd, handle_uevent_fd);
 
     run_thread = true;
     pipe(pipe_fd);
@@ -892,8 +977,31 @@ int get_device_fd()
     return device_fd;
 }
 
-std::unordered_map<std::string, BlockDevInfo> get_block_dev_mappings()
+std::vector<BlockDevInfo> get_block_devs(unsigned int *generation)
+{
+    std::lock_guard<std::mutex> lock(block_devs_guard);
+    if (generation) {
+        *generation = block_devs_generation;
+    }
+    return block_devs.devices();
+}
+
+bool wait_for_block_dev_by_name(const std::string &name,
+                                unsigned int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(block_devs_guard);
+    return block_devs_cv.wait_for(
+            lock, std::chrono::milliseconds(timeout_ms), [&]{
+        return block_devs.find_by_name(name) != nullptr;
+    });
+}
+
+bool wait_for_block_devs_change(unsigned int generation,
+                                unsigned int timeout_ms)
 {
-    std::lock_guard<std::mutex> lock(block_dev_mappings_guard);
-    return block_dev_mappings;
+    std::unique_lock<std::mutex> lock(block_devs_guard);
+    return block_devs_cv.wait_for(
+            lock, std::chrono::milliseconds(timeout_ms), [&]{
+        return block_devs_generation != generation;
+    });
 }
@@ -18,12 +18,13 @@
 #pragma once
 
 #include <string>
-#include <unordered_map>
+#include <vector>
 
 #include <sys/stat.h>
 
 struct BlockDevInfo
 {
+    std::string sysfs_path;     // Path in sysfs (without the /sys prefix)
     std::string path;           // Path to block device
     std::string partition_name; // Partition name (system, cache, data, etc.)
     int partition_num = -1;     // Partition number
@@ -36,4 +37,10 @@ void device_init(bool dry_run);
 void device_close();
 int get_device_fd();
 
-std::unordered_map<std::string, BlockDevInfo> get_block_dev_mappings();
+// Block devices seen by the uevent handler. The map is updated incrementally as
+// uevents arrive and is indexed by partition name.
+std::vector<BlockDevInfo> get_block_devs(unsigned int *generation = nullptr);
+bool wait_for_block_dev_by_name(const std::string &name,
+                                unsigned int timeout_ms);
+bool wait_for_block_devs_change(unsigned int generation,
+                                unsigned int timeout_ms);
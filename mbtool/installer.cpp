@@ -529,28 +529,45 @@ bool Installer::mount_efs() const
     return true;
 }
 
+/*!
+ * \brief Check an extracted file against its detached signature
+ */
+static bool verify_extracted_file(const util::ExtractInfo &info,
+                                  const void *data, size_t size,
+                                  void *userdata)
+{
+    (void) userdata;
+
+    std::string sig_path(info.to);
+    sig_path += ".sig";
+
+    SigVerifyResult result =
+            verify_signature_data(data, size, sig_path.c_str());
+    if (result != SigVerifyResult::Valid) {
+        LOGE("%s: Signature verification failed", info.to.c_str());
+        return false;
+    }
+
+    return true;
+}
+
 /*!
  * \brief Extract needed multiboot files from the patched zip file
  */
 bool Installer::extract_multiboot_files()
 {
+    // The signed files are verified in memory after the signatures and the
+    // unsigned files are extracted so that they only hit the disk if the
+    // signature is valid.
     std::vector<util::ExtractInfo> files{
         {
             "META-INF/com/google/android/update-binary.orig",
             _temp + "/updater"
         },
-        {
-            "META-INF/com/google/android/update-binary",
-            _temp + "/mbtool"
-        },
         {
             "META-INF/com/google/android/update-binary.sig",
             _temp + "/mbtool.sig"
         },
-        {
-            "multiboot/bb-wrapper.sh",
-            _temp + "/bb-wrapper.sh"
-        },
         {
             "multiboot/bb-wrapper.sh.sig",
             _temp + "/bb-wrapper.sh.sig"
@@ -563,49 +580,43 @@ bool Installer::extract_multiboot_files()
             "multiboot/info.prop",
             _temp + "/info.prop"
         },
+        {
+            "META-INF/com/google/android/update-binary",
+            _temp + "/mbtool",
+            true
+        },
+        {
+            "multiboot/bb-wrapper.sh",
+            _temp + "/bb-wrapper.sh",
+            true
+        },
     };
 
     std::vector<std::string> binaries{
         "file-contexts-tool",
-        "file-contexts-tool.sig",
         "fsck-wrapper",
-        "fsck-wrapper.sig",
         "mbtool",
-        "mbtool.sig",
         "mount.exfat",
-        "mount.exfat.sig",
     };
 
     for (auto const &binary : binaries) {
+        files.push_back({
+            "multiboot/binaries/" + binary + ".sig",
+            _temp + "/binaries/" + binary + ".sig"
+        });
         files.push_back({
             "multiboot/binaries/" + binary,
-            _temp + "/binaries/" + binary
+            _temp + "/binaries/" + binary,
+            true
         });
     }
 
-    if (!util::extract_files2(_zip_file, files)) {
+    if (!util::extract_files2_verified(_zip_file, files,
+                                       &verify_extracted_file, nullptr)) {
         LOGE("Failed to extract all multiboot files");
         return false;
     }
 
-    std::vector<std::string> sigcheck{
-        _temp + "/mbtool",
-        _temp + "/bb-wrapper.sh",
-        _temp + "/binaries/file-contexts-tool",
-        _temp + "/binaries/fsck-wrapper",
-        _temp + "/binaries/mbtool",
-        _temp + "/binaries/mount.exfat",
-    };
-
-    for (auto const &item : sigcheck) {
-        SigVerifyResult result =
-                verify_signature(item.c_str(), (item + ".sig").c_str());
-        if (result != SigVerifyResult::Valid) {
-            LOGE("%s: Signature verification failed", item.c_str());
-            return false;
-        }
-    }
-
     return true;
 }
 
@@ -1835,6 +1846,64 @@ Installer::ProceedState Installer::install_stage_unmount_filesystems()
     return on_unmounted_filesystems();
 }
 
+/*!
+ * \brief Describe everything the boot image ramdisk patchers depend on
+ *
+ * This is used as part of the key for the patched boot image cache.
+ */
+static bool get_boot_patch_id(const std::string &rom_id,
+                              const std::string &device_id,
+                              bool use_fuse_exfat,
+                              const std::string &temp_dir,
+                              std::string &patch_id_out)
+{
+    std::string patch_id = format("rom=%s\ndevice=%s\nfuse_exfat=%d\n",
+                                  rom_id.c_str(), device_id.c_str(),
+                                  use_fuse_exfat);
+
+    std::vector<std::string> files;
+    std::string binaries_dir(temp_dir);
+    binaries_dir += "/binaries";
+
+    DIR *dp = opendir(binaries_dir.c_str());
+    if (!dp) {
+        LOGE("%s: Failed to open directory: %s",
+             binaries_dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    while (struct dirent *ent = readdir(dp)) {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+            files.push_back(binaries_dir + "/" + ent->d_name);
+        }
+    }
+    closedir(dp);
+
+    std::sort(files.begin(), files.end());
+    files.push_back(temp_dir + "/device.json");
+
+    std::vector<util::Sha512Job> jobs(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        jobs[i].path = files[i];
+        jobs[i].read_data = false;
+    }
+
+    if (!util::sha512_hash_multiple(jobs, 0)) {
+        LOGE("Failed to compute sha512sums of boot image patcher inputs");
+        return false;
+    }
+
+    for (auto const &job : jobs) {
+        patch_id += job.path.substr(temp_dir.size());
+        patch_id += '=';
+        patch_id += util::hex_string(job.digest, SHA512_DIGEST_LENGTH);
+        patch_id += '\n';
+    }
+
+    patch_id_out.swap(patch_id);
+    return true;
+}
+
 Installer::ProceedState Installer::install_stage_finish()
 {
     LOGD("[Installer] Finalization stage");
@@ -1871,8 +1940,15 @@ Installer::ProceedState Installer::install_stage_finish()
         rps.push_back(rp_symlink_init());
         rps.push_back(rp_add_device_json(_temp + "/device.json"));
 
-        if (!InstallerUtil::patch_boot_image(_boot_block_dev, temp_boot_img,
-                                             rps)) {
+        std::string patch_id;
+        if (!get_boot_patch_id(_rom->id, _detected_device, _use_fuse_exfat,
+                               _temp, patch_id)) {
+            display_msg("Failed to compute boot image patch ID");
+            return ProceedState::Fail;
+        }
+
+        if (!InstallerUtil::patch_boot_image_cached(
+                _boot_block_dev, temp_boot_img, rps, patch_id, new_hash)) {
             display_msg("Failed to patch boot image");
             return ProceedState::Fail;
         }
@@ -1895,7 +1971,11 @@ Installer::ProceedState Installer::install_stage_finish()
             display_msg("Failed to flash patched boot image");
             return ProceedState::Fail;
         }
-        if (!util::copy_contents(temp_boot_img, path)) {
+
+        // Back up the boot image and compute its checksum in a single pass
+        unsigned char digest[SHA512_DIGEST_LENGTH];
+
+        if (!util::sha512_copy_contents(temp_boot_img, path, digest)) {
             LOGE("Failed to copy %s to %s: %s",
                  temp_boot_img.c_str(), path.c_str(),
                  strerror(errno));
@@ -1904,13 +1984,6 @@ Installer::ProceedState Installer::install_stage_finish()
         }
 
         // Update checksums
-        unsigned char digest[SHA512_DIGEST_LENGTH];
-
-        if (!util::sha512_hash(temp_boot_img, digest)) {
-            display_msg("Failed to compute sha512sum of new boot image");
-            return ProceedState::Fail;
-        }
-
         std::string hash = util::hex_string(digest, SHA512_DIGEST_LENGTH);
 
         std::unordered_map<std::string, std::string> props;
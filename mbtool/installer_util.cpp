@@ -19,292 +19,59 @@
 
 #include "installer_util.h"
 
+#include <algorithm>
 #include <memory>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
-#include <archive.h>
 #include <archive_entry.h>
 
+#include <openssl/sha.h>
+
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
 #include "mbbootimg/writer.h"
 
-#include "mbcommon/file.h"
-#include "mbcommon/file_util.h"
-#include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
-#include "mbcommon/optional.h"
-#include "mbcommon/string.h"
+#include "mbcommon/version.h"
 
 #include "mblog/logging.h"
 
-#include "mbutil/delete.h"
-#include "mbutil/path.h"
+#include "mbutil/copy.h"
+#include "mbutil/hash.h"
+#include "mbutil/string.h"
 
 #include "bootimg_util.h"
 #include "multiboot.h"
+#include "roms.h"
 
 #define LOG_TAG "mbtool/installer_util"
 
+#define BOOTIMG_CACHE_PARENT_DIR        "/data/multiboot"
+#define BOOTIMG_CACHE_DIR               "/data/multiboot/bootimg_cache"
+#define BOOTIMG_CACHE_MAX_ENTRIES       4
+
 using namespace mb::bootimg;
 
-typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
-typedef std::unique_ptr<archive_entry, decltype(archive_entry_free) *> ScopedArchiveEntry;
 typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
 
 namespace mb
 {
 
-bool InstallerUtil::unpack_ramdisk(const std::string &input_file,
-                                   const std::string &output_dir,
-                                   int &format_out,
-                                   std::vector<int> &filters_out)
-{
-    ScopedArchive ain(archive_read_new(), archive_read_free);
-    ScopedArchive aout(archive_write_disk_new(), archive_write_free);
-    archive_entry *entry;
-    std::string target_path;
-    int ret;
-
-    if (!ain || !aout) {
-        LOGE("Failed to allocate archive reader or writer instance");
-        return false;
-    }
-
-    archive_read_support_filter_gzip(ain.get());
-    archive_read_support_filter_lz4(ain.get());
-    archive_read_support_filter_lzma(ain.get());
-    archive_read_support_filter_xz(ain.get());
-    archive_read_support_format_cpio(ain.get());
-
-    // Set up disk writer parameters
-    archive_write_disk_set_standard_lookup(aout.get());
-    archive_write_disk_set_options(aout.get(),
-                                   ARCHIVE_EXTRACT_TIME
-                                 | ARCHIVE_EXTRACT_SECURE_SYMLINKS
-                                 | ARCHIVE_EXTRACT_SECURE_NODOTDOT
-                                 | ARCHIVE_EXTRACT_OWNER
-                                 | ARCHIVE_EXTRACT_PERM);
-
-    if (archive_read_open_filename(ain.get(), input_file.c_str(), 10240)
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    while (true) {
-        ret = archive_read_next_header(ain.get(), &entry);
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret == ARCHIVE_RETRY) {
-            continue;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read header: %s",
-                 input_file.c_str(), archive_error_string(ain.get()));
-            return false;
-        }
-
-        const char *path = archive_entry_pathname(entry);
-        if (!path || !*path) {
-            LOGE("%s: Header has null or empty filename", input_file.c_str());
-            return false;
-        }
-
-        // Build path
-        target_path = output_dir;
-        if (!target_path.empty() && target_path.back() != '/' && *path != '/') {
-            target_path += '/';
-        }
-        target_path += path;
-
-        archive_entry_set_pathname(entry, target_path.c_str());
-
-        // Extract file
-        ret = archive_read_extract2(ain.get(), entry, aout.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", archive_entry_pathname(entry),
-                 archive_error_string(ain.get()));
-            return false;
-        }
-    }
-
-    // Save format
-    format_out = archive_format(ain.get());
-    filters_out.clear();
-    for (int i = 0; i < archive_filter_count(ain.get()); ++i) {
-        int code = archive_filter_code(ain.get(), i);
-        if (code != ARCHIVE_FILTER_NONE) {
-            filters_out.push_back(code);
-        }
-    }
-
-    if (archive_read_close(ain.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    return true;
-}
-
-static int metadata_filter(archive *a, void *data, archive_entry *entry)
-{
-    (void) data;
-    (void) entry;
-
-    if (archive_read_disk_can_descend(a)) {
-        archive_read_disk_descend(a);
-    }
-    return 1;
-}
-
-bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
-                                 const std::string &output_file,
-                                 int format,
-                                 const std::vector<int> &filters)
-{
-    ScopedArchive ain(archive_read_disk_new(), archive_read_free);
-    ScopedArchive aout(archive_write_new(), archive_write_free);
-    ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
-    std::string full_path;
-    int ret;
-
-    if (!ain || !aout || !entry) {
-        LOGE("Failed to allocate archive reader, writer, or entry instance");
-        return false;
-    }
-
-    // Set up disk reader parameters
-    archive_read_disk_set_symlink_physical(ain.get());
-    archive_read_disk_set_metadata_filter_callback(
-            ain.get(), metadata_filter, nullptr);
-    // We don't want to look up usernames and group names on Android
-    //archive_read_disk_set_standard_lookup(in.get());
-
-    if (archive_write_set_format(aout.get(), format) != ARCHIVE_OK) {
-        LOGE("Failed to set output archive format: %s",
-             archive_error_string(aout.get()));
-        return false;
-    }
-    for (const int &filter : filters) {
-        if (archive_write_add_filter(aout.get(), filter) != ARCHIVE_OK) {
-            LOGE("Failed to add output archive filter: %s",
-                 archive_error_string(aout.get()));
-            return false;
-        }
-    }
-
-    archive_write_set_bytes_per_block(aout.get(), 512);
-
-    // Open output file
-    if (archive_write_open_filename(aout.get(), output_file.c_str())
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), archive_error_string(aout.get()));
-        return false;
-    }
-
-    ret = archive_read_disk_open(ain.get(), input_dir.c_str());
-    if (ret != ARCHIVE_OK) {
-        LOGE("%s: %s", input_dir.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    while (true) {
-        // libarchive doesn't clear the entry automatically
-        archive_entry_clear(entry.get());
-
-        ret = archive_read_next_header2(ain.get(), entry.get());
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read next header: %s", input_dir.c_str(),
-                 archive_error_string(ain.get()));
-            return false;
-        }
-
-        if (archive_entry_filetype(entry.get()) != AE_IFREG) {
-            archive_entry_set_size(entry.get(), 0);
-        }
-
-        const char *curpath = archive_entry_pathname(entry.get());
-        if (curpath && !input_dir.empty()) {
-            std::string relpath;
-            if (!util::relative_path(curpath, input_dir, relpath)) {
-                LOGE("Failed to compute relative path of %s starting at %s: %s",
-                     curpath, input_dir.c_str(), strerror(errno));
-                return false;
-            }
-            if (relpath.empty()) {
-                // If the relative path is empty, then the current path is
-                // the root of the directory tree. We don't need that, so
-                // skip it.
-                continue;
-            }
-            archive_entry_set_pathname(entry.get(), relpath.c_str());
-        }
-
-        ret = archive_write_header(aout.get(), entry.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", output_file.c_str(),
-                 archive_error_string(aout.get()));
-            return false;
-        }
-
-        char buf[10240];
-        la_ssize_t n;
-
-        if (archive_entry_size(entry.get()) > 0) {
-            while ((n = archive_read_data(ain.get(), buf, sizeof(buf))) > 0) {
-                if (archive_write_data(aout.get(), buf, static_cast<size_t>(n))
-                        != n) {
-                    LOGE("Failed to write archive entry data: %s",
-                         archive_error_string(aout.get()));
-                    return false;
-                }
-            }
-
-            if (n < 0) {
-                LOGE("Failed to read archive entry data: %s",
-                     archive_error_string(ain.get()));
-                return false;
-            }
-        }
-    }
-
-    archive_read_close(ain.get());
-
-    if (archive_write_close(aout.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", output_file.c_str(), archive_error_string(aout.get()));
-        return false;
-    }
-
-    return true;
-}
-
 bool InstallerUtil::patch_boot_image(const std::string &input_file,
                                      const std::string &output_file,
                                      std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
-    std::string tmpdir = format("%s.XXXXXX", output_file.c_str());
-
-    // std::string is guaranteed to be contiguous in C++11
-    if (!mkdtemp(&tmpdir[0])) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto delete_temp_dir = finally([&]{
-        util::delete_recursive(tmpdir);
-    });
-
     Reader reader;
     Writer writer;
     Header header;
@@ -392,47 +159,23 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
             }
 
             if (type == ENTRY_TYPE_RAMDISK) {
-                std::string ramdisk_in(tmpdir);
-                ramdisk_in += "/ramdisk.in";
-                std::string ramdisk_out(tmpdir);
-                ramdisk_out += "/ramdisk.out";
+                Ramdisk ramdisk;
 
-                auto delete_temp_files = finally([&]{
-                    unlink(ramdisk_in.c_str());
-                    unlink(ramdisk_out.c_str());
-                });
-
-                if (!bi_copy_data_to_file(reader, ramdisk_in)) {
+                if (!ramdisk.load(reader)) {
                     return false;
                 }
 
-                if (!patch_ramdisk(ramdisk_in, ramdisk_out, 0, rps)) {
-                    return false;
-                }
+                bool ret = patch_ramdisk(ramdisk, 0, rps);
 
-                if (!bi_copy_file_to_data(ramdisk_out, writer)) {
+                if (!ramdisk.save(writer)) {
                     return false;
                 }
-            } else if (type == ENTRY_TYPE_KERNEL) {
-                std::string kernel_in(tmpdir);
-                kernel_in += "/kernel.in";
-                std::string kernel_out(tmpdir);
-                kernel_out += "/kernel.out";
 
-                auto delete_temp_files = finally([&]{
-                    unlink(kernel_in.c_str());
-                    unlink(kernel_out.c_str());
-                });
-
-                if (!bi_copy_data_to_file(reader, kernel_in)) {
+                if (!ret) {
                     return false;
                 }
-
-                if (!patch_kernel_rkp(kernel_in, kernel_out)) {
-                    return false;
-                }
-
-                if (!bi_copy_file_to_data(kernel_out, writer)) {
+            } else if (type == ENTRY_TYPE_KERNEL) {
+                if (!patch_kernel_rkp(reader, writer)) {
                     return false;
                 }
             } else {
@@ -453,60 +196,213 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
     return true;
 }
 
-bool InstallerUtil::patch_ramdisk(const std::string &input_file,
-                                  const std::string &output_file,
-                                  unsigned int depth,
-                                  std::vector<std::function<RamdiskPatcherFn>> &rps)
+/*!
+ * \brief Get path to the cached patched boot image
+ *
+ * \return Path or empty string if the cache directory is not available
+ */
+static std::string get_boot_image_cache_path(
+        const unsigned char input_digest[SHA512_DIGEST_LENGTH],
+        const std::string &patch_id)
 {
-    if (depth > 1) {
-        LOGV("Ignoring doubly-nested ramdisk");
-        return true;
+    struct stat sb;
+    if (stat(get_raw_path(BOOTIMG_CACHE_PARENT_DIR).c_str(), &sb) < 0
+            || !S_ISDIR(sb.st_mode)) {
+        return {};
     }
 
-    std::string tmpdir = format("%s.XXXXXX", output_file.c_str());
+    const char *mbtool_version = version();
+    unsigned char digest[SHA512_DIGEST_LENGTH];
 
-    if (!mkdtemp(&tmpdir[0])) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
+    SHA512_CTX ctx;
+    SHA512_Init(&ctx);
+    SHA512_Update(&ctx, input_digest, SHA512_DIGEST_LENGTH);
+    SHA512_Update(&ctx, patch_id.data(), patch_id.size());
+    SHA512_Update(&ctx, mbtool_version, strlen(mbtool_version));
+    SHA512_Final(digest, &ctx);
+
+    std::string path = get_raw_path(BOOTIMG_CACHE_DIR);
+    path += '/';
+    path += util::hex_string(digest, sizeof(digest));
+    return path;
+}
+
+/*!
+ * \brief Remove the least recently used entries so that at most \p keep remain
+ */
+static void prune_boot_image_cache(const std::string &dir, size_t keep)
+{
+    std::vector<std::pair<time_t, std::string>> entries;
+
+    if (DIR *dp = opendir(dir.c_str())) {
+        while (struct dirent *ent = readdir(dp)) {
+            if (strcmp(ent->d_name, ".") == 0
+                    || strcmp(ent->d_name, "..") == 0) {
+                continue;
+            }
+
+            std::string path(dir);
+            path += '/';
+            path += ent->d_name;
+
+            struct stat sb;
+            if (stat(path.c_str(), &sb) == 0) {
+                entries.emplace_back(sb.st_mtime, std::move(path));
+            }
+        }
+        closedir(dp);
     }
 
-    auto delete_temp_dir = finally([&]{
-        util::delete_recursive(tmpdir);
+    if (entries.size() <= keep) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end());
+
+    for (size_t i = 0; i < entries.size() - keep; ++i) {
+        unlink(entries[i].second.c_str());
+    }
+}
+
+/*!
+ * \brief Store patched boot image in the cache
+ *
+ * The entry is written to a temporary file first so that an interrupted write
+ * is never mistaken for a valid entry. Failures are not fatal.
+ */
+static void store_cached_boot_image(const std::string &path,
+                                    const std::string &source)
+{
+    std::string dir = get_raw_path(BOOTIMG_CACHE_DIR);
+
+    if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+        LOGW("%s: Failed to create directory: %s",
+             dir.c_str(), strerror(errno));
+        return;
+    }
+
+    prune_boot_image_cache(dir, BOOTIMG_CACHE_MAX_ENTRIES - 1);
+
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_source < 0) {
+        LOGW("%s: Failed to open for reading: %s",
+             source.c_str(), strerror(errno));
+        return;
+    }
+
+    auto close_fd_source = finally([&] {
+        close(fd_source);
     });
 
-    int format;
-    std::vector<int> filters;
+    int fd_target = open(temp_path.c_str(),
+                         O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0600);
+    if (fd_target < 0) {
+        LOGW("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return;
+    }
 
-    // Extract ramdisk
-    if (!unpack_ramdisk(input_file, tmpdir, format, filters)) {
-        return false;
+    bool ok = util::copy_data_fd(fd_source, fd_target)
+            && fsync(fd_target) == 0;
+    if (close(fd_target) < 0) {
+        ok = false;
     }
 
-    // Patch ramdisk
-    std::string nested(tmpdir);
-    nested += "/sbin/ramdisk.cpio";
-    struct stat sb;
-    bool ret;
+    if (!ok || rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to write cached boot image: %s",
+             path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+    }
+}
+
+/*!
+ * \brief Patch boot image, reusing a previously patched result if possible
+ *
+ * Patched boot images are cached by the hash of the input boot image, the
+ * caller-provided \p patch_id and the mbtool version. \p patch_id must uniquely
+ * describe everything the ramdisk patchers in \p rps depend on.
+ *
+ * \param input_digest SHA512 digest of \p input_file or nullptr to compute it
+ */
+bool InstallerUtil::patch_boot_image_cached(const std::string &input_file,
+                                            const std::string &output_file,
+                                            std::vector<std::function<RamdiskPatcherFn>> &rps,
+                                            const std::string &patch_id,
+                                            const unsigned char *input_digest)
+{
+    unsigned char digest[SHA512_DIGEST_LENGTH];
 
-    if (stat(nested.c_str(), &sb) == 0) {
-        ret = patch_ramdisk(nested, nested, depth + 1, rps);
-    } else {
-        ret = patch_ramdisk_dir(tmpdir, rps);
+    if (input_digest) {
+        memcpy(digest, input_digest, sizeof(digest));
+    } else if (!util::sha512_hash(input_file, digest)) {
+        LOGW("%s: Failed to compute hash; not using cache",
+             input_file.c_str());
+        return patch_boot_image(input_file, output_file, rps);
     }
 
-    // Pack ramdisk
-    if (!pack_ramdisk(tmpdir, output_file, format, filters)) {
+    std::string cache_path = get_boot_image_cache_path(digest, patch_id);
+
+    if (!cache_path.empty()) {
+        struct stat sb;
+
+        if (stat(cache_path.c_str(), &sb) == 0) {
+            if (util::copy_contents(cache_path, output_file)) {
+                LOGD("Using cached patched boot image: %s",
+                     cache_path.c_str());
+
+                // Mark entry as recently used
+                utimensat(AT_FDCWD, cache_path.c_str(), nullptr, 0);
+                return true;
+            }
+
+            LOGW("%s: Failed to copy cached boot image: %s",
+                 cache_path.c_str(), strerror(errno));
+        }
+    }
+
+    if (!patch_boot_image(input_file, output_file, rps)) {
         return false;
     }
 
-    return ret;
+    if (!cache_path.empty()) {
+        store_cached_boot_image(cache_path, output_file);
+    }
+
+    return true;
 }
 
-bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                      std::vector<std::function<RamdiskPatcherFn>> &rps)
+bool InstallerUtil::patch_ramdisk(Ramdisk &ramdisk,
+                                  unsigned int depth,
+                                  std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
+    if (depth > 1) {
+        LOGV("Ignoring doubly-nested ramdisk");
+        return true;
+    }
+
+    // Patch ramdisk
+    auto nested = ramdisk.find("sbin/ramdisk.cpio");
+    if (nested && archive_entry_filetype(nested->entry.get()) == AE_IFREG) {
+        Ramdisk nested_ramdisk;
+
+        if (!nested_ramdisk.load(nested->data.data(), nested->data.size())) {
+            return false;
+        }
+
+        bool ret = patch_ramdisk(nested_ramdisk, depth + 1, rps);
+
+        if (!nested_ramdisk.save(nested->data)) {
+            return false;
+        }
+
+        return ret;
+    }
+
     for (auto const &rp : rps) {
-        if (!rp(ramdisk_dir)) {
+        if (!rp(ramdisk)) {
             return false;
         }
     }
@@ -514,8 +410,7 @@ bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
     return true;
 }
 
-bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
-                                     const std::string &output_file)
+bool InstallerUtil::patch_kernel_rkp(Reader &reader, Writer &writer)
 {
     // We'll use SuperSU's patch for negating the effects of
     // CONFIG_RKP_NS_PROT=y in newer Samsung kernels. This kernel feature
@@ -541,84 +436,18 @@ bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
         0x40, 0xB9, 0x1F, 0xA0, 0x0F, 0x71, 0x81, 0x01, 0x00, 0x54,
     };
 
-    StandardFile fin;
-    StandardFile fout;
-    optional<uint64_t> offset;
-
-    // Open input file
-    auto open_ret = fin.open(input_file, FileOpenMode::ReadOnly);
-    if (!open_ret) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), open_ret.error().message().c_str());
-        return false;
-    }
-
-    // Open output file
-    open_ret = fout.open(output_file, FileOpenMode::WriteOnly);
-    if (!open_ret) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), open_ret.error().message().c_str());
-        return false;
-    }
-
-    // Replace pattern
-    auto result_cb = [](File &file, void *userdata, uint64_t offset_)
-            -> oc::result<FileSearchAction> {
-        (void) file;
-        auto ptr = static_cast<optional<uint64_t> *>(userdata);
-        *ptr = offset_;
-        return FileSearchAction::Stop;
+    std::vector<BytePatch> patches{
+        { source_pattern, target_pattern, sizeof(source_pattern), 1, {} },
     };
 
-    auto search_ret = file_search(fin, -1, -1, 0, source_pattern,
-                                  sizeof(source_pattern), 1, result_cb,
-                                  &offset);
-    if (!search_ret) {
-        LOGE("%s: Error when searching for pattern: %s",
-             input_file.c_str(), search_ret.error().message().c_str());
-        return false;
-    }
-
-    // Copy data
-    auto seek_ret = fin.seek(0, SEEK_SET);
-    if (!seek_ret) {
-        LOGE("%s: Failed to seek to beginning: %s",
-             input_file.c_str(), seek_ret.error().message().c_str());
-        return false;
-    }
-
-    if (offset) {
-        LOGD("RKP pattern found at offset: 0x%" PRIx64, *offset);
-
-        if (!copy_file_to_file(fin, fout, *offset)) {
-            return false;
-        }
-
-        seek_ret = fin.seek(sizeof(source_pattern), SEEK_CUR);
-        if (!seek_ret) {
-            LOGE("%s: Failed to skip pattern: %s",
-                 input_file.c_str(), seek_ret.error().message().c_str());
-            return false;
-        }
-
-        auto ret = file_write_exact(fout, target_pattern,
-                                    sizeof(target_pattern));
-        if (!ret) {
-            LOGE("%s: Failed to write target pattern: %s",
-                 output_file.c_str(), ret.error().message().c_str());
-            return false;
-        }
-    }
-
-    if (!copy_file_to_file_eof(fin, fout)) {
+    // Replace pattern while copying the data
+    if (!bi_copy_data_to_data_patched(reader, writer, patches)) {
         return false;
     }
 
-    auto close_ret = fout.close();
-    if (!close_ret) {
-        LOGE("%s: Failed to close file: %s",
-             output_file.c_str(), close_ret.error().message().c_str());
-        return false;
+    if (!patches[0].offsets.empty()) {
+        LOGD("RKP pattern found at offset: 0x%" PRIx64,
+             patches[0].offsets[0]);
     }
 
     return true;
@@ -660,54 +489,4 @@ bool InstallerUtil::replace_file(const std::string &replace,
     return true;
 }
 
-bool InstallerUtil::copy_file_to_file(File &fin, File &fout, uint64_t to_copy)
-{
-    char buf[10240];
-
-    while (to_copy > 0) {
-        size_t to_read = static_cast<size_t>(
-                std::min<uint64_t>(to_copy, sizeof(buf)));
-
-        auto n = file_read_retry(fin, buf, to_read);
-        if (!n || n.value() != to_read) {
-            LOGE("Failed to read data: %s", n.error().message().c_str());
-            return false;
-        }
-
-        n = file_write_retry(fout, buf, to_read);
-        if (!n || n.value() != to_read) {
-            LOGE("Failed to write data: %s", n.error().message().c_str());
-            return false;
-        }
-
-        to_copy -= to_read;
-    }
-
-    return true;
-}
-
-bool InstallerUtil::copy_file_to_file_eof(File &fin, File &fout)
-{
-    char buf[10240];
-
-    while (true) {
-        auto n_read = file_read_retry(fin, buf, sizeof(buf));
-        if (!n_read) {
-            LOGE("Failed to read data: %s", n_read.error().message().c_str());
-            return false;
-        } else if (n_read.value() == 0) {
-            break;
-        }
-
-        auto n_written = file_write_retry(fout, buf, n_read.value());
-        if (!n_written || n_written.value() != n_read.value()) {
-            LOGE("Failed to write data: %s",
-                 n_written.error().message().c_str());
-            return false;
-        }
-    }
-
-    return true;
-}
-
 }
@@ -147,21 +147,25 @@ static void miniadbd_usage(FILE *stream)
     fprintf(stream,
             "Usage: miniadbd [OPTION]...\n\n"
             "Options:\n"
+            "  --tcp-port=PORT  Also listen for connections on 127.0.0.1:PORT\n"
             "  -h, --help       Display this help message\n");
 }
 
 int miniadbd_main(int argc, char *argv[])
 {
     int opt;
+    int tcp_port = 0;
 
     enum options {
         IGNORED_ROOT_SECLEVEL,
-        IGNORED_DEVICE_BANNER
+        IGNORED_DEVICE_BANNER,
+        OPT_TCP_PORT
     };
 
     static struct option long_options[] = {
         {"root_seclabel", required_argument, 0, IGNORED_ROOT_SECLEVEL},
         {"device_banner", required_argument, 0, IGNORED_DEVICE_BANNER},
+        {"tcp-port",      required_argument, 0, OPT_TCP_PORT},
         {"help",          no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
@@ -176,6 +180,16 @@ int miniadbd_main(int argc, char *argv[])
         case IGNORED_DEVICE_BANNER:
             printf("Ignoring --device_banner=%s\n", optarg);
             break;
+        case OPT_TCP_PORT: {
+            char *end;
+            long port = strtol(optarg, &end, 10);
+            if (!*optarg || *end || port <= 0 || port > 65535) {
+                fprintf(stderr, "Invalid port: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            tcp_port = static_cast<int>(port);
+            break;
+        }
         case 'h':
             miniadbd_usage(stdout);
             return EXIT_SUCCESS;
@@ -201,13 +215,23 @@ int miniadbd_main(int argc, char *argv[])
 
     init_transport_registration();
 
-    if (access(USB_ADB_PATH, F_OK) == 0 || access(USB_FFS_ADB_EP0, F_OK) == 0) {
+    bool have_usb = access(USB_ADB_PATH, F_OK) == 0
+            || access(USB_FFS_ADB_EP0, F_OK) == 0;
+
+    if (have_usb) {
         usb_init();
-        fdevent_loop();
     } else {
         LOGE("Failed to open either %s or %s", USB_ADB_PATH, USB_FFS_ADB_EP0);
     }
 
+    if (tcp_port > 0) {
+        local_init(tcp_port);
+    }
+
+    if (have_usb || tcp_port > 0) {
+        fdevent_loop();
+    }
+
     return EXIT_FAILURE;
 }
 
@@ -17,6 +17,8 @@
 #include "sysdeps.h"
 #include "adb.h"
 
+#include <algorithm>
+
 #include <cstdlib>
 #include <cstring>
 
@@ -58,11 +60,31 @@ void fatal_errno(const char *fmt, ...)
     exit(-1);
 }
 
+// apackets are large and one is needed for every message, so freed packets are
+// kept around for reuse instead of going back to the allocator
+#define APACKET_POOL_SIZE 32
+
+static pthread_mutex_t apacket_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static apacket *apacket_pool = nullptr;
+static size_t apacket_pool_count = 0;
+
 apacket* get_apacket(void)
 {
-    apacket* p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+    apacket* p = nullptr;
+
+    pthread_mutex_lock(&apacket_pool_lock);
+    if (apacket_pool) {
+        p = apacket_pool;
+        apacket_pool = p->next;
+        --apacket_pool_count;
+    }
+    pthread_mutex_unlock(&apacket_pool_lock);
+
     if (p == nullptr) {
-      fatal("failed to allocate an apacket");
+        p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+        if (p == nullptr) {
+          fatal("failed to allocate an apacket");
+        }
     }
 
     memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
@@ -71,6 +93,15 @@ apacket* get_apacket(void)
 
 void put_apacket(apacket *p)
 {
+    pthread_mutex_lock(&apacket_pool_lock);
+    if (apacket_pool_count < APACKET_POOL_SIZE) {
+        p->next = apacket_pool;
+        apacket_pool = p;
+        ++apacket_pool_count;
+        p = nullptr;
+    }
+    pthread_mutex_unlock(&apacket_pool_lock);
+
     free(p);
 }
 
@@ -180,7 +211,7 @@ void send_connect(atransport *t)
     apacket *cp = get_apacket();
     cp->msg.command = A_CNXN;
     cp->msg.arg0 = A_VERSION;
-    cp->msg.arg1 = MAX_PAYLOAD;
+    cp->msg.arg1 = t->max_payload;
     cp->msg.data_length = fill_connect_data((char *)cp->data,
                                             sizeof(cp->data));
     send_packet(cp, t);
@@ -263,6 +294,13 @@ void handle_packet(apacket *p, atransport *t)
             handle_offline(t);
         }
 
+        // Use the largest payload size supported by both sides
+        t->max_payload = std::min<size_t>(p->msg.arg1, MAX_PAYLOAD);
+        if (t->max_payload < MAX_PAYLOAD_V1) {
+            t->max_payload = MAX_PAYLOAD_V1;
+        }
+        ADB_LOGD(ADB_CONN, "negotiated max payload: %zu", t->max_payload);
+
         parse_banner(reinterpret_cast<const char*>(p->data), t);
 
         handle_online(t);
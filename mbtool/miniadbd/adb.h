@@ -19,7 +19,11 @@
 
 #include "fdevent.h"
 
-#define MAX_PAYLOAD 4096
+// Hosts that predate payload negotiation only support 4 KiB packets. Newer
+// hosts advertise their limit in the CNXN message and both sides use the
+// smaller of the two.
+#define MAX_PAYLOAD_V1 (4 * 1024)
+#define MAX_PAYLOAD (256 * 1024)
 
 #define A_SYNC 0x434e5953
 #define A_CNXN 0x4e584e43
@@ -151,6 +155,7 @@ struct  adisconnect
 */
 enum transport_type {
         kTransportUsb,
+        kTransportLocal,
         kTransportAny,
         kTransportHost,
 };
@@ -176,6 +181,9 @@ struct atransport
     int online;
     transport_type type;
 
+        /* negotiated maximum payload size (see MAX_PAYLOAD) */
+    size_t max_payload;
+
         /* usb handle or socket fd as needed */
     usb_handle *usb;
     int sfd;
@@ -242,6 +250,7 @@ void handle_packet(apacket *p, atransport *t);
 
 /* initialize a transport object's func pointers and state */
 void init_usb_transport(atransport *t, usb_handle *usb, int state);
+void init_socket_transport(atransport *t, int s, int port);
 
 int service_to_fd(const char *name);
 
@@ -269,6 +278,9 @@ int usb_read(usb_handle *h, void *data, int len);
 int usb_close(usb_handle *h);
 void usb_kick(usb_handle *h);
 
+/* loopback TCP server interface (for testing and benchmarking) */
+void local_init(int port);
+
 int connection_state(atransport *t);
 
 #define CS_ANY       -1
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Replacements for the device-only parts of miniadbd. This allows the
+// protocol code and the loopback TCP transport to run on a Linux host, where
+// there is no USB gadget and nothing should ever be rebooted.
+
+#include "sysdeps.h"
+#include "adb.h"
+
+#include <cerrno>
+
+#include "reboot.h"
+
+void usb_init()
+{
+}
+
+void usb_cleanup()
+{
+}
+
+int usb_write(usb_handle *h, const void *data, int len)
+{
+    (void) h;
+    (void) data;
+    (void) len;
+    errno = ENODEV;
+    return -1;
+}
+
+int usb_read(usb_handle *h, void *data, int len)
+{
+    (void) h;
+    (void) data;
+    (void) len;
+    errno = ENODEV;
+    return -1;
+}
+
+int usb_close(usb_handle *h)
+{
+    (void) h;
+    return 0;
+}
+
+void usb_kick(usb_handle *h)
+{
+    (void) h;
+}
+
+namespace mb
+{
+
+bool reboot_directly(const std::string &reboot_arg)
+{
+    (void) reboot_arg;
+    errno = ENOSYS;
+    return false;
+}
+
+}
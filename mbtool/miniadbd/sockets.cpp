@@ -323,9 +323,12 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
 
 
     if (ev & FDE_READ) {
+        // Fill packets up to the payload size negotiated with the host
+        size_t max_payload = (s->peer && s->peer->transport)
+                ? s->peer->transport->max_payload : MAX_PAYLOAD_V1;
         apacket *p = get_apacket();
         unsigned char *x = p->data;
-        size_t avail = MAX_PAYLOAD;
+        size_t avail = max_payload;
         int r;
         int is_eof = 0;
 
@@ -351,10 +354,10 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
         ADB_LOGD(ADB_SOCK,
                  "LS(%d): fd=%d post avail loop. r=%d is_eof=%d forced_eof=%d",
                  s->id, s->fd, r, is_eof, s->fde.force_eof);
-        if ((avail == MAX_PAYLOAD) || (s->peer == 0)) {
+        if ((avail == max_payload) || (s->peer == 0)) {
             put_apacket(p);
         } else {
-            p->len = MAX_PAYLOAD - avail;
+            p->len = max_payload - avail;
 
             r = s->peer->enqueue(s->peer, p);
             ADB_LOGD(ADB_SOCK, "LS(%d): fd=%d post peer->enqueue(). r=%d",
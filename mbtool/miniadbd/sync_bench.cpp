@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Pushes a file to and pulls it back from miniadbd's loopback TCP transport
+// through the sync service and reports the throughput of each direction. This
+// exercises the packet path, payload negotiation, the fdevent loop and
+// SYNC_DATA_MAX chunking without a USB connection.
+//
+// By default, miniadbd runs in-process, so the benchmark works on any Linux
+// host. With --external, it connects to an already running instance instead
+// (eg. "miniadbd --tcp-port=PORT" on a device with the port forwarded).
+//
+// Usage: miniadbd-sync-bench [--external] <port> <remote path> [<size in MiB>]
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "adb.h"
+#include "adb_log.h"
+#include "fdevent.h"
+#include "file_sync_service.h"
+#include "transport.h"
+
+#define LOCAL_ID 1
+
+static bool read_exactly(int fd, void *buf, size_t size)
+{
+    auto *ptr = static_cast<unsigned char *>(buf);
+    while (size > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(read(fd, ptr, size));
+        if (n <= 0) {
+            return false;
+        }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool write_exactly(int fd, const void *buf, size_t size)
+{
+    auto *ptr = static_cast<const unsigned char *>(buf);
+    while (size > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, ptr, size));
+        if (n <= 0) {
+            return false;
+        }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Minimal host side of the adb protocol with a single open stream
+class AdbStream
+{
+public:
+    AdbStream() : m_fd(-1), m_max_payload(MAX_PAYLOAD_V1), m_remote_id(0),
+                  m_rx_pos(0)
+    {
+    }
+
+    ~AdbStream()
+    {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    bool connect_tcp(int port)
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        // The server thread may not be listening yet
+        auto deadline = std::chrono::steady_clock::now()
+                + std::chrono::seconds(5);
+
+        for (;;) {
+            m_fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (m_fd < 0) {
+                fprintf(stderr, "socket: %s\n", strerror(errno));
+                return false;
+            }
+
+            int on = 1;
+            setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            if (connect(m_fd, reinterpret_cast<struct sockaddr *>(&addr),
+                        sizeof(addr)) == 0) {
+                break;
+            }
+
+            int saved_errno = errno;
+            close(m_fd);
+            m_fd = -1;
+
+            if (saved_errno != ECONNREFUSED
+                    || std::chrono::steady_clock::now() >= deadline) {
+                fprintf(stderr, "connect: %s\n", strerror(saved_errno));
+                return false;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        static const char banner[] = "host::";
+        if (!send_packet(A_CNXN, A_VERSION, MAX_PAYLOAD,
+                         banner, sizeof(banner))) {
+            return false;
+        }
+
+        amessage msg;
+        std::vector<unsigned char> data;
+        do {
+            if (!recv_packet(msg, data)) {
+                return false;
+            }
+        } while (msg.command != A_CNXN);
+
+        m_max_payload = std::min<size_t>(msg.arg1, MAX_PAYLOAD);
+        return true;
+    }
+
+    bool open(const char *service)
+    {
+        if (!send_packet(A_OPEN, LOCAL_ID, 0, service, strlen(service) + 1)) {
+            return false;
+        }
+
+        amessage msg;
+        std::vector<unsigned char> data;
+        if (!recv_packet(msg, data)) {
+            return false;
+        } else if (msg.command != A_OKAY) {
+            fprintf(stderr, "Failed to open service: %s\n", service);
+            return false;
+        }
+
+        m_remote_id = msg.arg0;
+        return true;
+    }
+
+    // Buffered so that sync headers and payloads share full-size packets
+    bool write(const void *buf, size_t size)
+    {
+        auto *ptr = static_cast<const unsigned char *>(buf);
+        m_tx.insert(m_tx.end(), ptr, ptr + size);
+
+        while (m_tx.size() >= m_max_payload) {
+            if (!send_data(m_tx.data(), m_max_payload)) {
+                return false;
+            }
+            m_tx.erase(m_tx.begin(), m_tx.begin() + m_max_payload);
+        }
+        return true;
+    }
+
+    bool flush()
+    {
+        if (!m_tx.empty()) {
+            if (!send_data(m_tx.data(), m_tx.size())) {
+                return false;
+            }
+            m_tx.clear();
+        }
+        return true;
+    }
+
+    bool read(void *buf, size_t size)
+    {
+        auto *ptr = static_cast<unsigned char *>(buf);
+
+        while (size > 0) {
+            if (m_rx_pos == m_rx.size()) {
+                m_rx.clear();
+                m_rx_pos = 0;
+                if (!recv_data()) {
+                    return false;
+                }
+                continue;
+            }
+
+            size_t n = std::min(size, m_rx.size() - m_rx_pos);
+            memcpy(ptr, m_rx.data() + m_rx_pos, n);
+            m_rx_pos += n;
+            ptr += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    size_t max_payload() const
+    {
+        return m_max_payload;
+    }
+
+private:
+    int m_fd;
+    size_t m_max_payload;
+    unsigned m_remote_id;
+    std::vector<unsigned char> m_tx;
+    std::vector<unsigned char> m_rx;
+    size_t m_rx_pos;
+
+    bool send_packet(unsigned command, unsigned arg0, unsigned arg1,
+                     const void *data, size_t size)
+    {
+        amessage msg;
+        msg.command = command;
+        msg.arg0 = arg0;
+        msg.arg1 = arg1;
+        msg.data_length = static_cast<unsigned>(size);
+        msg.data_check = 0;
+        msg.magic = command ^ 0xffffffff;
+
+        auto *ptr = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            msg.data_check += ptr[i];
+        }
+
+        return write_exactly(m_fd, &msg, sizeof(msg))
+                && write_exactly(m_fd, data, size);
+    }
+
+    bool recv_packet(amessage &msg, std::vector<unsigned char> &data)
+    {
+        if (!read_exactly(m_fd, &msg, sizeof(msg))) {
+            fprintf(stderr, "Connection closed\n");
+            return false;
+        }
+        if (msg.magic != (msg.command ^ 0xffffffff)
+                || msg.data_length > MAX_PAYLOAD) {
+            fprintf(stderr, "Invalid packet header\n");
+            return false;
+        }
+        data.resize(msg.data_length);
+        if (!read_exactly(m_fd, data.data(), data.size())) {
+            fprintf(stderr, "Connection closed\n");
+            return false;
+        }
+        if (msg.command == A_CLSE) {
+            fprintf(stderr, "Stream closed by remote\n");
+            return false;
+        }
+        return true;
+    }
+
+    // Sends one WRTE and waits for the OKAY that allows the next one. Data
+    // that arrives in the meantime is queued for read().
+    bool send_data(const void *data, size_t size)
+    {
+        if (!send_packet(A_WRTE, LOCAL_ID, m_remote_id, data, size)) {
+            return false;
+        }
+
+        amessage msg;
+        std::vector<unsigned char> buf;
+        for (;;) {
+            if (!recv_packet(msg, buf)) {
+                return false;
+            } else if (msg.command == A_OKAY) {
+                return true;
+            } else if (msg.command == A_WRTE) {
+                m_rx.insert(m_rx.end(), buf.begin(), buf.end());
+                if (!send_packet(A_OKAY, LOCAL_ID, m_remote_id, nullptr, 0)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    bool recv_data()
+    {
+        amessage msg;
+        std::vector<unsigned char> buf;
+        for (;;) {
+            if (!recv_packet(msg, buf)) {
+                return false;
+            } else if (msg.command == A_WRTE) {
+                m_rx.insert(m_rx.end(), buf.begin(), buf.end());
+                return send_packet(A_OKAY, LOCAL_ID, m_remote_id, nullptr, 0);
+            }
+        }
+    }
+};
+
+static bool sync_request(AdbStream &s, unsigned id, const std::string &path)
+{
+    syncmsg msg;
+    msg.req.id = id;
+    msg.req.namelen = static_cast<unsigned>(path.size());
+    return s.write(&msg.req, sizeof(msg.req))
+            && s.write(path.data(), path.size());
+}
+
+static bool sync_status(AdbStream &s)
+{
+    syncmsg msg;
+    if (!s.read(&msg.status, sizeof(msg.status))) {
+        return false;
+    }
+    if (msg.status.id != ID_OKAY) {
+        std::string reason(msg.status.msglen, '\0');
+        s.read(&reason[0], reason.size());
+        fprintf(stderr, "Remote error: %s\n", reason.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool push(AdbStream &s, const std::string &path,
+                 const std::vector<unsigned char> &data)
+{
+    if (!sync_request(s, ID_SEND, path + ",0644")) {
+        return false;
+    }
+
+    syncmsg msg;
+    for (size_t pos = 0; pos < data.size();) {
+        size_t n = std::min<size_t>(SYNC_DATA_MAX, data.size() - pos);
+        msg.data.id = ID_DATA;
+        msg.data.size = static_cast<unsigned>(n);
+        if (!s.write(&msg.data, sizeof(msg.data))
+                || !s.write(data.data() + pos, n)) {
+            return false;
+        }
+        pos += n;
+    }
+
+    msg.data.id = ID_DONE;
+    msg.data.size = 0;
+    return s.write(&msg.data, sizeof(msg.data)) && s.flush() && sync_status(s);
+}
+
+static bool pull(AdbStream &s, const std::string &path,
+                 std::vector<unsigned char> &data)
+{
+    if (!sync_request(s, ID_RECV, path) || !s.flush()) {
+        return false;
+    }
+
+    data.clear();
+
+    syncmsg msg;
+    for (;;) {
+        if (!s.read(&msg.data, sizeof(msg.data))) {
+            return false;
+        } else if (msg.data.id == ID_DONE) {
+            return true;
+        } else if (msg.data.id != ID_DATA) {
+            std::string reason(msg.data.size, '\0');
+            s.read(&reason[0], reason.size());
+            fprintf(stderr, "Remote error: %s\n", reason.c_str());
+            return false;
+        }
+
+        size_t old_size = data.size();
+        data.resize(old_size + msg.data.size);
+        if (!s.read(data.data() + old_size, msg.data.size)) {
+            return false;
+        }
+    }
+}
+
+static void start_miniadbd(int port)
+{
+    // Per-packet debug logging would dominate the measurements
+    adb_log_mask = ADB_SERV;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    init_transport_registration();
+    local_init(port);
+
+    std::thread(fdevent_loop).detach();
+}
+
+static double mib_per_sec(size_t size, std::chrono::steady_clock::duration d)
+{
+    double secs = std::chrono::duration<double>(d).count();
+    return static_cast<double>(size) / (1024.0 * 1024.0) / secs;
+}
+
+int main(int argc, char *argv[])
+{
+    bool external = argc > 1 && strcmp(argv[1], "--external") == 0;
+    if (external) {
+        --argc;
+        ++argv;
+    }
+
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: miniadbd-sync-bench [--external] <port> "
+                "<remote path> [<size in MiB>]\n");
+        return EXIT_FAILURE;
+    }
+
+    int port = atoi(argv[1]);
+    std::string path = argv[2];
+    size_t size_mib = argc == 4 ? strtoul(argv[3], nullptr, 10) : 256;
+
+    if (!external) {
+        start_miniadbd(port);
+    }
+
+    std::vector<unsigned char> data(size_mib * 1024 * 1024);
+    srand(1);
+    for (auto &b : data) {
+        b = static_cast<unsigned char>(rand());
+    }
+
+    AdbStream s;
+    if (!s.connect_tcp(port) || !s.open("sync:")) {
+        return EXIT_FAILURE;
+    }
+
+    printf("Negotiated max payload: %zu bytes\n", s.max_payload());
+
+    auto start = std::chrono::steady_clock::now();
+    if (!push(s, path, data)) {
+        fprintf(stderr, "Push failed\n");
+        return EXIT_FAILURE;
+    }
+    auto pushed = std::chrono::steady_clock::now();
+
+    std::vector<unsigned char> result;
+    if (!pull(s, path, result)) {
+        fprintf(stderr, "Pull failed\n");
+        return EXIT_FAILURE;
+    }
+    auto pulled = std::chrono::steady_clock::now();
+
+    // Politely end the sync session
+    sync_request(s, ID_QUIT, "");
+    s.flush();
+
+    printf("push: %zu MiB at %.1f MiB/s\n", size_mib,
+           mib_per_sec(data.size(), pushed - start));
+    printf("pull: %zu MiB at %.1f MiB/s\n", size_mib,
+           mib_per_sec(result.size(), pulled - pushed));
+
+    if (result != data) {
+        fprintf(stderr, "Pulled data does not match pushed data\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -643,6 +643,27 @@ void register_usb_transport(usb_handle *usb, const char *serial, const char *dev
     register_transport(t);
 }
 
+void register_socket_transport(int s, const char *serial, int port)
+{
+    atransport *t = reinterpret_cast<atransport*>(calloc(1, sizeof(atransport)));
+    if (t == nullptr) fatal("cannot allocate local atransport");
+    ADB_LOGD(ADB_TSPT, "transport: %p init'ing for socket %d (sn='%s')",
+             t, s, serial ? serial : "");
+    init_socket_transport(t, s, port);
+    if (serial) {
+        t->serial = strdup(serial);
+    }
+
+    pthread_mutex_lock(&transport_lock);
+    t->next = &pending_list;
+    t->prev = pending_list.prev;
+    t->next->prev = t;
+    t->prev->next = t;
+    pthread_mutex_unlock(&transport_lock);
+
+    register_transport(t);
+}
+
 /* this should only be used for transports with connection_state == CS_NOPERM */
 void unregister_usb_transport(usb_handle *usb)
 {
@@ -46,6 +46,8 @@ void register_usb_transport(usb_handle* h, const char* serial,
 /* this should only be used for transports with connection_state == CS_NOPERM */
 void unregister_usb_transport(usb_handle* usb);
 
+void register_socket_transport(int s, const char* serial, int port);
+
 int check_header(apacket* p);
 int check_data(apacket* p);
 
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2007 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sysdeps.h"
+#include "transport.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "adb_io.h"
+#include "adb_log.h"
+
+static int remote_read(apacket *p, atransport *t)
+{
+    if (!ReadFdExactly(t->sfd, &p->msg, sizeof(amessage))) {
+        ADB_LOGE(ADB_TSPT, "remote local: read terminated (message)");
+        return -1;
+    }
+
+    if (check_header(p)) {
+        ADB_LOGE(ADB_TSPT, "remote local: check_header failed");
+        return -1;
+    }
+
+    if (p->msg.data_length) {
+        if (!ReadFdExactly(t->sfd, p->data, p->msg.data_length)) {
+            ADB_LOGE(ADB_TSPT, "remote local: terminated (data)");
+            return -1;
+        }
+    }
+
+    if (check_data(p)) {
+        ADB_LOGE(ADB_TSPT, "remote local: check_data failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int remote_write(apacket *p, atransport *t)
+{
+    unsigned size = p->msg.data_length;
+
+    if (!WriteFdExactly(t->sfd, &p->msg, sizeof(amessage) + size)) {
+        ADB_LOGE(ADB_TSPT, "remote local: write terminated");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void remote_close(atransport *t)
+{
+    if (t->sfd >= 0) {
+        shutdown(t->sfd, SHUT_RDWR);
+        close(t->sfd);
+        t->sfd = -1;
+    }
+}
+
+static void remote_kick(atransport *t)
+{
+    if (t->sfd >= 0) {
+        shutdown(t->sfd, SHUT_RDWR);
+    }
+}
+
+void init_socket_transport(atransport *t, int s, int adb_port)
+{
+    ADB_LOGD(ADB_TSPT, "transport: local");
+    t->close = remote_close;
+    t->kick = remote_kick;
+    t->read_from_remote = remote_read;
+    t->write_to_remote = remote_write;
+    t->sync_token = 1;
+    t->connection_state = CS_OFFLINE;
+    t->type = kTransportLocal;
+    t->max_payload = MAX_PAYLOAD_V1;
+    t->sfd = s;
+    t->adb_port = adb_port;
+}
+
+static int local_server_socket(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    // Only listen on loopback. This transport exists for testing and
+    // benchmarking and is not authenticated.
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr),
+             sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    return fd;
+}
+
+static void *server_socket_thread(void *arg)
+{
+    int port = static_cast<int>(reinterpret_cast<uintptr_t>(arg));
+
+    ADB_LOGD(ADB_TSPT, "transport: server_socket_thread() starting");
+
+    int serverfd = -1;
+    for (;;) {
+        if (serverfd == -1) {
+            serverfd = local_server_socket(port);
+            if (serverfd < 0) {
+                ADB_LOGE(ADB_TSPT, "server: cannot bind socket to port %d: %s",
+                         port, strerror(errno));
+                adb_sleep_ms(1000);
+                continue;
+            }
+            close_on_exec(serverfd);
+        }
+
+        int fd = TEMP_FAILURE_RETRY(accept(serverfd, nullptr, nullptr));
+        if (fd >= 0) {
+            ADB_LOGD(ADB_TSPT, "server: new connection on fd %d", fd);
+            close_on_exec(fd);
+
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            register_socket_transport(fd, "host", port);
+        }
+    }
+
+    return nullptr;
+}
+
+void local_init(int port)
+{
+    ADB_LOGD(ADB_TSPT, "[ local_init - starting thread on port %d ]", port);
+    pthread_t tid;
+    if (adb_thread_create(&tid, server_socket_thread,
+                          reinterpret_cast<void *>(
+                                  static_cast<uintptr_t>(port)))) {
+        fatal_errno("cannot create local socket server thread");
+    }
+}
@@ -84,5 +84,6 @@ void init_usb_transport(atransport *t, usb_handle *h, int state)
     t->sync_token = 1;
     t->connection_state = state;
     t->type = kTransportUsb;
+    t->max_payload = MAX_PAYLOAD_V1;
     t->usb = h;
 }
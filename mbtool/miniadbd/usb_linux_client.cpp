@@ -16,6 +16,8 @@
 
 #include "sysdeps.h"
 
+#include <algorithm>
+
 #include <cstdlib>
 #include <cstring>
 
@@ -32,6 +34,13 @@
 #define MAX_PACKET_SIZE_HS      512
 #define MAX_PACKET_SIZE_SS      1024
 
+// The legacy f_adb driver rejects reads larger than its 4 KiB bulk buffer and
+// some FunctionFS implementations fail with very large transfers, so
+// negotiated payloads are split into chunks of these sizes
+#define USB_ADB_MAX_READ        4096
+#define USB_FFS_MAX_READ        16384
+#define USB_FFS_MAX_WRITE       16384
+
 #define cpu_to_le16(x)  htole16(x)
 #define cpu_to_le32(x)  htole32(x)
 
@@ -268,14 +277,17 @@ static int usb_adb_write(usb_handle *h, const void *data, int len)
 
 static int usb_adb_read(usb_handle *h, void *data, int len)
 {
-    int n;
-
     ADB_LOGD(ADB_USB, "about to read (fd=%d, len=%d)", h->fd, len);
-    n = adb_read(h->fd, data, len);
-    if (n != len) {
-        ADB_LOGE(ADB_USB, "ERROR: fd = %d, n = %d, errno = %d (%s)",
-                 h->fd, n, errno, strerror(errno));
-        return -1;
+    while (len > 0) {
+        int xfer = (len > USB_ADB_MAX_READ) ? USB_ADB_MAX_READ : len;
+        int n = adb_read(h->fd, data, xfer);
+        if (n != xfer) {
+            ADB_LOGE(ADB_USB, "ERROR: fd = %d, n = %d, errno = %d (%s)",
+                     h->fd, n, errno, strerror(errno));
+            return -1;
+        }
+        len -= xfer;
+        data = reinterpret_cast<char*>(data) + xfer;
     }
     ADB_LOGD(ADB_USB, "[ done fd=%d ]", h->fd);
     return 0;
@@ -442,7 +454,8 @@ static int bulk_write(int bulk_in, const uint8_t* buf, size_t length)
     int ret;
 
     do {
-        ret = adb_write(bulk_in, buf + count, length - count);
+        ret = adb_write(bulk_in, buf + count,
+                        std::min<size_t>(length - count, USB_FFS_MAX_WRITE));
         if (ret < 0) {
             if (errno != EINTR)
                 return ret;
@@ -474,7 +487,8 @@ static int bulk_read(int bulk_out, uint8_t* buf, size_t length)
     int ret;
 
     do {
-        ret = adb_read(bulk_out, buf + count, length - count);
+        ret = adb_read(bulk_out, buf + count,
+                       std::min<size_t>(length - count, USB_FFS_MAX_READ));
         if (ret < 0) {
             if (errno != EINTR) {
                 ADB_LOGE(ADB_USB,
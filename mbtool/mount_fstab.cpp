@@ -51,6 +51,7 @@
 #include "mbutil/properties.h"
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
+#include "mbutil/time.h"
 
 #include "multiboot.h"
 #include "reboot.h"
@@ -80,6 +81,57 @@ using namespace mb::device;
 namespace mb
 {
 
+/*!
+ * \brief Wait for a block device to appear
+ *
+ * If \a path is a by-name symlink, the uevent handler's block device map is
+ * used to wake up as soon as a partition with that name is registered instead
+ * of on the next stat() poll. The map only knows about raw PARTNAME values,
+ * which don't necessarily match the symlink name (eg. sanitized names or MTD
+ * names), so the map is only waited on in short slices and the path itself is
+ * checked after every wakeup.
+ */
+static bool wait_for_block_device(const std::string &path,
+                                  unsigned int timeout_ms)
+{
+    static const char by_name[] = "/by-name/";
+    static const unsigned int slice_ms = 50;
+
+    uint64_t deadline = util::current_time_ms() + timeout_ms;
+
+    // The map is only populated if our uevent handler is running
+    size_t pos = path.rfind(by_name);
+    bool use_map = get_device_fd() >= 0 && pos != std::string::npos;
+    std::string name;
+    if (use_map) {
+        name = path.substr(pos + sizeof(by_name) - 1);
+    }
+
+    while (true) {
+        if (util::path_exists(path, true)) {
+            return true;
+        }
+
+        uint64_t now = util::current_time_ms();
+        if (now >= deadline) {
+            return false;
+        }
+
+        unsigned int remaining = static_cast<unsigned int>(deadline - now);
+
+        // Once the map has the name (possibly a partition with the same name
+        // on another device), it can't tell us anything more, so just poll the
+        // path for the rest of the timeout
+        if (!use_map || wait_for_block_dev_by_name(
+                name, std::min(remaining, slice_ms))) {
+            now = util::current_time_ms();
+            return util::wait_for_path(
+                    path, now < deadline
+                            ? static_cast<unsigned int>(deadline - now) : 0);
+        }
+    }
+}
+
 /*!
  * \brief Try mounting each entry in a list of fstab entry until one works.
  *
@@ -119,7 +171,7 @@ static bool create_dir_and_mount(const std::vector<util::FstabRec> &recs,
         if (rec.fs_mgr_flags & util::MF_WAIT) {
             LOGD("%s: Waiting up to 20 seconds for block device",
                  rec.blk_device.c_str());
-            util::wait_for_path(rec.blk_device, 20 * 1000);
+            wait_for_block_device(rec.blk_device, 20 * 1000);
         }
 
         // Try mounting
@@ -476,15 +528,19 @@ static bool mount_extsd_fstab_entries(const std::vector<util::FstabRec> &extsd_r
     }
 
     // We can't wait for a block device path to appear since we don't know the
-    // block device path. Thus, we'll match the paths a number of times with a
-    // delay between each attempt.
-    static const int max_attempts = 10;
+    // block device path. Thus, we'll match the paths again whenever the set of
+    // block devices changes until the deadline passes. Unrelated devices (eg.
+    // loop, dm, or zram devices) also cause wakeups, so a bounded number of
+    // attempts could run out long before a slow SD card is detected.
+    static const unsigned int timeout_ms = 10 * 1000;
+
+    uint64_t deadline = util::current_time_ms() + timeout_ms;
 
-    for (int i = 0; i < max_attempts; ++i) {
-        LOGV("[Attempt %d/%d] Finding and mounting external SD",
-             i + 1, max_attempts);
+    for (int attempt = 1; ; ++attempt) {
+        LOGV("[Attempt %d] Finding and mounting external SD", attempt);
 
-        auto devices_map = get_block_dev_mappings();
+        unsigned int generation;
+        auto devices = get_block_devs(&generation);
 
         for (const util::FstabRec &rec : extsd_recs) {
             std::vector<std::string> patterns =
@@ -494,10 +550,9 @@ static bool mount_extsd_fstab_entries(const std::vector<util::FstabRec> &extsd_r
             for (const std::string &pattern : patterns) {
                 LOGD("Matching devices against pattern: %s", pattern.c_str());
 
-                for (auto const &pair : devices_map) {
-                    const BlockDevInfo &info = pair.second;
-
-                    if (path_matches(pair.first.c_str(), pattern.c_str())) {
+                for (const BlockDevInfo &info : devices) {
+                    if (path_matches(info.sysfs_path.c_str(),
+                                     pattern.c_str())) {
                         LOGV("Matched external SD block dev: "
                              "major=%d; minor=%d; name=%s; number=%d; path=%s",
                              info.major, info.minor, info.partition_name.c_str(),
@@ -518,16 +573,24 @@ static bool mount_extsd_fstab_entries(const std::vector<util::FstabRec> &extsd_r
             }
         }
 
-        if (i < max_attempts - 1) {
-            LOGW("No external SD patterns were matched; waiting 1 second");
-            sleep(1);
+        uint64_t now = util::current_time_ms();
+        if (now >= deadline) {
+            LOGE("No external SD patterns were matched after %u ms "
+                 "(%d attempts)", timeout_ms, attempt);
+            return false;
         }
-    }
 
-    LOGE("No external SD patterns were matched after %d attempts",
-         max_attempts);
+        if (attempt == 1) {
+            LOGW("No external SD patterns were matched; waiting up to %u ms "
+                 "for new block devices", timeout_ms);
+        }
 
-    return false;
+        // Retry at least once a second in case a matched device failed to
+        // mount because it wasn't ready yet
+        wait_for_block_devs_change(
+                generation, static_cast<unsigned int>(
+                        std::min<uint64_t>(deadline - now, 1000)));
+    }
 }
 
 static bool mount_target(const char *source, const char *target, bool bind)
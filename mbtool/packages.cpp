@@ -19,8 +19,6 @@
 
 #include "packages.h"
 
-#include <algorithm>
-
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
@@ -96,9 +94,15 @@ static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
                            std::shared_ptr<Package> pkg);
 static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
                            std::shared_ptr<Package> pkg);
+static bool parse_package_attrs(pugi::xml_node node, Package *pkg);
 static bool parse_tag_package(pugi::xml_node node, Packages *pkgs);
 static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs);
 
+// Only elements and their attributes are used, so don't bother creating nodes
+// for anything else or normalizing whitespace
+static constexpr unsigned int PARSE_OPTIONS =
+        pugi::parse_minimal | pugi::parse_escapes;
+
 
 Package::Package() :
         name(),
@@ -311,16 +315,27 @@ void Package::dump()
 #undef DUMP_PRIVATE_FLAG_IF_SET
 }
 
+static bool load_document(const std::string &path, pugi::xml_document &doc)
+{
+    pugi::xml_parse_result result = doc.load_file(path.c_str(), PARSE_OPTIONS);
+    if (!result) {
+        LOGE("Failed to parse XML file: %s: %s",
+             path.c_str(), result.description());
+        return false;
+    }
+
+    return true;
+}
+
 bool Packages::load_xml(const std::string &path)
 {
     pkgs.clear();
     sigs.clear();
+    m_by_uid.clear();
+    m_by_name.clear();
 
     pugi::xml_document doc;
-    pugi::xml_parse_result result = doc.load_file(path.c_str());
-    if (!result) {
-        LOGE("Failed to parse XML file: %s: %s",
-             path.c_str(), result.description());
+    if (!load_document(path, doc)) {
         return false;
     }
 
@@ -343,6 +358,47 @@ bool Packages::load_xml(const std::string &path)
     return true;
 }
 
+/*!
+ * \brief Parse only the \<package\> attributes in packages.xml
+ *
+ * Unlike load_xml(), this does not allocate a Package for every package, index
+ * the packages, or parse their signatures. \p callback is called for each
+ * \<package\> tag with a Package that is only valid during the call.
+ */
+bool Packages::scan_xml(const std::string &path,
+                        const std::function<void(const Package &)> &callback)
+{
+    pugi::xml_document doc;
+    if (!load_document(path, doc)) {
+        return false;
+    }
+
+    pugi::xml_node root = doc.child(TAG_PACKAGES);
+
+    for (pugi::xml_node cur_node : root.children(TAG_PACKAGE)) {
+        Package pkg;
+
+        if (!parse_package_attrs(cur_node, &pkg)) {
+            return false;
+        }
+
+        callback(pkg);
+    }
+
+    return true;
+}
+
+void Packages::add(std::shared_ptr<Package> pkg)
+{
+    // Keep the first match, like the linear search that this replaces
+    if (!pkg->is_shared_user) {
+        m_by_uid.emplace(static_cast<uid_t>(pkg->user_id), pkg);
+    }
+    m_by_name.emplace(pkg->name, pkg);
+
+    pkgs.push_back(std::move(pkg));
+}
+
 static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
                            std::shared_ptr<Package> pkg)
 {
@@ -411,12 +467,10 @@ static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
     return true;
 }
 
-static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
+static bool parse_package_attrs(pugi::xml_node node, Package *pkg)
 {
     assert(strcmp(node.name(), TAG_PACKAGE) == 0);
 
-    std::shared_ptr<Package> pkg(new Package());
-
     for (pugi::xml_attribute attr : node.attributes()) {
         const pugi::char_t *name = attr.name();
         const pugi::char_t *value = attr.value();
@@ -508,6 +562,17 @@ static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
         }
     }
 
+    return true;
+}
+
+static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
+{
+    std::shared_ptr<Package> pkg(new Package());
+
+    if (!parse_package_attrs(node, pkg.get())) {
+        return false;
+    }
+
     for (pugi::xml_node cur_node : node.children()) {
         if (cur_node.type() != pugi::xml_node_type::node_element) {
             continue;
@@ -531,7 +596,7 @@ static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
         }
     }
 
-    pkgs->pkgs.push_back(std::move(pkg));
+    pkgs->add(std::move(pkg));
 
     return true;
 }
@@ -571,20 +636,14 @@ static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs)
 
 std::shared_ptr<Package> Packages::find_by_uid(uid_t uid) const
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return !pkg->is_shared_user && pkg->user_id == static_cast<int>(uid);
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = m_by_uid.find(uid);
+    return it == m_by_uid.end() ? std::shared_ptr<Package>() : it->second;
 }
 
 std::shared_ptr<Package> Packages::find_by_pkg(const std::string &pkg_id) const
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return pkg->name == pkg_id;
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = m_by_name.find(pkg_id);
+    return it == m_by_name.end() ? std::shared_ptr<Package>() : it->second;
 }
 
 }
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -172,13 +173,24 @@ MB_DECLARE_OPERATORS_FOR_FLAGS(Package::PrivateFlags)
 class Packages
 {
 public:
+    // Populated by load_xml(). Use add() to add packages or the lookup indexes
+    // will be out of sync.
     std::vector<std::shared_ptr<Package>> pkgs;
     std::unordered_map<std::string, std::string> sigs;
 
     bool load_xml(const std::string &path);
 
+    static bool scan_xml(const std::string &path,
+                         const std::function<void(const Package &)> &callback);
+
+    void add(std::shared_ptr<Package> pkg);
+
     std::shared_ptr<Package> find_by_uid(uid_t uid) const;
     std::shared_ptr<Package> find_by_pkg(const std::string &pkg_id) const;
+
+private:
+    std::unordered_map<uid_t, std::shared_ptr<Package>> m_by_uid;
+    std::unordered_map<std::string, std::shared_ptr<Package>> m_by_name;
 };
 
 }
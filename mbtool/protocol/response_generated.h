@@ -323,7 +323,8 @@ inline flatbuffers::Offset<Unsupported> CreateUnsupported(
 struct Response FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_RESPONSE_TYPE = 4,
-    VT_RESPONSE = 6
+    VT_RESPONSE = 6,
+    VT_ID = 8
   };
   ResponseType response_type() const {
     return static_cast<ResponseType>(GetField<uint8_t>(VT_RESPONSE_TYPE, 0));
@@ -331,11 +332,15 @@ struct Response FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const void *response() const {
     return GetPointer<const void *>(VT_RESPONSE);
   }
+  uint64_t id() const {
+    return GetField<uint64_t>(VT_ID, 0);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_RESPONSE_TYPE) &&
            VerifyField<flatbuffers::uoffset_t>(verifier, VT_RESPONSE) &&
            VerifyResponseType(verifier, response(), response_type()) &&
+           VerifyField<uint64_t>(verifier, VT_ID) &&
            verifier.EndTable();
   }
 };
@@ -349,13 +354,16 @@ struct ResponseBuilder {
   void add_response(flatbuffers::Offset<void> response) {
     fbb_.AddOffset(Response::VT_RESPONSE, response);
   }
+  void add_id(uint64_t id) {
+    fbb_.AddElement<uint64_t>(Response::VT_ID, id, 0);
+  }
   ResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
   }
   ResponseBuilder &operator=(const ResponseBuilder &);
   flatbuffers::Offset<Response> Finish() {
-    const auto end = fbb_.EndTable(start_, 2);
+    const auto end = fbb_.EndTable(start_, 3);
     auto o = flatbuffers::Offset<Response>(end);
     return o;
   }
@@ -364,8 +372,10 @@ struct ResponseBuilder {
 inline flatbuffers::Offset<Response> CreateResponse(
     flatbuffers::FlatBufferBuilder &_fbb,
     ResponseType response_type = ResponseType_NONE,
-    flatbuffers::Offset<void> response = 0) {
+    flatbuffers::Offset<void> response = 0,
+    uint64_t id = 0) {
   ResponseBuilder builder_(_fbb);
+  builder_.add_id(id);
   builder_.add_response(response);
   builder_.add_response_type(response_type);
   return builder_.Finish();
@@ -0,0 +1,499 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ramdisk.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbtool/ramdisk"
+
+#define BUF_SIZE    10240
+
+using namespace mb::bootimg;
+
+namespace mb
+{
+
+typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
+
+struct ReaderCtx
+{
+    Reader *reader;
+    char buf[BUF_SIZE];
+};
+
+static la_ssize_t reader_read_cb(archive *a, void *userdata,
+                                 const void **buffer)
+{
+    auto ctx = static_cast<ReaderCtx *>(userdata);
+    size_t n;
+
+    if (!ctx->reader->read_data(ctx->buf, sizeof(ctx->buf), n)) {
+        archive_set_error(a, EIO, "Failed to read entry data: %s",
+                          ctx->reader->error_string().c_str());
+        return -1;
+    }
+
+    *buffer = ctx->buf;
+    return static_cast<la_ssize_t>(n);
+}
+
+static la_ssize_t writer_write_cb(archive *a, void *userdata,
+                                  const void *buffer, size_t length)
+{
+    auto writer = static_cast<Writer *>(userdata);
+    size_t n;
+
+    if (!writer->write_data(buffer, length, n) || n != length) {
+        archive_set_error(a, EIO, "Failed to write entry data: %s",
+                          writer->error_string().c_str());
+        return -1;
+    }
+
+    return static_cast<la_ssize_t>(n);
+}
+
+static la_ssize_t string_write_cb(archive *a, void *userdata,
+                                  const void *buffer, size_t length)
+{
+    (void) a;
+    auto str = static_cast<std::string *>(userdata);
+
+    str->append(static_cast<const char *>(buffer), length);
+    return static_cast<la_ssize_t>(length);
+}
+
+static void set_up_reader(archive *a)
+{
+    archive_read_support_filter_gzip(a);
+    archive_read_support_filter_lz4(a);
+    archive_read_support_filter_lzma(a);
+    archive_read_support_filter_xz(a);
+    archive_read_support_format_cpio(a);
+}
+
+static bool set_up_writer(archive *a, int format,
+                          const std::vector<int> &filters)
+{
+    if (archive_write_set_format(a, format) != ARCHIVE_OK) {
+        LOGE("Failed to set output archive format: %s",
+             archive_error_string(a));
+        return false;
+    }
+    for (const int &filter : filters) {
+        if (archive_write_add_filter(a, filter) != ARCHIVE_OK) {
+            LOGE("Failed to add output archive filter: %s",
+                 archive_error_string(a));
+            return false;
+        }
+    }
+
+    archive_write_set_bytes_per_block(a, 512);
+
+    return true;
+}
+
+/*!
+ * \brief Strip leading "/" and "./" components and trailing slashes
+ */
+static std::string normalize(const std::string &path)
+{
+    size_t begin = 0;
+    size_t end = path.size();
+
+    while (begin < end) {
+        if (path[begin] == '/') {
+            ++begin;
+        } else if (path[begin] == '.' && begin + 1 < end
+                && path[begin + 1] == '/') {
+            begin += 2;
+        } else {
+            break;
+        }
+    }
+
+    while (end > begin && path[end - 1] == '/') {
+        --end;
+    }
+
+    return path.substr(begin, end - begin);
+}
+
+static std::string parent_path(const std::string &path)
+{
+    auto pos = path.rfind('/');
+    return pos == std::string::npos ? std::string() : path.substr(0, pos);
+}
+
+Ramdisk::Ramdisk()
+    : m_format(ARCHIVE_FORMAT_CPIO_SVR4_NOCRC)
+{
+}
+
+bool Ramdisk::load(Reader &reader)
+{
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    if (!a) {
+        LOGE("Failed to allocate archive reader instance");
+        return false;
+    }
+
+    std::unique_ptr<ReaderCtx> ctx(new ReaderCtx());
+    ctx->reader = &reader;
+
+    set_up_reader(a.get());
+
+    if (archive_read_open(a.get(), ctx.get(), nullptr, &reader_read_cb,
+                          nullptr) != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for reading: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    return load_archive(a.get(), "ramdisk");
+}
+
+bool Ramdisk::load(const void *data, size_t size)
+{
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    if (!a) {
+        LOGE("Failed to allocate archive reader instance");
+        return false;
+    }
+
+    set_up_reader(a.get());
+
+    if (archive_read_open_memory(a.get(), const_cast<void *>(data), size)
+            != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for reading: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    return load_archive(a.get(), "nested ramdisk");
+}
+
+bool Ramdisk::load_archive(archive *a, const char *name)
+{
+    archive_entry *entry;
+    int ret;
+
+    m_nodes.clear();
+
+    while (true) {
+        ret = archive_read_next_header(a, &entry);
+        if (ret == ARCHIVE_EOF) {
+            break;
+        } else if (ret == ARCHIVE_RETRY) {
+            continue;
+        } else if (ret != ARCHIVE_OK) {
+            LOGE("%s: Failed to read header: %s",
+                 name, archive_error_string(a));
+            return false;
+        }
+
+        const char *path = archive_entry_pathname(entry);
+        if (!path || !*path) {
+            LOGE("%s: Header has null or empty filename", name);
+            return false;
+        }
+
+        Node node{{archive_entry_clone(entry), archive_entry_free}, {}};
+        if (!node.entry) {
+            LOGE("%s: Failed to allocate entry", name);
+            return false;
+        }
+
+        if (archive_entry_filetype(entry) == AE_IFREG
+                && archive_entry_size(entry) > 0) {
+            node.data.resize(static_cast<size_t>(archive_entry_size(entry)));
+
+            size_t total = 0;
+            while (total < node.data.size()) {
+                la_ssize_t n = archive_read_data(
+                        a, &node.data[total], node.data.size() - total);
+                if (n < 0) {
+                    LOGE("%s: %s: Failed to read data: %s",
+                         name, path, archive_error_string(a));
+                    return false;
+                } else if (n == 0) {
+                    LOGE("%s: %s: Unexpected end of data", name, path);
+                    return false;
+                }
+                total += static_cast<size_t>(n);
+            }
+        }
+
+        m_nodes.push_back(std::move(node));
+    }
+
+    // Save format
+    m_format = archive_format(a);
+    m_filters.clear();
+    for (int i = 0; i < archive_filter_count(a); ++i) {
+        int code = archive_filter_code(a, i);
+        if (code != ARCHIVE_FILTER_NONE) {
+            m_filters.push_back(code);
+        }
+    }
+
+    if (archive_read_close(a) != ARCHIVE_OK) {
+        LOGE("%s: %s", name, archive_error_string(a));
+        return false;
+    }
+
+    return true;
+}
+
+bool Ramdisk::save(Writer &writer) const
+{
+    ScopedArchive a(archive_write_new(), archive_write_free);
+    if (!a) {
+        LOGE("Failed to allocate archive writer instance");
+        return false;
+    }
+
+    if (!set_up_writer(a.get(), m_format, m_filters)) {
+        return false;
+    }
+
+    if (archive_write_open(a.get(), &writer, nullptr, &writer_write_cb,
+                           nullptr) != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for writing: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    return save_archive(a.get(), "ramdisk");
+}
+
+bool Ramdisk::save(std::string &out) const
+{
+    ScopedArchive a(archive_write_new(), archive_write_free);
+    if (!a) {
+        LOGE("Failed to allocate archive writer instance");
+        return false;
+    }
+
+    if (!set_up_writer(a.get(), m_format, m_filters)) {
+        return false;
+    }
+
+    std::string buf;
+
+    if (archive_write_open(a.get(), &buf, nullptr, &string_write_cb,
+                           nullptr) != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for writing: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    if (!save_archive(a.get(), "nested ramdisk")) {
+        return false;
+    }
+
+    out.swap(buf);
+    return true;
+}
+
+bool Ramdisk::save_archive(archive *a, const char *name) const
+{
+    for (auto const &node : m_nodes) {
+        archive_entry *entry = node.entry.get();
+
+        // The contents may have been modified by a patcher
+        if (archive_entry_filetype(entry) == AE_IFREG) {
+            archive_entry_set_size(entry, static_cast<la_int64_t>(
+                    node.data.size()));
+        } else {
+            archive_entry_set_size(entry, 0);
+        }
+
+        if (archive_write_header(a, entry) != ARCHIVE_OK) {
+            LOGE("%s: %s: %s", name, archive_entry_pathname(entry),
+                 archive_error_string(a));
+            return false;
+        }
+
+        if (!node.data.empty() && archive_write_data(
+                a, node.data.data(), node.data.size())
+                != static_cast<la_ssize_t>(node.data.size())) {
+            LOGE("%s: %s: Failed to write data: %s",
+                 name, archive_entry_pathname(entry), archive_error_string(a));
+            return false;
+        }
+    }
+
+    if (archive_write_close(a) != ARCHIVE_OK) {
+        LOGE("%s: %s", name, archive_error_string(a));
+        return false;
+    }
+
+    return true;
+}
+
+Ramdisk::Node * Ramdisk::find(const std::string &path)
+{
+    return const_cast<Node *>(static_cast<const Ramdisk *>(this)->find(path));
+}
+
+const Ramdisk::Node * Ramdisk::find(const std::string &path) const
+{
+    std::string needle = normalize(path);
+
+    for (auto const &node : m_nodes) {
+        if (normalize(archive_entry_pathname(node.entry.get())) == needle) {
+            return &node;
+        }
+    }
+
+    return nullptr;
+}
+
+bool Ramdisk::exists(const std::string &path) const
+{
+    return find(path) != nullptr;
+}
+
+bool Ramdisk::read_link(const std::string &path, std::string &target) const
+{
+    auto node = find(path);
+    if (!node || archive_entry_filetype(node->entry.get()) != AE_IFLNK) {
+        return false;
+    }
+
+    const char *link = archive_entry_symlink(node->entry.get());
+    if (!link) {
+        return false;
+    }
+
+    target = link;
+    return true;
+}
+
+Ramdisk::Node & Ramdisk::new_node(const std::string &path, mode_t type,
+                                  mode_t perm)
+{
+    // newc archives store the inode number as-is and the kernel uses it to
+    // detect hard links, so make sure new entries don't collide
+    la_int64_t ino = 0;
+    for (auto const &node : m_nodes) {
+        ino = std::max(ino, archive_entry_ino64(node.entry.get()));
+    }
+
+    Node node{{archive_entry_new(), archive_entry_free}, {}};
+    archive_entry_set_pathname(node.entry.get(), path.c_str());
+    archive_entry_set_filetype(node.entry.get(), type);
+    archive_entry_set_perm(node.entry.get(), perm);
+    archive_entry_set_uid(node.entry.get(), 0);
+    archive_entry_set_gid(node.entry.get(), 0);
+    archive_entry_set_nlink(node.entry.get(), 1);
+    archive_entry_set_ino64(node.entry.get(), ino + 1);
+    archive_entry_set_mtime(node.entry.get(), time(nullptr), 0);
+
+    m_nodes.push_back(std::move(node));
+    return m_nodes.back();
+}
+
+bool Ramdisk::set_file(const std::string &path, std::string data, mode_t perm)
+{
+    std::string normalized = normalize(path);
+    std::string parent = parent_path(normalized);
+
+    if (!parent.empty() && !exists(parent)) {
+        LOGE("%s: Parent directory does not exist", normalized.c_str());
+        return false;
+    }
+
+    Node *node = find(normalized);
+    if (node) {
+        archive_entry_set_filetype(node->entry.get(), AE_IFREG);
+        archive_entry_set_symlink(node->entry.get(), nullptr);
+        archive_entry_set_hardlink(node->entry.get(), nullptr);
+        archive_entry_set_perm(node->entry.get(), perm);
+    } else {
+        node = &new_node(normalized, AE_IFREG, perm);
+    }
+
+    node->data = std::move(data);
+    return true;
+}
+
+bool Ramdisk::set_symlink(const std::string &path, const std::string &target)
+{
+    std::string normalized = normalize(path);
+    std::string parent = parent_path(normalized);
+
+    if (!parent.empty() && !exists(parent)) {
+        LOGE("%s: Parent directory does not exist", normalized.c_str());
+        return false;
+    }
+
+    remove(normalized);
+
+    Node &node = new_node(normalized, AE_IFLNK, 0777);
+    archive_entry_set_symlink(node.entry.get(), target.c_str());
+    return true;
+}
+
+bool Ramdisk::remove(const std::string &path)
+{
+    std::string needle = normalize(path);
+
+    auto it = std::find_if(m_nodes.begin(), m_nodes.end(),
+                           [&](const Node &node) {
+        return normalize(archive_entry_pathname(node.entry.get())) == needle;
+    });
+    if (it == m_nodes.end()) {
+        return false;
+    }
+
+    m_nodes.erase(it);
+    return true;
+}
+
+bool Ramdisk::rename(const std::string &source, const std::string &target)
+{
+    std::string normalized = normalize(target);
+
+    if (normalize(source) == normalized) {
+        return exists(normalized);
+    }
+
+    if (!find(source)) {
+        LOGE("%s: Entry does not exist", source.c_str());
+        return false;
+    }
+
+    // Like rename(2), replace the target if it exists. Only the entry itself
+    // is renamed, so this should not be used for non-empty directories.
+    remove(normalized);
+
+    Node *node = find(source);
+    archive_entry_set_pathname(node->entry.get(), normalized.c_str());
+    return true;
+}
+
+}
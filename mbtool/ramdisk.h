@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+namespace mb
+{
+
+/*!
+ * \brief In-memory cpio ramdisk
+ *
+ * The entries of the archive are kept in their original order along with their
+ * metadata and contents. This allows a ramdisk to be patched and repacked
+ * without extracting it to the filesystem.
+ *
+ * Paths are relative to the root of the ramdisk. Leading slashes and "./"
+ * components are ignored when looking up entries.
+ */
+class Ramdisk
+{
+public:
+    struct Node
+    {
+        std::unique_ptr<archive_entry, decltype(archive_entry_free) *> entry;
+        std::string data;
+    };
+
+    Ramdisk();
+
+    bool load(bootimg::Reader &reader);
+    bool load(const void *data, size_t size);
+    bool save(bootimg::Writer &writer) const;
+    bool save(std::string &out) const;
+
+    Node * find(const std::string &path);
+    const Node * find(const std::string &path) const;
+    bool exists(const std::string &path) const;
+    bool read_link(const std::string &path, std::string &target) const;
+
+    bool set_file(const std::string &path, std::string data, mode_t perm);
+    bool set_symlink(const std::string &path, const std::string &target);
+    bool remove(const std::string &path);
+    bool rename(const std::string &source, const std::string &target);
+
+private:
+    bool load_archive(archive *a, const char *name);
+    bool save_archive(archive *a, const char *name) const;
+
+    Node & new_node(const std::string &path, mode_t type, mode_t perm);
+
+    std::vector<Node> m_nodes;
+    int m_format;
+    std::vector<int> m_filters;
+};
+
+}
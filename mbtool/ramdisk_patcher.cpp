@@ -22,61 +22,36 @@
 #include <algorithm>
 
 #include <cerrno>
-#include <cstdio>
-#include <cstdlib>
 #include <cstring>
 
-#include <sys/stat.h>
-#include <unistd.h>
-
-#include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
-#include "mbutil/copy.h"
+#include "mbutil/file.h"
 #include "mbutil/path.h"
 
-#include "installer_util.h"
-
 #define LOG_TAG "mbtool/ramdisk_patcher"
 
 namespace mb
 {
 
-static bool _rp_write_rom_id(const std::string &dir, const std::string &rom_id)
+static bool read_host_file(const std::string &path, std::string &data_out)
 {
-    std::string path(dir);
-    path += "/romid";
+    std::vector<unsigned char> data;
 
-    FILE *fp = fopen(path.c_str(), "wb");
-    if (!fp) {
-        LOGE("%s: Failed to open for writing: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    if (fputs(rom_id.c_str(), fp) == EOF) {
-        LOGE("%s: Failed to write ROM ID: %s",
-             path.c_str(), strerror(errno));
-        fclose(fp);
-        return false;
-    }
-
-    if (fchmod(fileno(fp), 0664) < 0) {
-        LOGE("%s: Failed to chmod: %s",
-             path.c_str(), strerror(errno));
-        fclose(fp);
-        return false;
-    }
-
-    if (fclose(fp) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             path.c_str(), strerror(errno));
+    if (!util::file_read_all(path, data)) {
+        LOGE("%s: Failed to read file: %s", path.c_str(), strerror(errno));
         return false;
     }
 
+    data_out.assign(data.begin(), data.end());
     return true;
 }
 
+static bool _rp_write_rom_id(Ramdisk &ramdisk, const std::string &rom_id)
+{
+    return ramdisk.set_file("romid", rom_id, 0664);
+}
+
 std::function<RamdiskPatcherFn>
 rp_write_rom_id(const std::string &rom_id)
 {
@@ -85,99 +60,39 @@ rp_write_rom_id(const std::string &rom_id)
     return std::bind(_rp_write_rom_id, _1, rom_id);
 }
 
-static bool _rp_patch_default_prop(const std::string &dir,
+static bool _rp_patch_default_prop(Ramdisk &ramdisk,
                                    const std::string &device_id,
                                    bool use_fuse_exfat)
 {
-    std::string path(dir);
-    path += "/default.prop";
-
-    std::string tmp_path = format("%s.XXXXXX", path.c_str());
-
-    const int tmp_fd = mkstemp(&tmp_path[0]);
-    if (tmp_fd < 0) {
-        LOGE("%s: Failed to create temporary file: %s",
-             path.c_str(), strerror(errno));
+    auto node = ramdisk.find("default.prop");
+    if (!node) {
+        LOGE("default.prop: File does not exist in ramdisk");
         return false;
     }
 
-    auto unlink_tmp_path = finally([&tmp_path] {
-        unlink(tmp_path.c_str());
-    });
-
-    auto close_tmp_fd = finally([&tmp_fd] {
-        close(tmp_fd);
-    });
-
-    FILE *fp_in = fopen(path.c_str(), "rb");
-    if (!fp_in) {
-        LOGE("%s: Failed to open for reading: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    auto close_fp_in = finally([&fp_in] {
-        fclose(fp_in);
-    });
-
-    FILE *fp_out = fdopen(tmp_fd, "wb");
-    if (!fp_out) {
-        LOGE("%s: Failed to open for writing: %s",
-             tmp_path.c_str(), strerror(errno));
-        return false;
-    }
-
-    // fp_out will automatically close the fd
-    close_tmp_fd.dismiss();
-
-    auto close_fp_out = finally([&fp_out] {
-        fclose(fp_out);
-    });
+    const std::string &data = node->data;
+    std::string new_data;
+    new_data.reserve(data.size() + 128);
 
-    char *buf = nullptr;
-    size_t buf_size = 0;
-    ssize_t n;
+    for (size_t pos = 0; pos < data.size();) {
+        size_t end = data.find('\n', pos);
+        end = end == std::string::npos ? data.size() : end + 1;
 
-    auto free_buf = finally([&buf] {
-        free(buf);
-    });
-
-    while ((n = getline(&buf, &buf_size, fp_in)) >= 0) {
         // Remove old multiboot properties
-        if (starts_with(buf, "ro.patcher.")) {
-            continue;
+        if (data.compare(pos, strlen("ro.patcher."), "ro.patcher.") != 0) {
+            new_data.append(data, pos, end - pos);
         }
 
-        if (fwrite(buf, 1, static_cast<size_t>(n), fp_out)
-                != static_cast<size_t>(n)) {
-            LOGE("%s: Failed to write file: %s",
-                 tmp_path.c_str(), strerror(errno));
-            return false;
-        }
+        pos = end;
     }
 
     // Write new properties
-    if (fputc('\n', fp_out) == EOF
-            || fprintf(fp_out, "ro.patcher.device=%s\n", device_id.c_str()) < 0
-            || fprintf(fp_out, "ro.patcher.use_fuse_exfat=%s\n",
-                       use_fuse_exfat ? "true" : "false") < 0) {
-        LOGE("%s: Failed to write properties: %s",
-             tmp_path.c_str(), strerror(errno));
-        return false;
-    }
+    new_data += '\n';
+    new_data += format("ro.patcher.device=%s\n", device_id.c_str());
+    new_data += format("ro.patcher.use_fuse_exfat=%s\n",
+                       use_fuse_exfat ? "true" : "false");
 
-    // Manually close file to ensure we catch write errors
-    close_fp_out.dismiss();
-
-    if (fclose(fp_out) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             tmp_path.c_str(), strerror(errno));
-        return false;
-    }
-
-    if (!InstallerUtil::replace_file(path.c_str(), tmp_path)) {
-        return false;
-    }
+    node->data.swap(new_data);
 
     return true;
 }
@@ -190,7 +105,7 @@ rp_patch_default_prop(const std::string &device_id, bool use_fuse_exfat)
     return std::bind(_rp_patch_default_prop, _1, device_id, use_fuse_exfat);
 }
 
-static bool _rp_add_binaries(const std::string &dir,
+static bool _rp_add_binaries(Ramdisk &ramdisk,
                              const std::string &binaries_dir)
 {
     struct CopySpec
@@ -215,15 +130,11 @@ static bool _rp_add_binaries(const std::string &dir,
         std::string source(binaries_dir);
         source += "/";
         source += item.from;
-        std::string target(dir);
-        target += "/";
-        target += item.to;
 
-        if (!util::copy_file(source, target, 0)) {
-            return false;
-        }
-        if (chmod(target.c_str(), item.perm) < 0) {
-            LOGE("%s: Failed to chmod: %s", target.c_str(), strerror(errno));
+        std::string data;
+
+        if (!read_host_file(source, data)
+                || !ramdisk.set_file(item.to, std::move(data), item.perm)) {
             return false;
         }
     }
@@ -239,18 +150,11 @@ rp_add_binaries(const std::string &binaries_dir)
     return std::bind(_rp_add_binaries, _1, binaries_dir);
 }
 
-static bool _rp_symlink_fuse_exfat(const std::string &dir)
+static bool _rp_symlink_fuse_exfat(Ramdisk &ramdisk)
 {
-    std::string fsck_exfat(dir);
-    fsck_exfat += "/sbin/fsck.exfat";
-    std::string fsck_exfat_sig(fsck_exfat);
-    fsck_exfat_sig += ".sig";
-
-    if ((unlink(fsck_exfat.c_str()) < 0 && errno != ENOENT)
-            || symlink("mount.exfat", fsck_exfat.c_str()) < 0
-            || (unlink(fsck_exfat_sig.c_str()) < 0 && errno != ENOENT)
-            || symlink("mount.exfat.sig", fsck_exfat_sig.c_str()) < 0) {
-        LOGE("Failed to symlink exfat fsck binaries: %s", strerror(errno));
+    if (!ramdisk.set_symlink("sbin/fsck.exfat", "mount.exfat")
+            || !ramdisk.set_symlink("sbin/fsck.exfat.sig", "mount.exfat.sig")) {
+        LOGE("Failed to symlink exfat fsck binaries");
         return false;
     }
 
@@ -263,14 +167,10 @@ rp_symlink_fuse_exfat()
     return _rp_symlink_fuse_exfat;
 }
 
-static bool _rp_symlink_init(const std::string &dir)
+static bool _rp_symlink_init(Ramdisk &ramdisk)
 {
-    std::string target{dir};
-    target += "/init";
-    std::string real_init{dir};
-    real_init += "/init.orig";
-
-    struct stat sb;
+    std::string target{"init"};
+    std::string real_init{"init.orig"};
 
     // If this is a Sony device that doesn't use sbin/ramdisk.cpio for the
     // combined ramdisk, we'll have to explicitly allow their init executable to
@@ -281,16 +181,12 @@ static bool _rp_symlink_init(const std::string &dir)
     // * https://github.com/chenxiaolong/DualBootPatcher/issues/533
     // * https://github.com/sonyxperiadev/device-sony-common-init
     {
-        std::string sony_init_wrapper(dir);
-        sony_init_wrapper += "/sbin/init_sony";
-        std::string sony_real_init(dir);
-        sony_real_init += "/init.real";
+        std::string sony_real_init("init.real");
         std::string sony_symlink_target;
 
         // Check that /init is a symlink and that /init.real exists
-        if (lstat(target.c_str(), &sb) == 0 && S_ISLNK(sb.st_mode)
-                && util::read_link(target, sony_symlink_target)
-                && lstat(sony_real_init.c_str(), &sb) == 0) {
+        if (ramdisk.read_link(target, sony_symlink_target)
+                && ramdisk.exists(sony_real_init)) {
             std::vector<std::string> haystack{util::path_split(sony_symlink_target)};
             std::vector<std::string> needle{util::path_split("sbin/init_sony")};
 
@@ -308,22 +204,14 @@ static bool _rp_symlink_init(const std::string &dir)
     LOGD("[init] Target init path: %s", target.c_str());
     LOGD("[init] Real init path: %s", real_init.c_str());
 
-    if (lstat(real_init.c_str(), &sb) < 0) {
-        if (errno != ENOENT) {
-            LOGE("%s: Failed to access file: %s",
-                 real_init.c_str(), strerror(errno));
-            return false;
-        }
-
-        if (rename(target.c_str(), real_init.c_str()) < 0) {
-            LOGE("%s: Failed to rename file: %s",
-                 target.c_str(), strerror(errno));
+    if (!ramdisk.exists(real_init)) {
+        if (!ramdisk.rename(target, real_init)) {
+            LOGE("%s: Failed to rename file", target.c_str());
             return false;
         }
 
-        if (symlink("/mbtool", target.c_str()) < 0) {
-            LOGE("%s: Failed to symlink mbtool: %s",
-                 target.c_str(), strerror(errno));
+        if (!ramdisk.set_symlink(target, "/mbtool")) {
+            LOGE("%s: Failed to symlink mbtool", target.c_str());
             return false;
         }
     }
@@ -337,23 +225,13 @@ rp_symlink_init()
     return _rp_symlink_init;
 }
 
-static bool _rp_add_device_json(const std::string &dir,
+static bool _rp_add_device_json(Ramdisk &ramdisk,
                                 const std::string &device_json_file)
 {
-    std::string device_json(dir);
-    device_json += "/device.json";
-
-    if (!util::copy_file(device_json_file, device_json, 0)) {
-        return false;
-    }
-
-    if (chmod(device_json.c_str(), 0644) < 0) {
-        LOGE("%s: Failed to chmod file: %s",
-             device_json.c_str(), strerror(errno));
-        return false;
-    }
+    std::string data;
 
-    return true;
+    return read_host_file(device_json_file, data)
+            && ramdisk.set_file("device.json", std::move(data), 0644);
 }
 
 std::function<RamdiskPatcherFn>
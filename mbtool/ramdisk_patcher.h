@@ -23,10 +23,12 @@
 #include <string>
 //#include <vector>
 
+#include "ramdisk.h"
+
 namespace mb
 {
 
-typedef bool (RamdiskPatcherFn)(const std::string &dir);
+typedef bool (RamdiskPatcherFn)(Ramdisk &ramdisk);
 
 std::function<RamdiskPatcherFn>
 rp_write_rom_id(const std::string &rom_id);
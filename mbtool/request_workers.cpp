@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "request_workers.h"
+
+#include <utility>
+
+#include <sys/socket.h>
+
+namespace mb
+{
+
+RequestWorkers::RequestWorkers(int fd, size_t threads, size_t max_queued,
+                               Handler handler)
+    : _fd(fd)
+    , _max_threads(threads)
+    , _max_queued(max_queued)
+    , _handler(std::move(handler))
+{
+}
+
+RequestWorkers::~RequestWorkers()
+{
+    stop();
+}
+
+/*!
+ * \brief Queue a request
+ *
+ * The worker threads are started on the first call. If the queue is full, this
+ * blocks until a worker thread takes a request.
+ *
+ * \return Whether the request was queued. Returns false if a previous request
+ *         failed.
+ */
+bool RequestWorkers::submit(std::vector<uint8_t> data)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_threads.empty()) {
+        for (size_t i = 0; i < _max_threads; ++i) {
+            _threads.emplace_back(&RequestWorkers::run, this);
+        }
+    }
+
+    _not_full.wait(lock, [&]{
+        return _failed || _queue.size() < _max_queued;
+    });
+
+    if (_failed) {
+        return false;
+    }
+
+    _queue.push_back(std::move(data));
+    _not_empty.notify_one();
+
+    return true;
+}
+
+/*!
+ * \brief Discard queued requests and wait for running requests to complete
+ */
+void RequestWorkers::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+
+        // Nobody is left to receive the responses, so don't run requests that
+        // haven't started yet. Some of them are destructive.
+        _queue.clear();
+    }
+
+    _not_empty.notify_all();
+    _not_full.notify_all();
+
+    for (auto &t : _threads) {
+        t.join();
+    }
+    _threads.clear();
+}
+
+void RequestWorkers::run()
+{
+    while (true) {
+        std::vector<uint8_t> data;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            _not_empty.wait(lock, [&]{
+                return _stopping || !_queue.empty();
+            });
+
+            if (_queue.empty() || _failed) {
+                return;
+            }
+
+            data = std::move(_queue.front());
+            _queue.pop_front();
+            _not_full.notify_one();
+        }
+
+        if (!_handler(data)) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _failed = true;
+            _not_full.notify_all();
+
+            // Interrupt the connection thread's blocking read
+            shutdown(_fd, SHUT_RDWR);
+        }
+    }
+}
+
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mb
+{
+
+/*!
+ * \brief Thread pool for processing requests from a connection
+ *
+ * Requests are queued by the connection thread and processed in FIFO order by
+ * up to \p threads threads. The responses may be sent out of order if there is
+ * more than one thread. If the handler returns false, the socket is shut down
+ * so that the connection thread stops reading further requests. When the
+ * connection ends, requests that are still queued are discarded.
+ */
+class RequestWorkers
+{
+public:
+    // Returns false if the connection should be closed
+    using Handler = std::function<bool(const std::vector<uint8_t> &)>;
+
+    RequestWorkers(int fd, size_t threads, size_t max_queued, Handler handler);
+    ~RequestWorkers();
+
+    bool submit(std::vector<uint8_t> data);
+    void stop();
+
+private:
+    void run();
+
+    int _fd;
+    size_t _max_threads;
+    size_t _max_queued;
+    Handler _handler;
+    std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+    std::deque<std::vector<uint8_t>> _queue;
+    std::vector<std::thread> _threads;
+    bool _stopping = false;
+    bool _failed = false;
+};
+
+}
@@ -20,10 +20,14 @@
 #include "sepolpatch.h"
 
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <climits>
 #include <cstdio>
+#include <cstring>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <sys/mman.h>
@@ -38,16 +42,27 @@
 #include <sepol/sepol.h>
 #undef bool
 
+#include <openssl/sha.h>
+
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+#include "mbcommon/version.h"
 #include "mblog/logging.h"
+#include "mbutil/file.h"
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
 #include "multiboot.h"
+#include "roms.h"
 
 #define LOG_TAG "mbtool/sepolpatch"
 
+// Patched policies are cached here, keyed by the hash of the source policy, the
+// patch type, the mbtool version, and any other inputs to the patch
+#define SEPOLICY_CACHE_PARENT_DIR       "/data/multiboot"
+#define SEPOLICY_CACHE_DIR              "/data/multiboot/sepolicy_cache"
+
 
 extern "C" int policydb_index_decls(policydb_t *p);
 
@@ -143,16 +158,26 @@ SELinuxResult selinux_raw_set_type_trans(policydb_t *pdb,
     }
 }
 
-SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
-                                          uint16_t source_type_val,
-                                          uint16_t target_type_val,
-                                          uint16_t class_val)
+/*!
+ * \brief Get bitmask of all permissions in a class
+ *
+ * \param pdb Policy DB object
+ * \param class_val Class value
+ * \param mask_out Bitmask of permissions (bit N - 1 is set for permission N)
+ *
+ * \return Whether the class exists
+ */
+bool selinux_raw_class_perms_mask(policydb_t *pdb,
+                                  uint16_t class_val,
+                                  uint32_t &mask_out)
 {
-    SELinuxResult result(SELinuxResult::Unchanged);
+    if (class_val == 0 || class_val > pdb->p_classes.nprim) {
+        return false;
+    }
 
     auto clazz = pdb->class_val_to_struct[class_val - 1];
     if (!clazz) {
-        return SELinuxResult::Error;
+        return false;
     }
 
     // Class-specific permissions
@@ -161,44 +186,104 @@ SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
         tables[1] = clazz->comdatum->permissions.table;
     }
 
+    uint32_t mask = 0;
+
     for (auto table = tables; *table; ++table) {
         for (uint32_t bucket = 0; bucket < (*table)->size; ++bucket) {
             for (hashtab_ptr_t cur = (*table)->htable[bucket]; cur;
                     cur = cur->next) {
                 auto perm_datum = static_cast<perm_datum_t *>(cur->datum);
-
-                SELinuxResult ret = selinux_raw_set_avtab_rule(
-                        pdb, source_type_val, target_type_val, class_val,
-                        perm_datum->s.value, false);
-
-                switch (ret) {
-                case SELinuxResult::Error:
-                    return ret;
-                case SELinuxResult::Changed:
-                    result = ret;
-                    break;
-                case SELinuxResult::Unchanged:
-                    // Ignore
-                    break;
-                }
+                mask |= 1U << (perm_datum->s.value - 1);
             }
         }
     }
 
-    return result;
+    mask_out = mask;
+    return true;
 }
 
-SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
-                                          uint16_t source_type_val,
-                                          uint16_t target_type_val)
+/*!
+ * Add permissions to an allow rule, creating the rule if needed.
+ *
+ * \param pdb Policy DB object
+ * \param source_type_val Source type for rule
+ * \param target_type_val Target type for rule
+ * \param class_val Class for rule
+ * \param perms Bitmask of permissions to add
+ *
+ * \return Whether a change was made
+ */
+static SELinuxResult add_avtab_perms(policydb_t *pdb,
+                                     uint16_t source_type_val,
+                                     uint16_t target_type_val,
+                                     uint16_t class_val,
+                                     uint32_t perms)
+{
+    avtab_datum_t *av;
+    avtab_key_t key;
+
+    key.source_type = source_type_val;
+    key.target_type = target_type_val;
+    key.target_class = class_val;
+    key.specified = AVTAB_ALLOWED;
+    av = avtab_search(&pdb->te_avtab, &key);
+
+    if (!av) {
+        avtab_datum_t av_new;
+        av_new.data = perms;
+        if (avtab_insert(&pdb->te_avtab, &key, &av_new) != 0) {
+            return SELinuxResult::Error;
+        }
+        return SELinuxResult::Changed;
+    } else {
+        auto old_data = av->data;
+
+        av->data |= perms;
+
+        return (av->data == old_data)
+                ? SELinuxResult::Unchanged
+                : SELinuxResult::Changed;
+    }
+}
+
+/*!
+ * \brief Add a batch of allow rules
+ *
+ * Rules with the same source type, target type, and class are merged first, so
+ * the avtab is only searched (and possibly inserted into) once per distinct
+ * key, regardless of the number of permissions.
+ *
+ * \param pdb Policy DB object
+ * \param rules Rules to add
+ *
+ * \return Whether a change was made
+ */
+SELinuxResult selinux_raw_add_allow_rules(
+        policydb_t *pdb, const std::vector<SELinuxAllowRule> &rules)
 {
     SELinuxResult result(SELinuxResult::Unchanged);
 
-    for (uint32_t class_val = 1; class_val <= pdb->p_classes.nprim;
-            ++class_val) {
-        SELinuxResult ret = selinux_raw_grant_all_perms(
-                pdb, source_type_val, target_type_val,
-                static_cast<uint16_t>(class_val));
+    std::unordered_map<uint64_t, uint32_t> merged;
+    merged.reserve(rules.size());
+
+    for (auto const &rule : rules) {
+        uint64_t key = (static_cast<uint64_t>(rule.source_type_val) << 32)
+                | (static_cast<uint64_t>(rule.target_type_val) << 16)
+                | rule.class_val;
+        merged[key] |= rule.perms;
+    }
+
+    for (auto const &item : merged) {
+        if (item.second == 0) {
+            continue;
+        }
+
+        SELinuxResult ret = add_avtab_perms(
+                pdb,
+                static_cast<uint16_t>(item.first >> 32),
+                static_cast<uint16_t>(item.first >> 16),
+                static_cast<uint16_t>(item.first),
+                item.second);
 
         switch (ret) {
         case SELinuxResult::Error:
@@ -215,6 +300,91 @@ SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
     return result;
 }
 
+SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
+                                          uint16_t source_type_val,
+                                          uint16_t target_type_val,
+                                          uint16_t class_val)
+{
+    uint32_t mask;
+
+    if (!selinux_raw_class_perms_mask(pdb, class_val, mask)) {
+        return SELinuxResult::Error;
+    }
+
+    if (mask == 0) {
+        return SELinuxResult::Unchanged;
+    }
+
+    return add_avtab_perms(pdb, source_type_val, target_type_val, class_val,
+                           mask);
+}
+
+SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
+                                          uint16_t source_type_val,
+                                          uint16_t target_type_val)
+{
+    std::vector<SELinuxAllowRule> rules;
+
+    for (uint32_t class_val = 1; class_val <= pdb->p_classes.nprim;
+            ++class_val) {
+        uint32_t mask;
+
+        if (!selinux_raw_class_perms_mask(
+                pdb, static_cast<uint16_t>(class_val), mask)) {
+            return SELinuxResult::Error;
+        }
+
+        rules.push_back({ source_type_val, target_type_val,
+                          static_cast<uint16_t>(class_val), mask });
+    }
+
+    return selinux_raw_add_allow_rules(pdb, rules);
+}
+
+/*!
+ * \brief Grant all permissions from a source type to every attribute
+ *
+ * The permission masks are computed once per class and all of the rules are
+ * applied as a single batch.
+ *
+ * \param pdb Policy DB object
+ * \param source_type_val Source type
+ *
+ * \return Whether a change was made
+ */
+SELinuxResult selinux_raw_grant_all_perms_to_attributes(
+        policydb_t *pdb, uint16_t source_type_val)
+{
+    std::vector<uint32_t> masks(pdb->p_classes.nprim);
+
+    for (uint32_t class_val = 1; class_val <= pdb->p_classes.nprim;
+            ++class_val) {
+        if (!selinux_raw_class_perms_mask(
+                pdb, static_cast<uint16_t>(class_val), masks[class_val - 1])) {
+            return SELinuxResult::Error;
+        }
+    }
+
+    std::vector<SELinuxAllowRule> rules;
+
+    for (uint32_t type_val = 1; type_val <= pdb->p_types.nprim; ++type_val) {
+        // Skip non-attributes
+        if (pdb->type_val_to_struct[type_val - 1]->flavor != TYPE_ATTRIB) {
+            continue;
+        }
+
+        for (uint32_t class_val = 1; class_val <= pdb->p_classes.nprim;
+                ++class_val) {
+            rules.push_back({ source_type_val,
+                              static_cast<uint16_t>(type_val),
+                              static_cast<uint16_t>(class_val),
+                              masks[class_val - 1] });
+        }
+    }
+
+    return selinux_raw_add_allow_rules(pdb, rules);
+}
+
 SELinuxResult selinux_raw_set_permissive(policydb_t *pdb,
                                          uint16_t type_val,
                                          bool permissive)
@@ -860,25 +1030,12 @@ static bool apply_pre_boot_patches(policydb_t *pdb)
         return false;
     }
 
-    // For all attributes
-    for (uint32_t type_val = 1; type_val <= pdb->p_types.nprim; ++type_val) {
-        // Skip non-attributes
-        if (pdb->type_val_to_struct[type_val - 1]->flavor != TYPE_ATTRIB) {
-            continue;
-        }
-
-        auto ret = selinux_raw_grant_all_perms(
-                pdb, static_cast<uint16_t>(kernel->s.value),
-                static_cast<uint16_t>(type_val));
-        switch (ret) {
-        case SELinuxResult::Changed:
-        case SELinuxResult::Unchanged:
-            break;
-        case SELinuxResult::Error:
-            LOGE("Failed to grant all perms for: %s -> %s",
-                 "kernel", pdb->p_type_val_to_name[type_val - 1]);
-            return false;
-        }
+    if (selinux_raw_grant_all_perms_to_attributes(
+            pdb, static_cast<uint16_t>(kernel->s.value))
+            == SELinuxResult::Error) {
+        LOGE("Failed to grant all perms for: %s -> <all attributes>",
+             "kernel");
+        return false;
     }
 
     // Allow the real init to load the "secure" SELinux policy
@@ -891,7 +1048,7 @@ static bool copy_avtab_rules(policydb_t *pdb,
                              const char *source_type,
                              const char *target_type)
 {
-    std::vector<std::pair<avtab_key_t, avtab_datum_t>> to_add;
+    std::vector<SELinuxAllowRule> to_add;
 
     type_datum_t *source, *target;
 
@@ -920,28 +1077,19 @@ static bool copy_avtab_rules(policydb_t *pdb,
             }
 
             if (cur->key.target_type == source->s.value) {
-                avtab_key_t copy = cur->key;
-                copy.target_type = static_cast<uint16_t>(target->s.value);
-
-                to_add.push_back(std::make_pair(std::move(copy), cur->datum));
+                to_add.push_back({ cur->key.source_type,
+                                   static_cast<uint16_t>(target->s.value),
+                                   cur->key.target_class,
+                                   cur->datum.data });
             }
         }
     }
 
-    avtab_datum_t *datum;
-    for (auto &pair : to_add) {
-        datum = avtab_search(&pdb->te_avtab, &pair.first);
-
-        if (!datum) {
-            // Create new avtab rule if the key doesn't exist
-            if (avtab_insert(&pdb->te_avtab, &pair.first, &pair.second) != 0) {
-                LOGE("Failed to add rule to avtab");
-                return false;
-            }
-        } else {
-            // Add additional perms if the key already exists
-            datum->data |= pair.second.data;
-        }
+    // Creates new rules if the keys don't exist and adds additional perms if
+    // they do
+    if (selinux_raw_add_allow_rules(pdb, to_add) == SELinuxResult::Error) {
+        LOGE("Failed to add rules to avtab");
+        return false;
     }
 
     return true;
@@ -1062,27 +1210,12 @@ static bool create_mbtool_types(policydb_t *pdb)
         return false;
     }
 
-    // For all attributes
-    for (uint32_t type_val = 1; type_val <= pdb->p_types.nprim;
-            ++type_val) {
-        // Skip non-attributes
-        if (pdb->type_val_to_struct[type_val - 1]->flavor
-                != TYPE_ATTRIB) {
-            continue;
-        }
-
-        auto ret2 = selinux_raw_grant_all_perms(
-                pdb, static_cast<uint16_t>(mb_exec->s.value),
-                static_cast<uint16_t>(type_val));
-        switch (ret2) {
-        case SELinuxResult::Changed:
-        case SELinuxResult::Unchanged:
-            break;
-        case SELinuxResult::Error:
-            LOGE("Failed to grant all perms for: %s -> %s",
-                 "mb_exec", pdb->p_type_val_to_name[type_val - 1]);
-            return false;
-        }
+    if (selinux_raw_grant_all_perms_to_attributes(
+            pdb, static_cast<uint16_t>(mb_exec->s.value))
+            == SELinuxResult::Error) {
+        LOGE("Failed to grant all perms for: %s -> <all attributes>",
+             "mb_exec");
+        return false;
     }
 
     return true;
@@ -1141,10 +1274,177 @@ bool selinux_apply_patch(policydb_t *pdb, SELinuxPatch patch)
     return ret;
 }
 
+static const char * patch_cache_name(SELinuxPatch patch)
+{
+    switch (patch) {
+    case SELinuxPatch::PreBoot:
+        return "pre_boot";
+    case SELinuxPatch::Main:
+        return "main";
+    case SELinuxPatch::CwmRecovery:
+        return "cwm_recovery";
+    case SELinuxPatch::StripNoAudit:
+        return "strip_no_audit";
+    case SELinuxPatch::None:
+        break;
+    }
+
+    return nullptr;
+}
+
+/*!
+ * \brief Get path to the cached patched policy
+ *
+ * \return Path or empty string if the cache directory is not available
+ */
+static std::string get_cache_path(const std::vector<unsigned char> &policy,
+                                  SELinuxPatch patch)
+{
+    const char *name = patch_cache_name(patch);
+    if (!name) {
+        return {};
+    }
+
+    struct stat sb;
+    if (stat(get_raw_path(SEPOLICY_CACHE_PARENT_DIR).c_str(), &sb) < 0
+            || !S_ISDIR(sb.st_mode)) {
+        return {};
+    }
+
+    auto patch_val = static_cast<uint32_t>(patch);
+    const char *mbtool_version = version();
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+
+    // The main patch also depends on the label of the internal storage (see
+    // fix_data_media_rules())
+    std::string extra;
+    if (patch == SELinuxPatch::Main
+            && !util::selinux_lget_context(INTERNAL_STORAGE, extra)) {
+        util::selinux_lget_context("/data/media", extra);
+    }
+
+    SHA512_CTX ctx;
+    SHA512_Init(&ctx);
+    SHA512_Update(&ctx, policy.data(), policy.size());
+    SHA512_Update(&ctx, &patch_val, sizeof(patch_val));
+    SHA512_Update(&ctx, mbtool_version, strlen(mbtool_version));
+    SHA512_Update(&ctx, extra.data(), extra.size());
+    SHA512_Final(digest, &ctx);
+
+    std::string path = get_raw_path(SEPOLICY_CACHE_DIR);
+    path += '/';
+    path += name;
+    path += '-';
+    path += util::hex_string(digest, sizeof(digest));
+    return path;
+}
+
+/*!
+ * \brief Store patched policy in the cache
+ *
+ * Older entries for the same patch type are removed since they can no longer
+ * match the current policy. The entry is written to a temporary file first so
+ * that an interrupted write is never mistaken for a valid entry.
+ */
+static void store_cached_policy(const std::string &path, SELinuxPatch patch,
+                                const std::vector<unsigned char> &data)
+{
+    std::string dir = get_raw_path(SEPOLICY_CACHE_DIR);
+
+    if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+        LOGW("%s: Failed to create directory: %s",
+             dir.c_str(), strerror(errno));
+        return;
+    }
+
+    std::string prefix(patch_cache_name(patch));
+    prefix += '-';
+
+    if (DIR *dp = opendir(dir.c_str())) {
+        while (struct dirent *ent = readdir(dp)) {
+            if (starts_with(ent->d_name, prefix)) {
+                std::string old_path(dir);
+                old_path += '/';
+                old_path += ent->d_name;
+                unlink(old_path.c_str());
+            }
+        }
+        closedir(dp);
+    }
+
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    int fd = open(temp_path.c_str(),
+                  O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGW("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return;
+    }
+
+    size_t total = 0;
+    while (total < data.size()) {
+        ssize_t n = write(fd, data.data() + total, data.size() - total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        total += static_cast<size_t>(n);
+    }
+
+    bool ok = total == data.size() && fsync(fd) == 0;
+    if (close(fd) < 0) {
+        ok = false;
+    }
+
+    if (!ok) {
+        LOGW("%s: Failed to write cached policy: %s",
+             temp_path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to rename to %s: %s",
+             temp_path.c_str(), path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+    }
+}
+
 bool patch_sepolicy(const std::string &source,
                     const std::string &target,
                     SELinuxPatch patch)
 {
+    std::vector<unsigned char> source_data;
+
+    if (!util::selinux_read_policy_image(source, source_data)) {
+        LOGE("%s: Failed to read SELinux policy", source.c_str());
+        return false;
+    }
+
+    std::string cache_path = get_cache_path(source_data, patch);
+
+    if (!cache_path.empty()) {
+        std::vector<unsigned char> cached_data;
+
+        if (util::file_read_all(cache_path, cached_data)
+                && !cached_data.empty()) {
+            if (util::selinux_write_policy_image(
+                    target, cached_data.data(), cached_data.size())) {
+                LOGD("%s: Loaded patched policy from cache",
+                     cache_path.c_str());
+                return true;
+            }
+
+            LOGW("%s: Failed to write cached policy; patching again",
+                 cache_path.c_str());
+            unlink(cache_path.c_str());
+        }
+    }
+
     policydb_t pdb;
 
     if (policydb_init(&pdb) < 0) {
@@ -1156,7 +1456,8 @@ bool patch_sepolicy(const std::string &source,
         policydb_destroy(&pdb);
     });
 
-    if (!util::selinux_read_policy(source, &pdb)) {
+    if (!util::selinux_policy_from_image(source_data.data(),
+                                         source_data.size(), &pdb)) {
         LOGE("%s: Failed to load SELinux policy", source.c_str());
         return false;
     }
@@ -1168,11 +1469,20 @@ bool patch_sepolicy(const std::string &source,
         return false;
     }
 
-    if (!util::selinux_write_policy(target, &pdb)) {
+    std::vector<unsigned char> target_data;
+
+    if (!util::selinux_policy_to_image(&pdb, target_data)
+            || !util::selinux_write_policy_image(
+                    target, target_data.data(), target_data.size())) {
         LOGE("%s: Failed to write SELinux policy", target.c_str());
         return false;
     }
 
+    // Only cache the policy once it has been successfully written
+    if (!cache_path.empty()) {
+        store_cached_policy(cache_path, patch, target_data);
+    }
+
     return true;
 }
 
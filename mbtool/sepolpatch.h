@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <sepol/policydb/policydb.h>
 
@@ -33,6 +34,15 @@ enum class SELinuxResult
     Error,
 };
 
+struct SELinuxAllowRule
+{
+    uint16_t source_type_val;
+    uint16_t target_type_val;
+    uint16_t class_val;
+    // Bit N - 1 is set for permission N
+    uint32_t perms;
+};
+
 SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
                                          uint16_t source_type_val,
                                          uint16_t target_type_val,
@@ -51,6 +61,13 @@ SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
 SELinuxResult selinux_raw_grant_all_perms(policydb_t *pdb,
                                           uint16_t source_type_val,
                                           uint16_t target_type_val);
+SELinuxResult selinux_raw_grant_all_perms_to_attributes(
+        policydb_t *pdb, uint16_t source_type_val);
+bool selinux_raw_class_perms_mask(policydb_t *pdb,
+                                  uint16_t class_val,
+                                  uint32_t &mask_out);
+SELinuxResult selinux_raw_add_allow_rules(
+        policydb_t *pdb, const std::vector<SELinuxAllowRule> &rules);
 SELinuxResult selinux_raw_set_permissive(policydb_t *pdb,
                                          uint16_t type_val,
                                          bool permissive);
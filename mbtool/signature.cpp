@@ -19,6 +19,8 @@
 
 #include "signature.h"
 
+#include <functional>
+
 #include <cstdlib>
 #include <cstring>
 
@@ -109,20 +111,13 @@ static void openssl_log_errors()
     ERR_print_errors_cb(&log_callback, nullptr);
 }
 
-static SigVerifyResult verify_signature_with_key(const char *path,
+static SigVerifyResult verify_signature_with_key(BIO *bio_data_in,
                                                  const char *sig_path,
                                                  EVP_PKEY *public_key)
 {
     bool ret = false;
     bool valid;
 
-    ScopedBIO bio_data_in(BIO_new_file(path, "rb"), BIO_free);
-    if (!bio_data_in) {
-        LOGE("%s: Failed to open input file", path);
-        openssl_log_errors();
-        return SigVerifyResult::Failure;
-    }
-
     ScopedBIO bio_sig_in(BIO_new_file(sig_path, "rb"), BIO_free);
     if (!bio_sig_in) {
         LOGE("%s: Failed to open signature file", sig_path);
@@ -130,14 +125,22 @@ static SigVerifyResult verify_signature_with_key(const char *path,
         return SigVerifyResult::Failure;
     }
 
-    ret = sign::verify_data(bio_data_in.get(), bio_sig_in.get(), public_key,
+    ret = sign::verify_data(bio_data_in, bio_sig_in.get(), public_key,
                             &valid);
 
     return ret ? (valid ? SigVerifyResult::Valid : SigVerifyResult::Invalid)
             : SigVerifyResult::Failure;
 }
 
-SigVerifyResult verify_signature(const char *path, const char *sig_path)
+/*!
+ * \brief Verify data against all valid certificates
+ *
+ * \param open_data Function that returns a new BIO for reading the data. It is
+ *                  called once per certificate since verification consumes the
+ *                  stream.
+ */
+static SigVerifyResult verify_signature_impl(
+        const std::function<ScopedBIO()> &open_data, const char *sig_path)
 {
     for (const std::string &hex_der : valid_certs) {
         std::string der;
@@ -175,8 +178,13 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
             return SigVerifyResult::Failure;
         }
 
-        SigVerifyResult result =
-                verify_signature_with_key(path, sig_path, public_key.get());
+        ScopedBIO bio_data_in = open_data();
+        if (!bio_data_in) {
+            return SigVerifyResult::Failure;
+        }
+
+        SigVerifyResult result = verify_signature_with_key(
+                bio_data_in.get(), sig_path, public_key.get());
         if (result == SigVerifyResult::Invalid) {
             // Keep trying ...
             continue;
@@ -188,6 +196,36 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
     return SigVerifyResult::Invalid;
 }
 
+SigVerifyResult verify_signature(const char *path, const char *sig_path)
+{
+    return verify_signature_impl([&] {
+        ScopedBIO bio(BIO_new_file(path, "rb"), BIO_free);
+        if (!bio) {
+            LOGE("%s: Failed to open input file", path);
+            openssl_log_errors();
+        }
+        return bio;
+    }, sig_path);
+}
+
+/*!
+ * \brief Verify in-memory data against a signature file
+ *
+ * This allows data to be verified before it is written anywhere.
+ */
+SigVerifyResult verify_signature_data(const void *data, size_t size,
+                                      const char *sig_path)
+{
+    return verify_signature_impl([&] {
+        ScopedBIO bio(BIO_new_mem_buf(data, static_cast<int>(size)), BIO_free);
+        if (!bio) {
+            LOGE("Failed to create BIO for input data");
+            openssl_log_errors();
+        }
+        return bio;
+    }, sig_path);
+}
+
 static void sigverify_usage(FILE *stream)
 {
     fprintf(stream,
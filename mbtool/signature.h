@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 namespace mb
 {
 
@@ -30,6 +32,8 @@ enum class SigVerifyResult
 };
 
 SigVerifyResult verify_signature(const char *path, const char *sig_path);
+SigVerifyResult verify_signature_data(const void *data, size_t size,
+                                      const char *sig_path);
 
 int sigverify_main(int argc, char *argv[]);
 
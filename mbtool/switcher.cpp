@@ -37,6 +37,7 @@
 #include "mbutil/copy.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
+#include "mbutil/hash.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
@@ -350,20 +351,32 @@ SwitchRomResult switch_rom(const std::string &id,
     std::unordered_map<std::string, std::string> props;
     checksums_read(&props);
 
-    for (Flashable &f : flashables) {
-        // If memory becomes an issue, an alternative method is to create a
-        // temporary directory in /data/multiboot/ that's only writable by root
-        // and copy the images there.
-        if (!util::file_read_all(f.image, f.data)) {
+    // If memory becomes an issue, an alternative method is to create a
+    // temporary directory in /data/multiboot/ that's only writable by root
+    // and copy the images there.
+    std::vector<util::Sha512Job> jobs(flashables.size());
+    for (size_t i = 0; i < flashables.size(); ++i) {
+        jobs[i].path = flashables[i].image;
+        jobs[i].read_data = true;
+    }
+
+    // Each image is read into memory and hashed in a single pass. The images
+    // are processed concurrently.
+    util::sha512_hash_multiple(jobs, 0);
+
+    for (size_t i = 0; i < flashables.size(); ++i) {
+        Flashable &f = flashables[i];
+        util::Sha512Job &job = jobs[i];
+
+        if (!job.success) {
             LOGE("%s: Failed to read image: %s",
-                 f.image.c_str(), strerror(errno));
+                 f.image.c_str(), strerror(job.error));
             return SwitchRomResult::Failed;
         }
 
         // Get actual sha512sum
-        unsigned char digest[SHA512_DIGEST_LENGTH];
-        SHA512(f.data.data(), f.data.size(), digest);
-        f.hash = util::hex_string(digest, SHA512_DIGEST_LENGTH);
+        f.data.swap(job.data);
+        f.hash = util::hex_string(job.digest, SHA512_DIGEST_LENGTH);
 
         if (force_update_checksums) {
             checksums_update(&props, id, util::base_name(f.image), f.hash);
@@ -456,17 +469,14 @@ bool set_kernel(const std::string &id, const std::string &boot_blockdev)
         return false;
     }
 
-    std::vector<unsigned char> data;
-
-    if (!util::file_read_all(boot_blockdev, data)) {
-        LOGE("%s: Failed to read block device: %s",
-             boot_blockdev.c_str(), strerror(errno));
+    // Copy the boot partition and compute its sha512sum in a single pass
+    unsigned char digest[SHA512_DIGEST_LENGTH];
+    if (!util::sha512_copy_contents(boot_blockdev, bootimg_path, digest)) {
+        LOGE("%s: Failed to copy block device to %s: %s",
+             boot_blockdev.c_str(), bootimg_path.c_str(), strerror(errno));
         return false;
     }
 
-    // Get actual sha512sum
-    unsigned char digest[SHA512_DIGEST_LENGTH];
-    SHA512(data.data(), data.size(), digest);
     std::string hash = util::hex_string(digest, SHA512_DIGEST_LENGTH);
 
     // Add to checksums.prop
@@ -477,14 +487,6 @@ bool set_kernel(const std::string &id, const std::string &boot_blockdev)
     // NOTE: This function isn't responsible for updating the checksums for
     //       any extra images. We don't want to mask any malicious changes.
 
-    // Cast is okay. The data is just passed to fwrite (ie. no signed
-    // extension issues)
-    if (!util::file_write_data(bootimg_path, data.data(), data.size())) {
-        LOGE("%s: Failed to write image: %s",
-             bootimg_path.c_str(), strerror(errno));
-        return false;
-    }
-
     LOGD("Updating checksums file");
     checksums_write(props);
 
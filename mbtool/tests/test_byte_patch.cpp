@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <cstring>
+
+#include "byte_patch.h"
+
+using namespace mb;
+
+static const unsigned char source[] = {
+    0x49, 0x01, 0x00, 0x54, 0x01, 0x14, 0x40, 0xB9,
+};
+static const unsigned char target[] = {
+    0xA1, 0x02, 0x00, 0x54, 0x01, 0x14, 0x40, 0xB9,
+};
+
+// Returns the input in reads that end at the given offsets, and then in reads
+// of the requested size
+struct SplitReader
+{
+    const std::vector<unsigned char> &data;
+    std::vector<size_t> splits;
+    size_t pos = 0;
+    size_t calls = 0;
+
+    bool operator()(void *buf, size_t size, size_t &bytes_read)
+    {
+        ++calls;
+
+        size_t end = data.size();
+        for (size_t split : splits) {
+            if (split > pos) {
+                end = std::min(end, split);
+                break;
+            }
+        }
+
+        bytes_read = std::min(size, end - pos);
+        memcpy(buf, data.data() + pos, bytes_read);
+        pos += bytes_read;
+        return true;
+    }
+};
+
+struct BytePatchTest : testing::Test
+{
+    std::vector<unsigned char> _input;
+    std::vector<unsigned char> _output;
+    std::vector<BytePatch> _patches{
+        { source, target, sizeof(source), 0, {} },
+    };
+
+    // Filler that never contains a partial match
+    void add_filler(size_t size)
+    {
+        _input.insert(_input.end(), size, 0xAA);
+    }
+
+    void add_source()
+    {
+        _input.insert(_input.end(), source, source + sizeof(source));
+    }
+
+    bool copy(std::vector<size_t> splits)
+    {
+        _output.clear();
+
+        SplitReader reader{_input, std::move(splits)};
+
+        return copy_data_patched(reader, [&](const void *buf, size_t size) {
+            auto ptr = static_cast<const unsigned char *>(buf);
+            _output.insert(_output.end(), ptr, ptr + size);
+            return true;
+        }, _patches);
+    }
+
+    std::vector<unsigned char> expected(const std::vector<uint64_t> &offsets)
+    {
+        std::vector<unsigned char> result(_input);
+        for (uint64_t offset : offsets) {
+            memcpy(result.data() + offset, target, sizeof(target));
+        }
+        return result;
+    }
+};
+
+TEST_F(BytePatchTest, MatchStraddlingReads)
+{
+    add_filler(100);
+    add_source();
+    add_filler(100);
+
+    // Split the input at every offset within the pattern
+    for (size_t i = 1; i < sizeof(source); ++i) {
+        ASSERT_TRUE(copy({ 100 + i }));
+        ASSERT_EQ(_patches[0].offsets, std::vector<uint64_t>{ 100 })
+                << "Split at pattern offset " << i;
+        ASSERT_EQ(_output, expected({ 100 }))
+                << "Split at pattern offset " << i;
+    }
+}
+
+TEST_F(BytePatchTest, MatchStraddlingSingleByteReads)
+{
+    add_filler(10);
+    add_source();
+    add_source();
+    add_filler(3);
+
+    std::vector<size_t> splits(_input.size());
+    for (size_t i = 0; i < splits.size(); ++i) {
+        splits[i] = i + 1;
+    }
+
+    ASSERT_TRUE(copy(splits));
+    ASSERT_EQ(_patches[0].offsets,
+              (std::vector<uint64_t>{ 10, 10 + sizeof(source) }));
+    ASSERT_EQ(_output, expected({ 10, 10 + sizeof(source) }));
+}
+
+TEST_F(BytePatchTest, MatchStraddlingFullSizeReads)
+{
+    // The reader returns as much data as requested, so the chunks are split at
+    // the copy buffer size
+    const std::vector<uint64_t> offsets{
+        10240 - 3,
+        2 * 10240 - 3 + sizeof(source),
+    };
+
+    add_filler(10240 - 3);
+    add_source();
+    add_filler(10240);
+    add_source();
+
+    ASSERT_TRUE(copy({}));
+    ASSERT_EQ(_patches[0].offsets, offsets);
+    ASSERT_EQ(_output, expected(offsets));
+}
+
+TEST_F(BytePatchTest, MatchAtEndOfInput)
+{
+    add_filler(50);
+    add_source();
+
+    // The last read ends exactly at the end of the pattern, in the middle of
+    // it, or at its start
+    for (size_t split : { _input.size(), _input.size() - 1, size_t(50) }) {
+        ASSERT_TRUE(copy({ split }));
+        ASSERT_EQ(_patches[0].offsets, std::vector<uint64_t>{ 50 })
+                << "Split at offset " << split;
+        ASSERT_EQ(_output, expected({ 50 }))
+                << "Split at offset " << split;
+    }
+}
+
+TEST_F(BytePatchTest, NoMatch)
+{
+    add_filler(100);
+    add_source();
+    _input[100 + sizeof(source) - 1] ^= 0xFF;
+    add_filler(20);
+    // Truncated pattern at the end of the input
+    _input.insert(_input.end(), source, source + sizeof(source) - 1);
+
+    for (size_t split : { size_t(0), size_t(104), _input.size() - 3 }) {
+        ASSERT_TRUE(copy({ split }));
+        ASSERT_TRUE(_patches[0].offsets.empty())
+                << "Split at offset " << split;
+        ASSERT_EQ(_output, _input)
+                << "Split at offset " << split;
+    }
+}
+
+TEST_F(BytePatchTest, MaxMatches)
+{
+    add_source();
+    add_filler(5);
+    add_source();
+    add_filler(5);
+    add_source();
+
+    _patches[0].max_matches = 2;
+
+    ASSERT_TRUE(copy({ 4, 17, 20 }));
+    ASSERT_EQ(_patches[0].offsets,
+              (std::vector<uint64_t>{ 0, sizeof(source) + 5 }));
+    ASSERT_EQ(_output, expected({ 0, sizeof(source) + 5 }));
+}
+
+TEST_F(BytePatchTest, ReadFailure)
+{
+    add_filler(100);
+
+    ASSERT_FALSE(copy_data_patched(
+            [](void *, size_t, size_t &) { return false; },
+            [](const void *, size_t) { return true; },
+            _patches));
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "initwrapper/coldboot.h"
+
+// Builds a fake sysfs tree and uses inotify to record the order in which the
+// uevent files are written
+struct ColdbootTest : testing::Test
+{
+    std::string _root;
+    int _inotify_fd = -1;
+    // Watch descriptor -> directory relative to _root
+    std::unordered_map<int, std::string> _watches;
+    // Directories whose uevent file should be written
+    std::vector<std::string> _uevent_dirs;
+
+    void SetUp() override
+    {
+        char tmpl[] = "/tmp/mbtool-coldboot-XXXXXX";
+        ASSERT_NE(mkdtemp(tmpl), nullptr);
+        _root = tmpl;
+
+        _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        ASSERT_GE(_inotify_fd, 0);
+    }
+
+    void TearDown() override
+    {
+        if (_inotify_fd >= 0) {
+            close(_inotify_fd);
+        }
+        if (!_root.empty()) {
+            nftw(_root.c_str(), &remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        }
+    }
+
+    static int remove_entry(const char *path, const struct stat *sb,
+                            int type, struct FTW *ftw)
+    {
+        (void) sb;
+        (void) type;
+        (void) ftw;
+        return remove(path);
+    }
+
+    void make_dir(const std::string &path, bool uevent, bool expected = true)
+    {
+        std::string full_path = _root + path;
+        ASSERT_EQ(mkdir(full_path.c_str(), 0755), 0);
+
+        if (uevent) {
+            int fd = open((full_path + "/uevent").c_str(),
+                          O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            ASSERT_GE(fd, 0);
+            close(fd);
+
+            if (expected) {
+                _uevent_dirs.push_back(path);
+            }
+        }
+
+        int wd = inotify_add_watch(_inotify_fd, full_path.c_str(),
+                                   IN_OPEN | IN_CLOSE_WRITE);
+        ASSERT_GE(wd, 0);
+        _watches[wd] = path;
+    }
+
+    // Every second directory has no uevent file, like in the real sysfs
+    void make_tree(const std::string &path, int depth, int fanout)
+    {
+        for (int i = 0; i < fanout; ++i) {
+            std::string child = path + "/dev" + std::to_string(i);
+            make_dir(child, i % 2 == 0);
+            if (depth > 1) {
+                make_tree(child, depth - 1, fanout);
+            }
+        }
+    }
+
+    // Coldboot never writes to uevent files more than once without another
+    // event in between, so inotify will not coalesce the writes
+    std::vector<std::string> read_written_dirs()
+    {
+        std::vector<std::string> dirs;
+        alignas(struct inotify_event) char buf[16384];
+        ssize_t n;
+
+        while ((n = read(_inotify_fd, buf, sizeof(buf))) > 0) {
+            for (char *ptr = buf; ptr < buf + n;) {
+                auto event = reinterpret_cast<struct inotify_event *>(ptr);
+                EXPECT_FALSE(event->mask & IN_Q_OVERFLOW);
+
+                if ((event->mask & IN_CLOSE_WRITE) && event->len > 0
+                        && strcmp(event->name, "uevent") == 0) {
+                    dirs.push_back(_watches[event->wd]);
+                }
+
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        return dirs;
+    }
+
+    void make_sysfs()
+    {
+        make_dir("/class", false);
+        make_dir("/block", false);
+        make_dir("/devices", false);
+
+        make_tree("/class", 2, 3);
+        make_tree("/block", 1, 4);
+        // Deeper than the depth at which subtrees are no longer split across
+        // worker threads
+        make_tree("/devices", 6, 3);
+
+        // Hidden directories and symlinks are not followed
+        make_dir("/devices/.hidden", true, false);
+        ASSERT_EQ(symlink("../devices/dev0",
+                          (_root + "/class/dev0/link").c_str()), 0);
+
+        // Discard the events from creating the tree
+        read_written_dirs();
+    }
+};
+
+TEST_F(ColdbootTest, WritesEachUeventOnceParentsFirst)
+{
+    make_sysfs();
+
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_CLOEXEC | O_NONBLOCK), 0);
+
+    coldboot(_root, fds[0], [](int fd) {
+        (void) fd;
+    });
+
+    close(fds[0]);
+    close(fds[1]);
+
+    auto written = read_written_dirs();
+
+    std::unordered_map<std::string, size_t> order;
+    for (size_t i = 0; i < written.size(); ++i) {
+        EXPECT_TRUE(order.emplace(written[i], i).second)
+                << written[i] << "/uevent written more than once";
+    }
+
+    EXPECT_EQ(order.find("/devices/.hidden"), order.end());
+    EXPECT_EQ(written.size(), _uevent_dirs.size());
+
+    for (auto const &dir : _uevent_dirs) {
+        auto it = order.find(dir);
+        ASSERT_NE(it, order.end()) << dir << "/uevent not written";
+
+        // The nearest ancestor with a uevent file must come first
+        std::string parent = dir;
+        while (true) {
+            parent.erase(parent.rfind('/'));
+            if (parent.empty()) {
+                break;
+            }
+
+            auto parent_it = order.find(parent);
+            if (parent_it != order.end()) {
+                EXPECT_LT(parent_it->second, it->second)
+                        << parent << " announced after " << dir;
+                break;
+            }
+        }
+    }
+}
+
+TEST_F(ColdbootTest, DrainsUeventFd)
+{
+    make_sysfs();
+
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_CLOEXEC | O_NONBLOCK), 0);
+
+    // Pretend that events are pending before the walk starts
+    static const char events[] = "0123456789";
+    ASSERT_EQ(write(fds[1], events, sizeof(events)),
+              static_cast<ssize_t>(sizeof(events)));
+
+    size_t received = 0;
+    int calls = 0;
+
+    coldboot(_root, fds[0], [&](int fd) {
+        EXPECT_EQ(fd, fds[0]);
+        ++calls;
+
+        char buf[4];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            received += static_cast<size_t>(n);
+        }
+    });
+
+    close(fds[0]);
+    close(fds[1]);
+
+    EXPECT_GE(calls, 1);
+    EXPECT_EQ(received, sizeof(events));
+}
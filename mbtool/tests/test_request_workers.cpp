@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "request_workers.h"
+
+using namespace mb;
+
+// Requests are a single byte and the handlers write that byte back as the
+// response
+struct RequestWorkersTest : testing::Test
+{
+    int _fds[2] = { -1, -1 };
+
+    void SetUp() override
+    {
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, _fds), 0)
+                << strerror(errno);
+    }
+
+    void TearDown() override
+    {
+        for (int fd : _fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    bool respond(const std::vector<uint8_t> &data)
+    {
+        return write(_fds[0], data.data(), data.size())
+                == static_cast<ssize_t>(data.size());
+    }
+
+    std::vector<uint8_t> read_responses(size_t count)
+    {
+        std::vector<uint8_t> buf(count);
+        size_t total = 0;
+
+        while (total < count) {
+            ssize_t n = read(_fds[1], buf.data() + total, count - total);
+            if (n <= 0) {
+                break;
+            }
+            total += static_cast<size_t>(n);
+        }
+
+        buf.resize(total);
+        return buf;
+    }
+};
+
+TEST_F(RequestWorkersTest, SingleWorkerRespondsInOrder)
+{
+    constexpr size_t count = 64;
+
+    RequestWorkers workers(_fds[0], 1, 4,
+                           [&](const std::vector<uint8_t> &data) {
+        return respond(data);
+    });
+
+    for (size_t i = 0; i < count; ++i) {
+        ASSERT_TRUE(workers.submit({ static_cast<uint8_t>(i) }));
+    }
+
+    auto responses = read_responses(count);
+    ASSERT_EQ(responses.size(), count);
+
+    for (size_t i = 0; i < count; ++i) {
+        EXPECT_EQ(responses[i], i);
+    }
+}
+
+TEST_F(RequestWorkersTest, MultipleWorkersRespondToEveryRequest)
+{
+    constexpr size_t count = 64;
+
+    RequestWorkers workers(_fds[0], 4, 4,
+                           [&](const std::vector<uint8_t> &data) {
+        return respond(data);
+    });
+
+    for (size_t i = 0; i < count; ++i) {
+        ASSERT_TRUE(workers.submit({ static_cast<uint8_t>(i) }));
+    }
+
+    auto responses = read_responses(count);
+    ASSERT_EQ(responses.size(), count);
+
+    std::vector<bool> seen(count);
+    for (uint8_t r : responses) {
+        ASSERT_LT(r, count);
+        EXPECT_FALSE(seen[r]) << "Duplicate response " << int(r);
+        seen[r] = true;
+    }
+}
+
+TEST_F(RequestWorkersTest, FailureShutsDownConnection)
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool release = false;
+    std::atomic<int> calls{0};
+
+    RequestWorkers workers(_fds[0], 1, 1, [&](const std::vector<uint8_t> &) {
+        ++calls;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]{ return release; });
+        return false;
+    });
+
+    // The first request is taken by the worker and the second fills the queue
+    ASSERT_TRUE(workers.submit({ 0 }));
+    ASSERT_TRUE(workers.submit({ 1 }));
+
+    // This blocks until the failure since the queue is full
+    auto blocked = std::async(std::launch::async, [&]{
+        return workers.submit({ 2 });
+    });
+    EXPECT_EQ(blocked.wait_for(std::chrono::milliseconds(100)),
+              std::future_status::timeout);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    cv.notify_all();
+
+    EXPECT_FALSE(blocked.get());
+
+    // The connection thread's reads return EOF
+    char c;
+    EXPECT_EQ(read(_fds[1], &c, 1), 0);
+    EXPECT_EQ(read(_fds[0], &c, 1), 0);
+
+    EXPECT_FALSE(workers.submit({ 3 }));
+
+    workers.stop();
+
+    // Queued requests are not run after a failure
+    EXPECT_EQ(calls, 1);
+}
+
+TEST_F(RequestWorkersTest, StopDiscardsQueuedRequests)
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool started = false;
+    bool release = false;
+    std::atomic<int> calls{0};
+
+    RequestWorkers workers(_fds[0], 1, 4, [&](const std::vector<uint8_t> &) {
+        ++calls;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        started = true;
+        cv.notify_all();
+        cv.wait(lock, [&]{ return release; });
+        return true;
+    });
+
+    ASSERT_TRUE(workers.submit({ 0 }));
+    ASSERT_TRUE(workers.submit({ 1 }));
+    ASSERT_TRUE(workers.submit({ 2 }));
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]{ return started; });
+    }
+
+    auto stopped = std::async(std::launch::async, [&]{
+        workers.stop();
+    });
+
+    // Let stop() discard the queue before the running request completes
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    cv.notify_all();
+
+    stopped.get();
+
+    EXPECT_EQ(calls, 1);
+}
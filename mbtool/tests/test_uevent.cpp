@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2017  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/netlink.h>
+
+#include "initwrapper/cutils/uevent.h"
+
+static const char fake_uevent[] =
+        "add@/devices/fake\0ACTION=add\0DEVPATH=/devices/fake\0SUBSYSTEM=block";
+
+// A uevent socket that only receives messages sent directly to it, so that
+// real events from the host do not interfere with the test
+struct UeventTest : testing::Test
+{
+    int _fd = -1;
+    int _feeder_fd = -1;
+    uint32_t _port = 0;
+
+    void SetUp() override
+    {
+        _fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                     NETLINK_KOBJECT_UEVENT);
+        ASSERT_GE(_fd, 0) << strerror(errno);
+
+        int on = 1;
+        ASSERT_EQ(setsockopt(_fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)),
+                  0);
+
+        struct sockaddr_nl addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        ASSERT_EQ(bind(_fd, reinterpret_cast<struct sockaddr *>(&addr),
+                       sizeof(addr)), 0) << strerror(errno);
+
+        socklen_t addr_len = sizeof(addr);
+        ASSERT_EQ(getsockname(_fd, reinterpret_cast<struct sockaddr *>(&addr),
+                              &addr_len), 0);
+        _port = addr.nl_pid;
+
+        _feeder_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+                            NETLINK_KOBJECT_UEVENT);
+        ASSERT_GE(_feeder_fd, 0) << strerror(errno);
+    }
+
+    void TearDown() override
+    {
+        if (_fd >= 0) {
+            close(_fd);
+        }
+        if (_feeder_fd >= 0) {
+            close(_feeder_fd);
+        }
+    }
+
+    void send_fake_uevent()
+    {
+        struct sockaddr_nl addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_pid = _port;
+
+        ASSERT_EQ(sendto(_feeder_fd, fake_uevent, sizeof(fake_uevent), 0,
+                         reinterpret_cast<struct sockaddr *>(&addr),
+                         sizeof(addr)),
+                  static_cast<ssize_t>(sizeof(fake_uevent)))
+                << strerror(errno);
+    }
+};
+
+TEST_F(UeventTest, BatchReceiveDropsNonKernelSenders)
+{
+    constexpr int sent = 5;
+    for (int i = 0; i < sent; ++i) {
+        send_fake_uevent();
+    }
+
+    char bufs[8][256];
+    struct iovec iov[8];
+    ssize_t lengths[8];
+
+    memset(bufs, 'x', sizeof(bufs));
+    for (int i = 0; i < 8; ++i) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = sizeof(bufs[i]);
+    }
+
+    ASSERT_EQ(uevent_kernel_multicast_recv_batch(_fd, iov, lengths, 8), sent);
+
+    static const char zeros[sizeof(bufs[0])] = {};
+    for (int i = 0; i < sent; ++i) {
+        EXPECT_EQ(lengths[i], -1);
+        EXPECT_EQ(memcmp(bufs[i], zeros, sizeof(zeros)), 0)
+                << "Message " << i << " was not cleared";
+    }
+
+    // Everything was consumed
+    ASSERT_EQ(uevent_kernel_multicast_recv_batch(_fd, iov, lengths, 8), -1);
+    ASSERT_EQ(errno, EAGAIN);
+}
+
+TEST_F(UeventTest, BatchReceiveLimitsBatchSize)
+{
+    constexpr int sent = UEVENT_RECV_BATCH_MAX + 4;
+    for (int i = 0; i < sent; ++i) {
+        send_fake_uevent();
+    }
+
+    static char bufs[sent][256];
+    struct iovec iov[sent];
+    ssize_t lengths[sent];
+
+    for (int i = 0; i < sent; ++i) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = sizeof(bufs[i]);
+    }
+
+    ASSERT_EQ(uevent_kernel_multicast_recv_batch(_fd, iov, lengths, sent),
+              UEVENT_RECV_BATCH_MAX);
+    ASSERT_EQ(uevent_kernel_multicast_recv_batch(_fd, iov, lengths, sent),
+              sent - UEVENT_RECV_BATCH_MAX);
+}
@@ -19,11 +19,12 @@
 
 #define FUSE_USE_VERSION 26
 
-#include <mutex>
-#include <new>
+#include <algorithm>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -56,6 +57,7 @@
 #endif
 
 // libmbcommon
+#include "mbcommon/endian.h"
 #include "mbcommon/file.h"
 #include "mbcommon/file/standard.h"
 #include "mbcommon/optional.h"
@@ -69,15 +71,15 @@
 #define OFF_T off_t
 #endif
 
+using ChunkInfo = mb::sparse::detail::ChunkInfo;
+
+static int source_fd = -1;
 static char source_fd_path[50];
 static uint64_t sparse_size;
 
-struct context
-{
-    mb::StandardFile source_file;
-    mb::sparse::SparseFile sparse_file;
-    std::mutex mutex;
-};
+// The chunk table is loaded once before mounting and is never modified
+// afterwards, so reads can use it from any thread without locking
+static std::vector<ChunkInfo> chunks;
 
 static mb::optional<int> extract_errno(std::error_code ec)
 {
@@ -100,80 +102,103 @@ static int fuse_open(const char *path, fuse_file_info *fi)
         return -EROFS;
     }
 
-    context *ctx = new(std::nothrow) context();
-    if (!ctx) {
-        return -ENOMEM;
-    }
-
-    auto ret = ctx->source_file.open(source_fd_path,
-                                     mb::FileOpenMode::ReadOnly);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open file: %s\n",
-                source_fd_path, ret.error().message().c_str());
-        delete ctx;
-        return -extract_errno(ret.error()).value_or(EIO);
-    }
-
-    ret = ctx->sparse_file.open(&ctx->source_file);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open sparse file: %s\n",
-                source_fd_path, ret.error().message().c_str());
-        delete ctx;
-        return -extract_errno(ret.error()).value_or(EIO);
-    }
-
-    fi->fh = reinterpret_cast<uint64_t>(ctx);
-
     return 0;
 }
 
 /*!
- * \brief Release callback for fuse
+ * \brief Read raw chunk data from the source file at the specified offset
  */
-static int fuse_release(const char *path, fuse_file_info *fi)
+static int read_raw_data(char *buf, size_t size, uint64_t src_offset)
 {
-    (void) path;
+    while (size > 0) {
+        ssize_t n = pread64(source_fd, buf, size,
+                            static_cast<off64_t>(src_offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        } else if (n == 0) {
+            // Source file is truncated
+            return -EIO;
+        }
 
-    delete reinterpret_cast<context *>(fi->fh);
+        buf += n;
+        size -= static_cast<size_t>(n);
+        src_offset += static_cast<uint64_t>(n);
+    }
 
     return 0;
 }
 
 /*!
- * \brief Read from sparse file
+ * \brief Read callback for fuse
  *
- * \warning Bad stuff will happen if \a ctx->mutex is not locked when this
- *          function is called
+ * This only uses positional reads on the source file and the read-only chunk
+ * table, so it is safe to call concurrently.
  */
-static int fuse_read_locked(context *ctx, char *buf, size_t size,
-                            OFF_T offset)
+static int fuse_read(const char *path, char *buf, size_t size, OFF_T offset,
+                     fuse_file_info *fi)
 {
-    // Seek to position
-    auto new_offset = ctx->sparse_file.seek(offset, SEEK_SET);
-    if (!new_offset) {
-        return -extract_errno(new_offset.error()).value_or(EIO);
+    (void) path;
+    (void) fi;
+
+    if (offset < 0) {
+        return -EINVAL;
     }
 
-    auto n = ctx->sparse_file.read(buf, size);
-    if (!n) {
-        return -extract_errno(n.error()).value_or(EIO);
+    uint64_t cur = static_cast<uint64_t>(offset);
+    if (cur >= sparse_size) {
+        return 0;
     }
 
-    return static_cast<int>(n.value());
-}
+    size = static_cast<size_t>(std::min<uint64_t>(size, sparse_size - cur));
+    size = std::min<size_t>(size, INT_MAX);
 
-/*!
- * \brief Read callback for fuse
- */
-static int fuse_read(const char *path, char *buf, size_t size, OFF_T offset,
-                     fuse_file_info *fi)
-{
-    (void) path;
+    // Find first chunk that ends after the offset
+    auto it = std::upper_bound(chunks.begin(), chunks.end(), cur,
+                               [](uint64_t o, const ChunkInfo &ci) {
+        return o < ci.end;
+    });
+
+    size_t total = 0;
 
-    context *ctx = reinterpret_cast<context *>(fi->fh);
+    for (; total < size && it != chunks.end(); ++it) {
+        if (it->begin == it->end) {
+            continue;
+        }
 
-    std::lock_guard<std::mutex> lock(ctx->mutex);
-    return fuse_read_locked(ctx, buf, size, offset);
+        uint64_t diff = cur - it->begin;
+        size_t to_read = static_cast<size_t>(
+                std::min<uint64_t>(size - total, it->end - cur));
+
+        switch (it->type) {
+        case mb::sparse::detail::CHUNK_TYPE_RAW: {
+            int ret = read_raw_data(buf + total, to_read, it->raw_begin + diff);
+            if (ret < 0) {
+                return ret;
+            }
+            break;
+        }
+        case mb::sparse::detail::CHUNK_TYPE_FILL: {
+            uint32_t fill_val = mb_htole32(it->fill_val);
+            auto fill_bytes = reinterpret_cast<unsigned char *>(&fill_val);
+            for (size_t i = 0; i < to_read; ++i) {
+                buf[total + i] = static_cast<char>(
+                        fill_bytes[(diff + i) % sizeof(fill_val)]);
+            }
+            break;
+        }
+        default:
+            memset(buf + total, 0, to_read);
+            break;
+        }
+
+        total += to_read;
+        cur += to_read;
+    }
+
+    return static_cast<int>(total);
 }
 
 /*!
@@ -190,9 +215,9 @@ static int fuse_getattr(const char *path, struct stat *stbuf)
 }
 
 /*!
- * \brief Get size of sparse file (needed for fuse_getattr())
+ * \brief Load size and chunk table of sparse file
  */
-static int get_sparse_file_size()
+static int load_sparse_file()
 {
     mb::StandardFile source_file;
     mb::sparse::SparseFile sparse_file;
@@ -211,7 +236,15 @@ static int get_sparse_file_size()
         return -extract_errno(ret.error()).value_or(EIO);
     }
 
+    auto chunks_ret = sparse_file.chunks();
+    if (!chunks_ret) {
+        fprintf(stderr, "%s: Failed to read sparse chunks: %s\n",
+                source_fd_path, chunks_ret.error().message().c_str());
+        return -extract_errno(chunks_ret.error()).value_or(EIO);
+    }
+
     sparse_size = sparse_file.size();
+    chunks = std::move(chunks_ret.value());
 
     return 0;
 }
@@ -301,8 +334,9 @@ int main(int argc, char *argv[])
         }
         snprintf(source_fd_path, sizeof(source_fd_path),
                  "/proc/self/fd/%d", fd);
+        source_fd = fd;
 
-        if (get_sparse_file_size() < 0) {
+        if (load_sparse_file() < 0) {
             close(fd);
             return EXIT_FAILURE;
         }
@@ -313,7 +347,6 @@ int main(int argc, char *argv[])
     fuse_oper.getattr = fuse_getattr;
     fuse_oper.open    = fuse_open;
     fuse_oper.read    = fuse_read;
-    fuse_oper.release = fuse_release;
 
     int fuse_ret = fuse_main(args.argc, args.argv, &fuse_oper, nullptr);
 
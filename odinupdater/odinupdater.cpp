@@ -18,10 +18,17 @@
  */
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <cerrno>
+#include <climits>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -35,7 +42,6 @@
 // libmbcommon
 #include "mbcommon/error_code.h"
 #include "mbcommon/file/callbacks.h"
-#include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 
@@ -51,10 +57,15 @@
 #include "mbutil/mount.h"
 #include "mbutil/properties.h"
 
-// minizip
+// libarchive
 #include <archive.h>
 #include <archive_entry.h>
 
+// minizip
+#include "minizip/ioandroid.h"
+#include "minizip/ioapi_buf.h"
+#include "minizip/unzip.h"
+
 #define DEBUG_SKIP_FLASH_SYSTEM 0
 #define DEBUG_SKIP_FLASH_CSC    0
 #define DEBUG_SKIP_FLASH_BOOT   0
@@ -73,6 +84,10 @@
 
 #define EFS_SALES_CODE_FILE     "/efs/imei/mps_code.dat"
 
+// Buffers used for passing data from the inflate thread to the write thread
+#define PIPELINE_BUFFER_SIZE    (4 * 1024 * 1024)
+#define PIPELINE_BUFFER_COUNT   4
+
 #define PROP_SYSTEM_DEV         "system"
 #define PROP_BOOT_DEV           "boot"
 
@@ -91,6 +106,13 @@ static int interface;
 static int output_fd;
 static const char *zip_file;
 
+// The firmware zip is opened once and its central directory is indexed so that
+// entries can be opened directly, regardless of their position in the zip
+static unzFile zip_uf = nullptr;
+static zlib_filefunc64_def zip_func;
+static ourbuffer_t zip_iobuf;
+static std::unordered_map<std::string, unz64_file_pos> zip_index;
+
 static char sales_code[10];
 static std::string system_block_dev;
 static std::string boot_block_dev;
@@ -175,45 +197,105 @@ static bool umount_system()
     return WIFEXITED(status) && WEXITSTATUS(status) == 0;
 }
 
-static bool la_open_zip(archive *a, const char *filename)
+static void zip_close()
 {
-    if (archive_read_support_format_zip(a) != ARCHIVE_OK) {
-        error("libarchive: Failed to enable zip support: %s",
-              archive_error_string(a));
+    if (zip_uf) {
+        unzClose(zip_uf);
+        zip_uf = nullptr;
+    }
+    zip_index.clear();
+}
+
+static bool zip_open_and_index()
+{
+    memset(&zip_func, 0, sizeof(zip_func));
+    memset(&zip_iobuf, 0, sizeof(zip_iobuf));
+
+    fill_android_filefunc64(&zip_iobuf.filefunc64);
+    fill_buffer_filefunc64(&zip_func, &zip_iobuf);
+
+    zip_uf = unzOpen2_64(zip_file, &zip_func);
+    if (!zip_uf) {
+        error("minizip: %s: Failed to open zip", zip_file);
         return false;
     }
 
-    if (archive_read_open_filename(a, zip_file, 10240) != ARCHIVE_OK) {
-        error("libarchive: %s: Failed to open zip: %s",
-              filename, archive_error_string(a));
+    // Only the central directory is read here
+    int ret = unzGoToFirstFile(zip_uf);
+    while (ret == UNZ_OK) {
+        unz_file_info64 fi;
+        char name[1024];
+        unz64_file_pos pos;
+
+        ret = unzGetCurrentFileInfo64(zip_uf, &fi, name, sizeof(name),
+                                      nullptr, 0, nullptr, 0);
+        if (ret != UNZ_OK) {
+            break;
+        }
+
+        ret = unzGetFilePos64(zip_uf, &pos);
+        if (ret != UNZ_OK) {
+            break;
+        }
+
+        zip_index.emplace(name, pos);
+
+        ret = unzGoToNextFile(zip_uf);
+    }
+    if (ret != UNZ_END_OF_LIST_OF_FILE) {
+        error("minizip: %s: Failed to read central directory: %d",
+              zip_file, ret);
+        zip_close();
         return false;
     }
 
+    info("Indexed %zu entries in %s", zip_index.size(), zip_file);
+
     return true;
 }
 
-static ExtractResult la_skip_to(archive *a, const char *filename,
-                                archive_entry **entry)
+// Seek directly to an indexed entry and open it for reading. On success, the
+// caller must call zip_close_entry() when done.
+static ExtractResult zip_open_entry(const char *filename, unz_file_info64 *fi)
 {
-    int ret;
-    while ((ret = archive_read_next_header(a, entry)) == ARCHIVE_OK) {
-        const char *name = archive_entry_pathname(*entry);
-        if (!name) {
-            error("libarchive: Failed to get filename");
-            return ExtractResult::Error;
-        }
+    auto it = zip_index.find(filename);
+    if (it == zip_index.end()) {
+        error("minizip: Failed to find %s in zip", filename);
+        return ExtractResult::Missing;
+    }
 
-        if (strcmp(filename, name) == 0) {
-            return ExtractResult::Ok;
-        }
+    int ret = unzGoToFilePos64(zip_uf, &it->second);
+    if (ret != UNZ_OK) {
+        error("minizip: %s: Failed to seek to entry: %d", filename, ret);
+        return ExtractResult::Error;
+    }
+
+    ret = unzGetCurrentFileInfo64(zip_uf, fi, nullptr, 0, nullptr, 0,
+                                  nullptr, 0);
+    if (ret != UNZ_OK) {
+        error("minizip: %s: Failed to get entry info: %d", filename, ret);
+        return ExtractResult::Error;
     }
-    if (ret != ARCHIVE_EOF) {
-        error("libarchive: Failed to read header: %s", archive_error_string(a));
+
+    ret = unzOpenCurrentFile(zip_uf);
+    if (ret != UNZ_OK) {
+        error("minizip: %s: Failed to open entry: %d", filename, ret);
         return ExtractResult::Error;
     }
 
-    error("libarchive: Failed to find %s in zip", filename);
-    return ExtractResult::Missing;
+    return ExtractResult::Ok;
+}
+
+// Close the current entry. This also verifies the CRC32 checksum if the entire
+// entry was read.
+static bool zip_close_entry(const char *filename)
+{
+    int ret = unzCloseCurrentFile(zip_uf);
+    if (ret != UNZ_OK) {
+        error("minizip: %s: Failed to close entry: %d", filename, ret);
+        return false;
+    }
+    return true;
 }
 
 static bool load_sales_code()
@@ -256,39 +338,30 @@ static bool load_block_devs()
     Device device;
 
     {
-        archive *a = archive_read_new();
-        if (!a) {
-            error("Out of memory");
+        unz_file_info64 fi;
+        if (zip_open_entry(DEVICE_JSON_FILE, &fi) != ExtractResult::Ok) {
             return false;
         }
 
-        auto close_archive = mb::finally([&]{
-            archive_read_free(a);
+        auto close_entry = mb::finally([]{
+            unzCloseCurrentFile(zip_uf);
         });
 
-        if (!la_open_zip(a, zip_file)) {
-            return false;
-        }
-
-        archive_entry *entry;
-        if (la_skip_to(a, DEVICE_JSON_FILE, &entry) != ExtractResult::Ok) {
-            return false;
-        }
-
         static constexpr size_t max_size = 10240;
 
-        if (archive_entry_size(entry) >= static_cast<int64_t>(max_size)) {
+        if (fi.uncompressed_size >= max_size) {
             error("%s is too large", DEVICE_JSON_FILE);
             return false;
         }
 
         std::vector<char> buf(max_size);
-        la_ssize_t n;
+        int n;
 
-        n = archive_read_data(a, buf.data(), buf.size() - 1);
+        n = unzReadCurrentFile(zip_uf, buf.data(),
+                               static_cast<uint32_t>(buf.size() - 1));
         if (n < 0) {
-            error("libarchive: %s: Failed to read %s: %s",
-                  zip_file, DEVICE_JSON_FILE, archive_error_string(a));
+            error("minizip: %s: Failed to read %s: %d",
+                  zip_file, DEVICE_JSON_FILE, n);
             return false;
         }
 
@@ -347,15 +420,15 @@ static mb::oc::result<size_t> cb_zip_read(mb::File &file, void *userdata,
 {
     (void) file;
 
-    archive *a = static_cast<archive *>(userdata);
+    unzFile uf = static_cast<unzFile>(userdata);
     uint64_t total = 0;
 
     while (size > 0) {
-        la_ssize_t n = archive_read_data(a, buf, size);
+        auto to_read = static_cast<uint32_t>(std::min<size_t>(size, INT_MAX));
+        int n = unzReadCurrentFile(uf, buf, to_read);
         if (n < 0) {
-            error("libarchive: Failed to read data: %s",
-                  archive_error_string(a));
-            return mb::ec_from_errno(archive_errno(a));
+            error("minizip: Failed to read data: %d", n);
+            return mb::ec_from_errno(EIO);
         } else if (n == 0) {
             break;
         }
@@ -368,34 +441,125 @@ static mb::oc::result<size_t> cb_zip_read(mb::File &file, void *userdata,
     return static_cast<size_t>(total);
 }
 
+struct PipelineBuffer
+{
+    std::vector<char> data;
+    size_t size;
+};
+
+// Blocking queue for passing buffers between threads. pop() returns nullptr
+// once the queue is closed and empty.
+class BufferQueue
+{
+public:
+    void push(PipelineBuffer *buf)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(buf);
+        }
+        _cv.notify_one();
+    }
+
+    PipelineBuffer * pop()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [&]{
+            return _closed || !_queue.empty();
+        });
+
+        if (_queue.empty()) {
+            return nullptr;
+        }
+
+        auto buf = _queue.front();
+        _queue.pop_front();
+        return buf;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = true;
+        }
+        _cv.notify_all();
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<PipelineBuffer *> _queue;
+    bool _closed = false;
+};
+
+// Fill buffers with data from the sparse file until EOF, an error occurs, or
+// the writer stops accepting data
+static bool pipeline_read(mb::File &file, const char *zip_filename,
+                          BufferQueue &free_queue, BufferQueue &full_queue)
+{
+    auto close_full_queue = mb::finally([&]{
+        full_queue.close();
+    });
+
+    while (true) {
+        PipelineBuffer *buf = free_queue.pop();
+        if (!buf) {
+            // Writer failed
+            return false;
+        }
+
+        buf->size = 0;
+
+        while (buf->size < buf->data.size()) {
+            auto n = file.read(buf->data.data() + buf->size,
+                               buf->data.size() - buf->size);
+            if (!n) {
+                error("Failed to read sparse file %s: %s",
+                      zip_filename, n.error().message().c_str());
+                return false;
+            } else if (n.value() == 0) {
+                break;
+            }
+
+            buf->size += n.value();
+        }
+
+        if (buf->size == 0) {
+            return true;
+        }
+
+        bool eof = buf->size < buf->data.size();
+
+        full_queue.push(buf);
+
+        if (eof) {
+            return true;
+        }
+    }
+}
+
 #if DEBUG_SKIP_FLASH_SYSTEM
 MB_UNUSED
 #endif
 static ExtractResult extract_sparse_file(const char *zip_filename,
                                          const char *out_filename)
 {
-    ScopedArchive a{archive_read_new(), &archive_read_free};
     mb::CallbackFile file;
     mb::sparse::SparseFile sparse_file;
-    mb::StandardFile out_file;
 
-    if (!a) {
-        error("Out of memory");
-        return ExtractResult::Error;
-    }
-
-    if (!la_open_zip(a.get(), zip_file)) {
-        return ExtractResult::Error;
-    }
-
-    archive_entry *entry;
-    auto result = la_skip_to(a.get(), zip_filename, &entry);
+    unz_file_info64 fi;
+    auto result = zip_open_entry(zip_filename, &fi);
     if (result != ExtractResult::Ok) {
         return result;
     }
 
+    auto close_entry = mb::finally([]{
+        unzCloseCurrentFile(zip_uf);
+    });
+
     auto open_ret = file.open(nullptr, nullptr, &cb_zip_read, nullptr, nullptr,
-                              nullptr, a.get());
+                              nullptr, zip_uf);
     if (!open_ret) {
         error("Failed to open sparse file in zip: %s",
               open_ret.error().message().c_str());
@@ -409,30 +573,75 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return ExtractResult::Error;
     }
 
-    open_ret = out_file.open(out_filename, mb::FileOpenMode::WriteOnly);
-    if (!open_ret) {
+    int fd = open64(out_filename,
+                    O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC | O_LARGEFILE,
+                    0600);
+    if (fd < 0) {
         error("%s: Failed to open for writing: %s",
-              out_filename, open_ret.error().message().c_str());
+              out_filename, strerror(errno));
         return ExtractResult::Error;
     }
 
-    char buf[10240];
+    auto close_fd = mb::finally([fd]{
+        close(fd);
+    });
+
+    // Inflating and writing to the block device are done on separate threads
+    // so that flashing is limited by the slower of the two instead of their
+    // sum
+    std::vector<PipelineBuffer> buffers(PIPELINE_BUFFER_COUNT);
+    BufferQueue free_queue;
+    BufferQueue full_queue;
+
+    for (auto &buf : buffers) {
+        buf.data.resize(PIPELINE_BUFFER_SIZE);
+        free_queue.push(&buf);
+    }
+
+    bool read_ok = false;
+    std::thread reader([&]{
+        read_ok = pipeline_read(sparse_file, zip_filename,
+                               free_queue, full_queue);
+    });
+
+    auto join_reader = mb::finally([&]{
+        free_queue.close();
+        reader.join();
+    });
+
     uint64_t cur_bytes = 0;
     uint64_t max_bytes = sparse_file.size();
     uint64_t old_bytes = 0;
 
     set_progress(0);
 
-    while (true) {
-        auto n = sparse_file.read(buf, sizeof(buf));
-        if (!n) {
-            error("Failed to read sparse file %s: %s",
-                  zip_filename, n.error().message().c_str());
-            return ExtractResult::Error;
-        } else if (n.value() == 0) {
-            break;
+    while (PipelineBuffer *buf = full_queue.pop()) {
+        size_t offset = 0;
+
+        while (offset < buf->size) {
+            ssize_t n = pwrite64(fd, buf->data.data() + offset,
+                                 buf->size - offset,
+                                 static_cast<off64_t>(cur_bytes));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                error("%s: Failed to write file: %s",
+                      out_filename, strerror(errno));
+                return ExtractResult::Error;
+            } else if (n == 0) {
+                // Retrying would loop forever without making progress
+                error("%s: Failed to write file: %s",
+                      out_filename, strerror(EIO));
+                return ExtractResult::Error;
+            }
+
+            offset += static_cast<size_t>(n);
+            cur_bytes += static_cast<uint64_t>(n);
         }
 
+        free_queue.push(buf);
+
         // Rate limit: update progress only after difference exceeds 0.1%
         double old_ratio = static_cast<double>(old_bytes) / max_bytes;
         double new_ratio = static_cast<double>(cur_bytes) / max_bytes;
@@ -440,27 +649,28 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
             set_progress(new_ratio);
             old_bytes = cur_bytes;
         }
+    }
 
-        char *out_ptr = buf;
+    join_reader.dismiss();
+    reader.join();
 
-        while (n.value() > 0) {
-            auto n_written = out_file.write(buf, n.value());
-            if (!n_written) {
-                error("%s: Failed to write file: %s",
-                      out_filename, n_written.error().message().c_str());
-                return ExtractResult::Error;
-            }
+    if (!read_ok) {
+        return ExtractResult::Error;
+    }
 
-            n.value() -= n_written.value();
-            out_ptr += n_written.value();
-            cur_bytes += n_written.value();
-        }
+    if (fsync(fd) < 0 && errno != EINVAL) {
+        error("%s: Failed to sync file: %s", out_filename, strerror(errno));
+        return ExtractResult::Error;
+    }
+
+    close_fd.dismiss();
+    if (close(fd) < 0) {
+        error("%s: Failed to close file: %s", out_filename, strerror(errno));
+        return ExtractResult::Error;
     }
 
-    auto close_ret = out_file.close();
-    if (!close_ret) {
-        error("%s: Failed to close file: %s",
-              out_filename, close_ret.error().message().c_str());
+    close_entry.dismiss();
+    if (!zip_close_entry(zip_filename)) {
         return ExtractResult::Error;
     }
 
@@ -470,9 +680,8 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
 static ExtractResult extract_raw_file(const char *zip_filename,
                                       const char *out_filename)
 {
-    ScopedArchive a{archive_read_new(), &archive_read_free};
     char buf[10240];
-    la_ssize_t n;
+    int n;
     int fd;
     uint64_t cur_bytes = 0;
     uint64_t max_bytes = 0;
@@ -480,22 +689,17 @@ static ExtractResult extract_raw_file(const char *zip_filename,
     double old_ratio;
     double new_ratio;
 
-    if (!a) {
-        error("Out of memory");
-        return ExtractResult::Error;
-    }
-
-    if (!la_open_zip(a.get(), zip_file)) {
-        return ExtractResult::Error;
-    }
-
-    archive_entry *entry;
-    auto result = la_skip_to(a.get(), zip_filename, &entry);
+    unz_file_info64 fi;
+    auto result = zip_open_entry(zip_filename, &fi);
     if (result != ExtractResult::Ok) {
         return result;
     }
 
-    max_bytes = static_cast<uint64_t>(archive_entry_size(entry));
+    auto close_entry = mb::finally([]{
+        unzCloseCurrentFile(zip_uf);
+    });
+
+    max_bytes = fi.uncompressed_size;
 
     fd = open64(out_filename,
                 O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC | O_LARGEFILE, 0600);
@@ -510,7 +714,7 @@ static ExtractResult extract_raw_file(const char *zip_filename,
 
     set_progress(0);
 
-    while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
+    while ((n = unzReadCurrentFile(zip_uf, buf, sizeof(buf))) > 0) {
         // Rate limit: update progress only after difference exceeds 0.1%
         old_ratio = static_cast<double>(old_bytes) / max_bytes;
         new_ratio = static_cast<double>(cur_bytes) / max_bytes;
@@ -529,13 +733,17 @@ static ExtractResult extract_raw_file(const char *zip_filename,
                 return ExtractResult::Error;
             }
 
-            n -= nwritten;
+            n -= static_cast<int>(nwritten);
             out_ptr += nwritten;
         } while (n > 0);
     }
     if (n != 0) {
-        error("libarchive: %s: Failed to read %s: %s",
-              zip_file, zip_filename, archive_error_string(a.get()));
+        error("minizip: %s: Failed to read %s: %d", zip_file, zip_filename, n);
+        return ExtractResult::Error;
+    }
+
+    close_entry.dismiss();
+    if (!zip_close_entry(zip_filename)) {
         return ExtractResult::Error;
     }
 
@@ -840,6 +1048,15 @@ static bool flash_zip()
         return false;
     }
 
+    // Index the zip once for all of the entries that are extracted below
+    if (!zip_open_and_index()) {
+        return false;
+    }
+
+    auto close_zip = mb::finally([]{
+        zip_close();
+    });
+
     // Load block device info
     if (!load_block_devs()) {
         return false;